@@ -0,0 +1,190 @@
+//
+// Created by user on 6/18/23.
+//
+
+#include <vector>
+#include <memory>
+#include <cstdio>
+#include "iostream"
+#include <stdexcept>
+#include "SpaceShip.h"
+
+#ifndef IRA_BASICSHIP_H
+#define IRA_BASICSHIP_H
+
+/**
+ * @brief The ship model on a hardware float or double-double backend, for searches that evaluate many ships cheaply
+ *        before the winners are verified with SpaceShipHandler.
+ * @details Same getters, setters and lazy evaluation as SpaceShipWrapper, which is the MPFR instantiation of the same
+ *          BasicSpaceShip core; this adds the long double interface. Each stage gets its own copy of its engine, so
+ *          editing an Engine afterwards does not reach a BasicShip; set the stage's engine again instead. With a
+ *          hardware float backend only adding a stage allocates, and the evaluation loops are plain arithmetic.
+ * @tparam Backend A numeric backend from NumericBackend.h.
+ */
+template <typename Backend>
+class BasicShip : public BasicSpaceShip<Backend> {
+public:
+    typedef typename Backend::storage_type storage_type;
+    typedef BasicEngine<Backend> engine_type;
+
+    explicit BasicShip(const Backend& backend = Backend()) : BasicSpaceShip<Backend>(backend) {}
+
+    // ========== CREATORS ==========
+    /**
+     * @brief Adds a stage using the values of an existing engine.
+     * @param dryMass The dry mass of the stage.
+     * @param fuelMass The fuel mass of the stage.
+     * @param engine The engine used in the stage, copied into the stage.
+     * @param stageIdx The index at which to insert the stage (optional).
+     */
+    void addStage(long double dryMass, long double fuelMass, const Engine* engine, int stageIdx = -1) {
+        if (engine == nullptr) {
+            throw std::runtime_error("Null pointer exception");
+        }
+        std::unique_ptr<engine_type> copy(new engine_type(this->backend));
+        this->backend.setMpfr(copy->mass, engine->mass);
+        this->backend.setMpfr(copy->exhaustVelocity, engine->exhaustVelocity);
+        insertStage(dryMass, fuelMass, std::move(copy), stageIdx);
+    }
+
+    /**
+     * @brief Adds a stage with an engine given by value.
+     * @param dryMass The dry mass of the stage.
+     * @param fuelMass The fuel mass of the stage.
+     * @param engineMass Mass of the stage's engine.
+     * @param exhaustVelocity Exhaust velocity of the stage's engine.
+     * @param stageIdx The index at which to insert the stage (optional).
+     */
+    void addStage(long double dryMass, long double fuelMass, long double engineMass, long double exhaustVelocity,
+                  int stageIdx = -1) {
+        std::unique_ptr<engine_type> copy(new engine_type(this->backend));
+        this->backend.set(copy->mass, engineMass);
+        this->backend.set(copy->exhaustVelocity, exhaustVelocity);
+        insertStage(dryMass, fuelMass, std::move(copy), stageIdx);
+    }
+
+    /**
+     * @brief Reserves storage for count more stages, so adding them only allocates their engines.
+     * @param count Number of stages that will be added.
+     */
+    void reserveStages(size_t count) {
+        BasicSpaceShip<Backend>::reserveStages(count);
+        engines.reserve(engines.size() + count);
+    }
+
+    // ========== GETTERS ==========
+    size_t getStageCount() const {
+        return this->stages.size();
+    }
+
+    long double getRemainingMass(uint stageIdx) {
+        this->genRemainingMass();
+        return this->backend.get(this->stages[stageIdx]->remainingMass);
+    }
+
+    long double getStageDryMass(uint stageIdx) const {
+        return this->backend.get(this->stages[stageIdx]->dryMass);
+    }
+
+    long double getStageFuelMass(uint stageIdx) const {
+        return this->backend.get(this->stages[stageIdx]->fuelMass);
+    }
+
+    long double getStageTotalMass(uint stageIdx) const {
+        return this->backend.get(this->stages[stageIdx]->totalMass);
+    }
+
+    long double getStageEngineMass(uint stageIdx) const {
+        return this->backend.get(this->stages[stageIdx]->engine->mass);
+    }
+
+    long double getStageExhaustVelocity(uint stageIdx) const {
+        return this->backend.get(this->stages[stageIdx]->engine->exhaustVelocity);
+    }
+
+    long double getStageDeltaV(uint stageIdx) {
+        this->genDeltaV();
+        return this->backend.get(this->stages[stageIdx]->deltaV);
+    }
+
+    /**
+     * @brief Returns the total mass of the ship, the remaining mass of its first stage.
+     * @return Total mass of the ship.
+     */
+    long double getMass() {
+        if (getStageCount() == 0) {
+            return 0;
+        }
+        return getRemainingMass(0);
+    }
+
+    long double getDeltaV() {
+        this->genDeltaV();
+        return this->backend.get(this->deltaV);
+    }
+
+    /**
+     * @brief Returns the total delta-V in the backend's own type, without converting to long double.
+     * @return Total delta-V of the ship.
+     */
+    const storage_type& getRawDeltaV() {
+        this->genDeltaV();
+        return this->deltaV;
+    }
+
+    // ========== SETTERS ==========
+    void setStageDryMass(uint stageIdx, const long double newMass) {
+        typename Backend::Scratch value(this->backend);
+        this->backend.set(value, newMass);
+        BasicSpaceShip<Backend>::setStageDryMass(this->stages[stageIdx], value);
+    }
+
+    void setStageFuelMass(uint stageIdx, const long double newMass) {
+        typename Backend::Scratch value(this->backend);
+        this->backend.set(value, newMass);
+        BasicSpaceShip<Backend>::setStageFuelMass(this->stages[stageIdx], value);
+    }
+
+    void setStageEngine(uint stageIdx, const Engine* newEngine) {
+        if (newEngine == nullptr) {
+            throw std::runtime_error("Null pointer exception");
+        }
+        engine_type* engine = engines[stageIdx].get();
+        this->backend.setMpfr(engine->mass, newEngine->mass);
+        this->backend.setMpfr(engine->exhaustVelocity, newEngine->exhaustVelocity);
+        this->genTotalMass(this->stages[stageIdx]);
+    }
+
+    void setStageEngine(uint stageIdx, const long double engineMass, const long double exhaustVelocity) {
+        engine_type* engine = engines[stageIdx].get();
+        this->backend.set(engine->mass, engineMass);
+        this->backend.set(engine->exhaustVelocity, exhaustVelocity);
+        this->genTotalMass(this->stages[stageIdx]);
+    }
+
+protected:
+    std::vector<std::unique_ptr<engine_type>> engines;    /**< Engine of each stage, in burn order. Owned by the
+                                                               ship, unlike SpaceShip's. */
+
+    /**
+     * @brief Adds a stage that uses an engine owned by the ship.
+     * @param stageIdx Index to insert at, or -1 to append.
+     */
+    void insertStage(long double dryMass, long double fuelMass, std::unique_ptr<engine_type> engine, int stageIdx) {
+        typename Backend::Scratch dry(this->backend), fuel(this->backend);
+        this->backend.set(dry, dryMass);
+        this->backend.set(fuel, fuelMass);
+        BasicSpaceShip<Backend>::addStage(dry, fuel, engine.get(), stageIdx);
+        engines.insert(stageIdx != -1 ? engines.begin() + stageIdx : engines.end(), std::move(engine));
+    }
+};
+
+typedef BasicShip<DoubleBackend> DoubleShip;
+typedef BasicShip<LongDoubleBackend> LongDoubleShip;
+typedef BasicShip<DoubleDoubleBackend> DoubleDoubleShip;
+#ifdef IRA_FLOAT128
+typedef BasicShip<Float128Backend> Float128Ship;
+#endif
+
+
+#endif //IRA_BASICSHIP_H
@@ -0,0 +1,410 @@
+//
+// Created by user on 6/16/23.
+//
+
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <unistd.h>
+#include <fcntl.h>
+#include "SpaceShipHandler.h"
+#include "BasicShip.h"
+#include "DeltaVBatch.h"
+#include "SweepCache.h"
+#include "DesignSweep.h"
+#include "RefuelAnalysis.h"
+#include "MonteCarlo.h"
+
+// Benchmarks the core SpaceShip operations over a sweep of stage counts and precisions and prints the results as
+// JSON on stdout. Usage: ira_bench [--seed N] [--min-time-ms N] [--stages a,b,..] [--precisions a,b,..] [--threads N]
+
+namespace {
+    std::atomic<size_t> heapAllocations(0), heapBytes(0);
+
+    void* (*gmpAlloc)(size_t);
+    void* (*gmpRealloc)(void*, size_t, size_t);
+    void (*gmpFree)(void*, size_t);
+
+    // Installed before MpfrScratch::recycleAllocations, so the recycling sits on top of these and only real heap
+    // allocations are counted.
+    void* countingAlloc(size_t size) {
+        heapAllocations.fetch_add(1, std::memory_order_relaxed);
+        heapBytes.fetch_add(size, std::memory_order_relaxed);
+        return gmpAlloc(size);
+    }
+    void* countingRealloc(void* ptr, size_t oldSize, size_t newSize) {
+        heapAllocations.fetch_add(1, std::memory_order_relaxed);
+        heapBytes.fetch_add(newSize, std::memory_order_relaxed);
+        return gmpRealloc(ptr, oldSize, newSize);
+    }
+
+    struct Counters {
+        size_t allocations, bytes;
+    };
+
+    Counters snapshot() {
+        return {heapAllocations.load(std::memory_order_relaxed), heapBytes.load(std::memory_order_relaxed)};
+    }
+
+    struct Options {
+        unsigned long seed = 20230616;
+        double minTimeMs = 50;
+        std::vector<uint> stageCounts = {1, 10, 100, 1000};
+        std::vector<long> precisions = {53, 128, 1024, 8192};
+        unsigned threads = 0;                                               // Pool threads, 0 for every core
+    };
+
+    template <typename T>
+    std::vector<T> parseList(const char* list) {
+        std::vector<T> values;
+        std::string item;
+        for (const char* c = list; ; c++) {
+            if (*c == ',' || *c == '\0') {
+                if (!item.empty()) {
+                    values.push_back((T) std::strtol(item.c_str(), nullptr, 10));
+                }
+                item.clear();
+                if (*c == '\0') {
+                    break;
+                }
+            } else {
+                item += *c;
+            }
+        }
+        return values;
+    }
+
+    FILE* out;                                                              // JSON output; stdout goes to /dev/null
+    bool firstResult = true;
+
+    void report(const char* op, uint stages, long precision, size_t ops, double seconds, size_t allocations) {
+        fprintf(out, "%s\n    {\"op\": \"%s\", \"stages\": %u, \"precision\": %ld, \"ops\": %zu, \"ns_per_op\": %.1f, "
+               "\"allocs_per_op\": %.3f}", firstResult ? "" : ",", op, stages, precision, ops, 1e9 * seconds / ops,
+               (double) allocations / ops);
+        firstResult = false;
+    }
+
+    /**
+     * @brief Runs op until at least minTimeMs has passed and reports the average.
+     * @param setup Called before every op, neither timed nor counted. Used to put the ship back into the state op
+     *              expects.
+     */
+    template <typename Setup, typename Op>
+    void measure(const char* name, uint stages, long precision, const Options& options, Setup setup, Op op) {
+        setup();
+        op();                                                               // Warm up caches and scratch pools
+
+        size_t ops = 0, allocations = 0;
+        double seconds = 0;
+        while (seconds * 1e3 < options.minTimeMs) {
+            setup();
+            const size_t before = heapAllocations.load(std::memory_order_relaxed);
+            auto start = std::chrono::steady_clock::now();
+            op();
+            seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            allocations += heapAllocations.load(std::memory_order_relaxed) - before;
+            ops++;
+        }
+        report(name, stages, precision, ops, seconds, allocations);
+    }
+
+    /**
+     * @brief Measures genDeltaV of a BasicShip with the same stages as ship.
+     */
+    template <typename Backend>
+    void measureBackend(const char* name, SpaceShipWrapper* ship, uint stages, long precision,
+                        const Options& options) {
+        BasicShip<Backend> copy;
+        for (uint i = 0; i < stages; i++) {
+            copy.addStage(ship->getStageDryMass(i), ship->getStageFuelMass(i), ship->getStageEngineMass(i),
+                          ship->getStageExhaustVelocity(i));
+        }
+        const long double topDryMass = copy.getStageDryMass(stages - 1);
+        measure(name, stages, precision, options, [&]() { copy.setStageDryMass(stages - 1, topDryMass); },
+                [&]() { copy.getDeltaV(); });
+    }
+}
+
+// Every allocation made through new is counted as well, so allocs_per_op covers the stage vectors and arenas too.
+// Every form of new and delete is replaced, so no allocation can reach a library operator delete and the other way
+// round. They stay out of line: inlined into a caller, GCC sees free called on memory from operator new and warns
+// (-Wmismatched-new-delete).
+namespace {
+    __attribute__((noinline)) void* countedAlloc(size_t size) noexcept {
+        heapAllocations.fetch_add(1, std::memory_order_relaxed);
+        heapBytes.fetch_add(size, std::memory_order_relaxed);
+        return std::malloc(size ? size : 1);
+    }
+
+    __attribute__((noinline)) void countedFree(void* ptr) noexcept {
+        std::free(ptr);
+    }
+}
+
+void* operator new(size_t size) {
+    void* ptr = countedAlloc(size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+void* operator new[](size_t size) {
+    void* ptr = countedAlloc(size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return countedAlloc(size);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return countedAlloc(size);
+}
+void operator delete(void* ptr) noexcept {
+    countedFree(ptr);
+}
+void operator delete[](void* ptr) noexcept {
+    countedFree(ptr);
+}
+void operator delete(void* ptr, size_t) noexcept {
+    countedFree(ptr);
+}
+void operator delete[](void* ptr, size_t) noexcept {
+    countedFree(ptr);
+}
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    countedFree(ptr);
+}
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    countedFree(ptr);
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--seed")) {
+            options.seed = std::strtoul(argv[i + 1], nullptr, 10);
+        } else if (!strcmp(argv[i], "--min-time-ms")) {
+            options.minTimeMs = std::strtod(argv[i + 1], nullptr);
+        } else if (!strcmp(argv[i], "--stages")) {
+            options.stageCounts = parseList<uint>(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--precisions")) {
+            options.precisions = parseList<long>(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--threads")) {
+            options.threads = (unsigned) std::strtoul(argv[i + 1], nullptr, 10);
+        } else {
+            fprintf(stderr, "[ira_bench] Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    mp_get_memory_functions(&gmpAlloc, &gmpRealloc, &gmpFree);
+    mp_set_memory_functions(countingAlloc, countingRealloc, gmpFree);
+    MpfrScratch::recycleAllocations();
+
+    // printStats writes to stdout, so the JSON goes to a copy of it and stdout itself is silenced.
+    fflush(stdout);
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    const int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    close(devNull);
+    std::vector<std::string> shipReports;
+
+    fprintf(out, "{\n  \"seed\": %lu,\n  \"results\": [", options.seed);
+    for (long precision : options.precisions) {
+        for (uint stageCount : options.stageCounts) {
+            std::mt19937 gen(options.seed);
+            std::uniform_real_distribution<long double> valRange(1, 1'000'000'000.0);
+            std::uniform_int_distribution<uint> stagePick(0, stageCount - 1);
+
+            SpaceShipHandler handler(precision);
+            std::vector<EngineId> engines;
+            std::vector<std::string> names;
+            for (uint i = 0; i < stageCount; i++) {
+                names.push_back("S" + std::to_string(i));
+                engines.push_back(handler.createEngineId(names.back(), valRange(gen), valRange(gen)));
+            }
+            auto build = [&](SpaceShipWrapper* ship) {
+                for (uint i = 0; i < stageCount; i++) {
+                    ship->addStage(valRange(gen), valRange(gen), engines[i]);
+                }
+                ship->getDeltaV();
+            };
+
+            auto* warmUp = handler.addShip();                               // Warm up before measuring a ship
+            build(warmUp);
+            handler.removeShip(warmUp);
+            const Counters shipBefore = snapshot();
+            auto* ship = handler.addShip();
+            build(ship);
+            const Counters shipAfter = snapshot();
+            shipReports.push_back("    {\"stages\": " + std::to_string(stageCount) + ", \"precision\": "
+                                  + std::to_string(precision) + ", \"bytes_per_ship\": "
+                                  + std::to_string(shipAfter.bytes - shipBefore.bytes) + "}");
+
+            SpaceShipWrapper* scratchShip = nullptr;                        // One at a time, replaced every op
+            auto freshScratchShip = [&]() {
+                if (scratchShip != nullptr) {
+                    handler.removeShip(scratchShip);
+                }
+                scratchShip = handler.addShip();
+                for (uint i = 0; i + 1 < stageCount; i++) {
+                    scratchShip->addStage(1, 1, engines[i]);
+                }
+            };
+            measure("addStage.append", stageCount, precision, options, freshScratchShip,
+                    [&]() { scratchShip->addStage(valRange(gen), valRange(gen), engines[0]); scratchShip->getDeltaV(); });
+            measure("addStage.insert", stageCount, precision, options,
+                    [&]() { freshScratchShip(); scratchShip->getDeltaV(); },
+                    [&]() { scratchShip->addStage(valRange(gen), valRange(gen), engines[0], (stageCount - 1) / 2);
+                        scratchShip->getDeltaV(); });
+            handler.removeShip(scratchShip);
+
+            auto noSetup = []() {};
+            measure("setStageDryMass", stageCount, precision, options, noSetup,
+                    [&]() { ship->setStageDryMass(stagePick(gen), valRange(gen)); ship->getDeltaV(); });
+            measure("setStageFuelMass", stageCount, precision, options, noSetup,
+                    [&]() { ship->setStageFuelMass(stagePick(gen), valRange(gen)); ship->getDeltaV(); });
+            measure("setStageEngine", stageCount, precision, options, noSetup,
+                    [&]() { ship->setStageEngine(stagePick(gen), engines[stagePick(gen)]); ship->getDeltaV(); });
+            measure("genDeltaV", stageCount, precision, options,
+                    [&]() { ship->setStageDryMass(stageCount - 1, ship->getStageDryMass(stageCount - 1)); },
+                    [&]() { ship->getDeltaV(); });
+            WorkStealingPool stagePool(options.threads);                    // Every block of 256 stages on a thread
+            ship->setStagePool(&stagePool, 0);
+            measure("genDeltaV.parallel", stageCount, precision, options,
+                    [&]() { ship->setStageDryMass(stageCount - 1, ship->getStageDryMass(stageCount - 1)); },
+                    [&]() { ship->getDeltaV(); });
+            ship->setStagePool(nullptr);
+            ship->setEvaluationMode(EvaluationMode::fast);
+            measure("genDeltaV.fast", stageCount, precision, options,
+                    [&]() { ship->setStageDryMass(stageCount - 1, ship->getStageDryMass(stageCount - 1)); },
+                    [&]() { ship->getDeltaV(); });
+            ship->setEvaluationMode(EvaluationMode::certified, 1e-15, 1e-6);
+            measure("genDeltaV.certified", stageCount, precision, options,
+                    [&]() { ship->setStageDryMass(stageCount - 1, ship->getStageDryMass(stageCount - 1)); },
+                    [&]() { ship->getDeltaV(); });
+            ship->setEvaluationMode(EvaluationMode::exact);
+            measureBackend<DoubleBackend>("genDeltaV.double", ship, stageCount, precision, options);
+            measureBackend<DoubleDoubleBackend>("genDeltaV.doubleDouble", ship, stageCount, precision, options);
+
+            std::vector<std::pair<SpaceShipWrapper*, uint>> fleet;          // Uneven ships, 1 to stageCount stages
+            std::uniform_int_distribution<uint> fleetStages(1, stageCount);
+            for (int j = 0; j < 16; j++) {
+                fleet.push_back({handler.addShip(), fleetStages(gen)});
+                for (uint i = 0; i < fleet.back().second; i++) {
+                    fleet.back().first->addStage(valRange(gen), valRange(gen), engines[i]);
+                }
+            }
+            measure("evaluateAll", stageCount, precision, options,
+                    [&]() { for (auto &fleetShip : fleet) {                 // Every stage of every ship stale
+                        const uint top = fleetShip.second - 1;
+                        fleetShip.first->setStageDryMass(top, fleetShip.first->getStageDryMass(top)); } },
+                    [&]() { handler.evaluateAll(options.threads); });
+            SweepCache sweep(precision);                                    // New booster under the ship's stack
+            std::vector<SweepStage> candidate(1);
+            for (uint i = 0; i < stageCount; i++) {
+                candidate.push_back({(long double) ship->getStageDryMass(i), (long double) ship->getStageFuelMass(i),
+                                     handler.getEngine(engines[i])});
+            }
+            measure("sweepCache.candidate", stageCount, precision, options,
+                    [&]() { if (sweep.getNodeCount() > 10000) { sweep.clear(); }
+                        candidate[0] = {valRange(gen), valRange(gen), handler.getEngine(engines[0])}; },
+                    [&]() { sweep.evaluate(candidate); });
+            DeltaVGradient gradient;
+            measure("getDeltaVGradient", stageCount, precision, options, noSetup,
+                    [&]() { gradient = ship->getDeltaVGradient(); });
+            long double solvedFuel;                                         // Top stage, so every stage moves
+            const long double solveTarget = 1.01L * ship->getDeltaV();
+            measure("solveFuelMass", stageCount, precision, options, noSetup,
+                    [&]() { ship->solveFuelMass(stageCount - 1, solveTarget, solvedFuel); });
+            RefuelAnalysis refuels(ship);                                   // Depot under the top two stages
+            const RefuelScenario refuel = {{{stageCount > 1 ? stageCount - 2 : 0, stageCount - 1, 1000}}};
+            measure("refuel.scenario", stageCount, precision, options, noSetup,
+                    [&]() { refuels.evaluate(refuel); });
+            MonteCarloOptions monteCarloOptions;                            // 1% normal on every value
+            monteCarloOptions.samples = 65'536;
+            monteCarloOptions.threads = options.threads;
+            const Distribution onePercent = {DistributionKind::normal, 0.01L};
+            std::vector<EngineTolerance> engineTolerances;
+            for (EngineId engine : engines) {
+                engineTolerances.push_back({engine, onePercent, onePercent});
+            }
+            MonteCarlo monteCarlo(handler, ship, std::vector<StageTolerance>(stageCount, {onePercent, onePercent}),
+                                  engineTolerances, monteCarloOptions);
+            MonteCarloResult monteCarloResult;
+            measure("monteCarlo65536", stageCount, precision, options, noSetup,
+                    [&]() { monteCarlo.run(monteCarloResult); });
+            auto* staged = handler.addShip();                               // Light engines under a heavy payload,
+            const EngineId light = handler.createEngineId("light" + std::to_string(stageCount), 1, 3'000);
+            for (uint i = 0; i < stageCount; i++) {                         // so every stage keeps some fuel
+                staged->addStage(1, 1, light);
+            }
+            staged->addStage(1'000'000, 0, light);
+            const std::vector<StageStructure> structures(stageCount, {1, 0.08L});
+            const long double stagedMass = 20 * staged->getMass();
+            measure("optimizeStaging", stageCount, precision, options, noSetup,
+                    [&]() { staged->maximizeStagingDeltaV(structures, stagedMass); });
+            std::vector<SweepStageRange> sweepRanges(1);                    // 32x32 boosters under the ship's stack
+            sweepRanges[0] = {1, 1'000'000, 32, 1, 1'000'000, 32, {engines[0]}};
+            for (uint i = 0; i < stageCount; i++) {
+                const long double dry = ship->getStageDryMass(i), fuel = ship->getStageFuelMass(i);
+                sweepRanges.push_back({dry, dry, 1, fuel, fuel, 1, {engines[i]}});
+            }
+            SweepOptions sweepOptions;
+            sweepOptions.threads = options.threads;
+            DesignSweep designSweep(handler, sweepRanges, sweepOptions);
+            measure("designSweep1024", stageCount, precision, options, noSetup,
+                    [&]() { designSweep.run("/dev/null"); });
+
+            const size_t batchShips = 1024;                                 // Same shape, SoA, every SimdLevel
+            std::vector<double> batchValues(4 * batchShips * stageCount), batchDeltaVs(batchShips);
+            for (auto &value : batchValues) {
+                value = (double) valRange(gen);
+            }
+            ShipBatch batch;
+            batch.shipCount = batchShips;
+            batch.stageCount = stageCount;
+            batch.dryMasses = batchValues.data();
+            batch.fuelMasses = batch.dryMasses + batchShips * stageCount;
+            batch.engineMasses = batch.fuelMasses + batchShips * stageCount;
+            batch.exhaustVelocities = batch.engineMasses + batchShips * stageCount;
+            batch.deltaVs = batchDeltaVs.data();
+            const SimdLevel bestLevel = DeltaVBatch::getSimdLevel();
+            const char* batchOps[] = {"batch1024.scalar", "batch1024.avx2", "batch1024.avx512"};
+            for (SimdLevel level : {SimdLevel::scalar, SimdLevel::avx2, SimdLevel::avx512}) {
+                if (DeltaVBatch::isSupported(level)) {
+                    DeltaVBatch::setSimdLevel(level);
+                    measure(batchOps[(int) level], stageCount, precision, options, noSetup,
+                            [&]() { DeltaVBatch::evaluate(batch); });
+                }
+            }
+            DeltaVBatch::setSimdLevel(bestLevel);
+            measure("getRemainingMass", stageCount, precision, options, noSetup,
+                    [&]() { ship->getRemainingMass(stagePick(gen)); });
+
+            measure("printStats", stageCount, precision, options, noSetup,
+                    [&]() { ship->printStats(); });
+
+            measure("getEngine.name", stageCount, precision, options, noSetup,
+                    [&]() { handler.getEngine(names[stagePick(gen)]); });
+            measure("getEngine.id", stageCount, precision, options, noSetup,
+                    [&]() { handler.getEngine(engines[stagePick(gen)]); });
+            fflush(out);
+        }
+    }
+    fprintf(out, "\n  ],\n  \"ships\": [\n");
+    for (size_t i = 0; i < shipReports.size(); i++) {
+        fprintf(out, "%s%s\n", shipReports[i].c_str(), i + 1 < shipReports.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    fclose(out);
+    return 0;
+}
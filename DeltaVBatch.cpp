@@ -0,0 +1,115 @@
+//
+// Created by user on 6/22/23.
+//
+
+#include "DeltaVBatch.h"
+#include "DeltaVBatchKernel.h"
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+    struct ScalarOps {
+        typedef double Vec;
+        typedef bool Mask;
+        static const size_t width = 1;
+
+        static Vec broadcast(double value) { return value; }
+        static Vec load(const double* values) { return *values; }
+        static void store(double* values, Vec a) { *values = a; }
+
+        static Vec add(Vec a, Vec b) { return a + b; }
+        static Vec sub(Vec a, Vec b) { return a - b; }
+        static Vec mul(Vec a, Vec b) { return a * b; }
+        static Vec div(Vec a, Vec b) { return a / b; }
+        static Vec fma(Vec a, Vec b, Vec c) { return a * b + c; }
+
+        static Mask greater(Vec a, Vec b) { return a > b; }
+        static Mask less(Vec a, Vec b) { return a < b; }
+        static Mask equal(Vec a, Vec b) { return a == b; }
+        static Vec select(Mask mask, Vec ifTrue, Vec ifFalse) { return mask ? ifTrue : ifFalse; }
+
+        static Vec split(Vec u, Vec& exponent) {
+            int binaryExponent;
+            const double mantissa = std::frexp(u, &binaryExponent);            // [0.5, 1)
+            exponent = binaryExponent - 1;
+            return mantissa * 2;
+        }
+    };
+
+    std::atomic<int> activeLevel(-1);                                       // -1 until detected
+
+    SimdLevel bestLevel() {
+        if (DeltaVBatch::isSupported(SimdLevel::avx512)) {
+            return SimdLevel::avx512;
+        }
+        if (DeltaVBatch::isSupported(SimdLevel::avx2)) {
+            return SimdLevel::avx2;
+        }
+        return SimdLevel::scalar;
+    }
+}
+
+bool DeltaVBatch::isSupported(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::scalar:
+            return true;
+        case SimdLevel::avx2:
+#ifdef IRA_AVX2
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+            return false;
+#endif
+        case SimdLevel::avx512:
+#ifdef IRA_AVX512
+            return __builtin_cpu_supports("avx512f");
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+SimdLevel DeltaVBatch::getSimdLevel() {
+    int level = activeLevel.load(std::memory_order_relaxed);
+    if (level < 0) {
+        level = (int) bestLevel();
+        activeLevel.store(level, std::memory_order_relaxed);
+    }
+    return (SimdLevel) level;
+}
+
+SimdLevel DeltaVBatch::setSimdLevel(SimdLevel level) {
+    while (!isSupported(level)) {
+        level = (SimdLevel) ((int) level - 1);
+    }
+    activeLevel.store((int) level, std::memory_order_relaxed);
+    return level;
+}
+
+void DeltaVBatch::evaluate(const ShipBatch& batch) {
+    if (batch.shipCount == 0) {
+        return;
+    }
+    if (batch.deltaVs == nullptr || (batch.stageCount != 0 && (batch.dryMasses == nullptr
+        || batch.fuelMasses == nullptr || batch.engineMasses == nullptr || batch.exhaustVelocities == nullptr))) {
+        throw std::runtime_error("Null pointer exception");
+    }
+
+    size_t done = 0;
+    switch (getSimdLevel()) {
+#ifdef IRA_AVX512
+        case SimdLevel::avx512:
+            done = batchDeltaVAvx512(batch, 0, batch.shipCount);
+            break;
+#endif
+#ifdef IRA_AVX2
+        case SimdLevel::avx2:
+            done = batchDeltaVAvx2(batch, 0, batch.shipCount);
+            break;
+#endif
+        default:
+            break;
+    }
+    batchDeltaV<ScalarOps>(batch, done, batch.shipCount);                 // The ships left over from the vectors
+}
@@ -0,0 +1,73 @@
+//
+// Created by user on 6/22/23.
+//
+
+#include <cstddef>
+
+#ifndef IRA_DELTAVBATCH_H
+#define IRA_DELTAVBATCH_H
+
+/**
+ * @brief Instruction sets the batch kernel can run on.
+ */
+enum class SimdLevel {
+    scalar,     /**< One ship at a time, portable. */
+    avx2,       /**< Four ships at a time, needs AVX2 and FMA. */
+    avx512      /**< Eight ships at a time, needs AVX-512F. */
+};
+
+/**
+ * @brief Many ships of the same shape, as arrays in stage-major, ship-minor order: the value of stage k of ship i
+ *        is at [k * shipCount + i]. Stages are in burn order, like SpaceShip's.
+ */
+struct ShipBatch {
+    size_t shipCount = 0;
+    size_t stageCount = 0;
+    const double* dryMasses = nullptr;
+    const double* fuelMasses = nullptr;
+    const double* engineMasses = nullptr;
+    const double* exhaustVelocities = nullptr;
+    double* stageDeltaVs = nullptr;             /**< Delta-V of each stage, same layout (optional). */
+    double* deltaVs = nullptr;                  /**< Total delta-V of each ship, shipCount values. */
+};
+
+/**
+ * @brief Delta-V of whole batches of ships in double precision, without building any SpaceShipWrapper.
+ * @details Computes the same rocket equation as SpaceShip::genDeltaV, dv = ve * log1p(fuel / rest), for several
+ *          ships at once with a vectorized log. The widest instruction set the CPU supports is picked the first time
+ *          a batch is evaluated. Every SimdLevel runs the same arithmetic, so results agree up to FMA contraction,
+ *          and are within about ten units of double roundoff of the exact values. Meant for screening: verify the
+ *          winners with SpaceShipHandler.
+ */
+class DeltaVBatch {
+public:
+    /**
+     * @brief Computes the delta-V of every ship in the batch.
+     * @note Masses and exhaust velocities must be non-negative and finite.
+     * @param batch Ships to evaluate; stageDeltaVs and deltaVs are filled in.
+     */
+    static void evaluate(const ShipBatch& batch);
+
+    /**
+     * @brief Returns the instruction set evaluate uses.
+     * @return SimdLevel in use.
+     */
+    static SimdLevel getSimdLevel();
+
+    /**
+     * @brief Makes evaluate use a lower instruction set than it would pick, mainly for testing and benchmarks.
+     * @param level Requested SimdLevel. Levels this build or CPU lacks fall back to the best one below them.
+     * @return The SimdLevel now in use.
+     */
+    static SimdLevel setSimdLevel(SimdLevel level);
+
+    /**
+     * @brief Returns whether a SimdLevel is compiled in and supported by the CPU.
+     * @param level SimdLevel to check.
+     * @return true if evaluate can use it.
+     */
+    static bool isSupported(SimdLevel level);
+};
+
+
+#endif //IRA_DELTAVBATCH_H
@@ -0,0 +1,45 @@
+//
+// Created by user on 6/22/23.
+//
+
+// Compiled with -mavx2 -mfma; only called after DeltaVBatch has checked the CPU.
+
+#include <immintrin.h>
+#include "DeltaVBatchKernel.h"
+
+namespace {
+    struct Avx2Ops {
+        typedef __m256d Vec;
+        typedef __m256d Mask;
+        static const size_t width = 4;
+
+        static Vec broadcast(double value) { return _mm256_set1_pd(value); }
+        static Vec load(const double* values) { return _mm256_loadu_pd(values); }
+        static void store(double* values, Vec a) { _mm256_storeu_pd(values, a); }
+
+        static Vec add(Vec a, Vec b) { return _mm256_add_pd(a, b); }
+        static Vec sub(Vec a, Vec b) { return _mm256_sub_pd(a, b); }
+        static Vec mul(Vec a, Vec b) { return _mm256_mul_pd(a, b); }
+        static Vec div(Vec a, Vec b) { return _mm256_div_pd(a, b); }
+        static Vec fma(Vec a, Vec b, Vec c) { return _mm256_fmadd_pd(a, b, c); }
+
+        static Mask greater(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+        static Mask less(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+        static Mask equal(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+        static Vec select(Mask mask, Vec ifTrue, Vec ifFalse) { return _mm256_blendv_pd(ifFalse, ifTrue, mask); }
+
+        static Vec split(Vec u, Vec& exponent) {
+            const __m256i bits = _mm256_castpd_si256(u);
+            const __m256i biased = _mm256_srli_epi64(bits, 52);                // Sign is 0 for u > 0
+            exponent = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(biased,   // 2^52 + biased, exactly
+                                                                          _mm256_set1_epi64x(0x4330000000000000))),
+                                     _mm256_set1_pd(4503599627370496.0 + 1023));
+            return _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi64x(0x000FFFFFFFFFFFFF)),
+                                                       _mm256_set1_epi64x(0x3FF0000000000000)));
+        }
+    };
+}
+
+size_t batchDeltaVAvx2(const ShipBatch& batch, size_t begin, size_t end) {
+    return batchDeltaV<Avx2Ops>(batch, begin, end);
+}
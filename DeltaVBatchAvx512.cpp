@@ -0,0 +1,40 @@
+//
+// Created by user on 6/22/23.
+//
+
+// Compiled with -mavx512f; only called after DeltaVBatch has checked the CPU.
+
+#include <immintrin.h>
+#include "DeltaVBatchKernel.h"
+
+namespace {
+    struct Avx512Ops {
+        typedef __m512d Vec;
+        typedef __mmask8 Mask;
+        static const size_t width = 8;
+
+        static Vec broadcast(double value) { return _mm512_set1_pd(value); }
+        static Vec load(const double* values) { return _mm512_loadu_pd(values); }
+        static void store(double* values, Vec a) { _mm512_storeu_pd(values, a); }
+
+        static Vec add(Vec a, Vec b) { return _mm512_add_pd(a, b); }
+        static Vec sub(Vec a, Vec b) { return _mm512_sub_pd(a, b); }
+        static Vec mul(Vec a, Vec b) { return _mm512_mul_pd(a, b); }
+        static Vec div(Vec a, Vec b) { return _mm512_div_pd(a, b); }
+        static Vec fma(Vec a, Vec b, Vec c) { return _mm512_fmadd_pd(a, b, c); }
+
+        static Mask greater(Vec a, Vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+        static Mask less(Vec a, Vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+        static Mask equal(Vec a, Vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ); }
+        static Vec select(Mask mask, Vec ifTrue, Vec ifFalse) { return _mm512_mask_blend_pd(mask, ifFalse, ifTrue); }
+
+        static Vec split(Vec u, Vec& exponent) {                           // Zero masked with every lane on: the
+            exponent = _mm512_maskz_getexp_pd(0xFF, u);                    // unmasked forms pass an undefined
+            return _mm512_maskz_getmant_pd(0xFF, u, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_src);    // source through.
+        }
+    };
+}
+
+size_t batchDeltaVAvx512(const ShipBatch& batch, size_t begin, size_t end) {
+    return batchDeltaV<Avx512Ops>(batch, begin, end);
+}
@@ -0,0 +1,105 @@
+//
+// Created by user on 6/22/23.
+//
+
+#include <cstddef>
+#include <cmath>
+#include "DeltaVBatch.h"
+
+#ifndef IRA_DELTAVBATCHKERNEL_H
+#define IRA_DELTAVBATCHKERNEL_H
+
+// The batch kernel, written once against a vector "Ops" policy and instantiated by DeltaVBatch.cpp (scalar) and the
+// per instruction set translation units, which are compiled with their own -m flags. Every function here is a
+// template on Ops, and each translation unit's Ops lives in an anonymous namespace, so no AVX code can leak into a
+// symbol shared with the portable build. For the same reason the kernel calls no standard library function itself;
+// anything it needs comes from Ops, and only the scalar Ops, compiled without -m flags, uses one (std::frexp).
+//
+// An Ops policy provides:
+//     typedef ... Vec, Mask;    static const size_t width;
+//     Vec broadcast(double) / load(const double*) / void store(double*, Vec)
+//     Vec add / sub / mul / div(Vec, Vec), fma(a, b, c) = a * b + c
+//     Mask greater / less / equal(Vec, Vec), Vec select(Mask, Vec ifTrue, Vec ifFalse)
+//     Vec split(Vec u, Vec& exponent)    u = mantissa * 2^exponent with the mantissa in [1, 2), for normal u > 0
+
+/**
+ * @brief Natural log of positive, normal, finite values.
+ * @details Reduces to m in [sqrt(1/2), sqrt(2)) and sums log(m) = 2 atanh(s), s = (m - 1) / (m + 1), whose series
+ *          converges to double precision in 10 terms as |s| < 0.172.
+ */
+template <typename Ops>
+inline typename Ops::Vec batchLog(typename Ops::Vec u) {
+    typedef typename Ops::Vec Vec;
+    const Vec one = Ops::broadcast(1);
+    Vec exponent;
+    Vec m = Ops::split(u, exponent);
+    const auto high = Ops::greater(m, Ops::broadcast(1.41421356237309504880));
+    m = Ops::select(high, Ops::mul(m, Ops::broadcast(0.5)), m);
+    exponent = Ops::select(high, Ops::add(exponent, one), exponent);
+
+    const Vec f = Ops::sub(m, one);                                         // Exact, m is within a factor 2 of 1
+    const Vec s = Ops::div(f, Ops::add(f, Ops::broadcast(2)));
+    const Vec z = Ops::mul(s, s);
+    Vec series = Ops::broadcast(1.0 / 21);                                  // 1/3 + z/5 + ... + z^9/21
+    for (int k = 19; k >= 3; k -= 2) {
+        series = Ops::fma(series, z, Ops::broadcast(1.0 / k));
+    }
+    const Vec twoS = Ops::add(s, s);
+    const Vec logM = Ops::fma(Ops::mul(twoS, z), series, twoS);
+
+    const Vec ln2High = Ops::broadcast(6.93147180369123816490e-01);         // exponent * ln2High is exact
+    const Vec ln2Low = Ops::broadcast(1.90821492927058770002e-10);
+    return Ops::fma(exponent, ln2High, Ops::fma(exponent, ln2Low, logM));
+}
+
+/**
+ * @brief log(1 + x) for x >= 0, accurate for small x as well.
+ * @details Uses log1p(x) = log(u) * x / (u - 1) with u = 1 + x rounded, which cancels the rounding error of u.
+ */
+template <typename Ops>
+inline typename Ops::Vec batchLog1p(typename Ops::Vec x) {
+    typedef typename Ops::Vec Vec;
+    const Vec u = Ops::add(Ops::broadcast(1), x);
+    const Vec d = Ops::sub(u, Ops::broadcast(1));
+    Vec result = Ops::mul(batchLog<Ops>(u), Ops::div(x, d));
+    result = Ops::select(Ops::equal(d, Ops::broadcast(0)), x, result);      // x below roundoff of 1
+    return Ops::select(Ops::less(u, Ops::broadcast(HUGE_VAL)), result, u);    // Infinity and NaN pass through
+}
+
+/**
+ * @brief Evaluates ships [begin, begin + k * Ops::width) of a batch, for the largest k that fits before end.
+ * @return The first ship not evaluated.
+ */
+template <typename Ops>
+size_t batchDeltaV(const ShipBatch& batch, size_t begin, size_t end) {
+    typedef typename Ops::Vec Vec;
+    size_t ship = begin;
+    for (; ship + Ops::width <= end; ship += Ops::width) {
+        Vec above = Ops::broadcast(0),                                      // Mass of the stages above
+            total = Ops::broadcast(0);
+        for (size_t stage = batch.stageCount; stage-- > 0;) {              // Top down, like the suffix sum
+            const size_t at = stage * batch.shipCount + ship;
+            const Vec fuel = Ops::load(batch.fuelMasses + at);
+            const Vec rest = Ops::add(Ops::add(Ops::load(batch.dryMasses + at), Ops::load(batch.engineMasses + at)),
+                                      above);
+            const Vec deltaV = Ops::mul(Ops::load(batch.exhaustVelocities + at),
+                                        batchLog1p<Ops>(Ops::div(fuel, rest)));
+            if (batch.stageDeltaVs != nullptr) {
+                Ops::store(batch.stageDeltaVs + at, deltaV);
+            }
+            total = Ops::add(total, deltaV);
+            above = Ops::add(rest, fuel);
+        }
+        Ops::store(batch.deltaVs + ship, total);
+    }
+    return ship;
+}
+
+// Instantiations for each instruction set, defined in their own translation units when the build has them
+// (IRA_AVX2, IRA_AVX512). Same contract as batchDeltaV.
+size_t batchDeltaVAvx2(const ShipBatch& batch, size_t begin, size_t end);
+size_t batchDeltaVAvx512(const ShipBatch& batch, size_t begin, size_t end);
+
+
+
+#endif //IRA_DELTAVBATCHKERNEL_H
@@ -0,0 +1,264 @@
+//
+// Created by user on 6/24/23.
+//
+
+#include "DesignSweep.h"
+#include "WorkStealingPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+namespace {
+    const size_t candidatesPerTask = 64;            // Consecutive candidates one thread evaluates on one ship
+
+    uint64_t mix(uint64_t value) {                  // splitmix64's finalizer
+        value += 0x9e3779b97f4a7c15;
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+        return value ^ (value >> 31);
+    }
+
+    /**
+     * @brief A permutation of [0, n) chosen by key, evaluated one index at a time.
+     * @details A 4 round Feistel network permutes the smallest power of 4 that holds n, and indices that land at or
+     *          above n are pushed through again (cycle walking) until they land inside.
+     */
+    uint64_t permute(uint64_t index, uint64_t n, uint64_t key) {
+        int halfBits = 1;
+        while (((uint64_t) 1 << (2 * halfBits)) < n) {
+            halfBits++;
+        }
+        const uint64_t halfMask = ((uint64_t) 1 << halfBits) - 1;
+        do {
+            uint64_t left = index >> halfBits, right = index & halfMask;
+            for (uint64_t round = 0; round < 4; round++) {
+                const uint64_t next = left ^ (mix(right ^ mix(key + round)) & halfMask);
+                left = right;
+                right = next;
+            }
+            index = (left << halfBits) | right;
+        } while (index >= n);
+        return index;
+    }
+
+    long double gridValue(long double min, long double max, uint steps, size_t step) {
+        if (steps <= 1) {
+            return min;
+        }
+        return min + (max - min) * step / (steps - 1);
+    }
+
+    void writeCsvField(FILE* out, const std::string& text) {
+        if (text.find_first_of(",\"\n") == std::string::npos) {
+            fputs(text.c_str(), out);
+            return;
+        }
+        fputc('"', out);
+        for (char c : text) {
+            if (c == '"') {
+                fputc('"', out);
+            }
+            fputc(c, out);
+        }
+        fputc('"', out);
+    }
+
+    /**
+     * @brief A thread's ship and the candidate it last evaluated.
+     */
+    struct SweepShip {
+        std::unique_ptr<SpaceShipWrapper> ship;
+        std::vector<SweepStage> stages;
+    };
+}
+
+DesignSweep::DesignSweep(SpaceShipHandler& handler, std::vector<SweepStageRange> stages, SweepOptions options)
+        : handler(handler), stages(std::move(stages)), options(options) {
+    for (auto &stage : this->stages) {
+        engines.emplace_back();
+        for (EngineId id : stage.engines) {
+            engines.back().push_back(id.value < handler.getEngineCount() ? handler.getEngine(id) : nullptr);
+        }
+    }
+
+    if (options.sampling == SweepSampling::latinHypercube) {
+        candidateCount = this->stages.empty() ? 0 : options.samples;
+        return;
+    }
+    candidateCount = this->stages.empty() ? 0 : 1;
+    for (auto &stage : this->stages) {
+        for (size_t radix : {(size_t) stage.dryMassSteps, (size_t) stage.fuelMassSteps, stage.engines.size()}) {
+            if (radix != 0 && candidateCount > SIZE_MAX / radix) {
+                candidateCount = 0;                                         // Overflow, reported by run
+                return;
+            }
+            candidateCount *= radix;
+        }
+    }
+}
+
+size_t DesignSweep::getCandidateCount() const {
+    return candidateCount;
+}
+
+void DesignSweep::getCandidate(size_t index, std::vector<SweepStage>& candidate) const {
+    candidate.resize(stages.size());
+    for (size_t i = 0; i < stages.size(); i++) {
+        const SweepStageRange& range = stages[i];
+        SweepStage& stage = candidate[i];
+        if (options.sampling == SweepSampling::latinHypercube) {
+            stage.dryMass = range.minDryMass + (range.maxDryMass - range.minDryMass) * latinFraction(index, 3 * i);
+            stage.fuelMass = range.minFuelMass
+                             + (range.maxFuelMass - range.minFuelMass) * latinFraction(index, 3 * i + 1);
+            stage.engine = engines[i][(size_t) (latinFraction(index, 3 * i + 2) * engines[i].size())];
+            continue;
+        }
+        stage.dryMass = gridValue(range.minDryMass, range.maxDryMass, range.dryMassSteps, index % range.dryMassSteps);
+        index /= range.dryMassSteps;
+        stage.fuelMass = gridValue(range.minFuelMass, range.maxFuelMass, range.fuelMassSteps,
+                                   index % range.fuelMassSteps);
+        index /= range.fuelMassSteps;
+        stage.engine = engines[i][index % engines[i].size()];
+        index /= engines[i].size();
+    }
+}
+
+double DesignSweep::latinFraction(size_t index, size_t dimension) const {
+    const uint64_t key = mix(options.seed ^ mix(dimension));
+    const uint64_t stratum = permute(index, options.samples, key);
+    const double jitter = (mix(key ^ mix(index)) >> 11) * (1.0 / 9007199254740992.0);  // [0, 1), 53 bits
+    return std::min((stratum + jitter) / options.samples, std::nextafter(1.0, 0.0));      // Rounding can reach 1
+}
+
+int DesignSweep::prepare() {
+    if (stages.empty()) {
+        std::cerr << "[DesignSweep::run] No stages to sweep." << std::endl;
+        return 1;
+    }
+    if (candidateCount == 0) {
+        std::cerr << "[DesignSweep::run] The sweep has no candidates, or too many to count." << std::endl;
+        return 1;
+    }
+    for (size_t i = 0; i < stages.size(); i++) {
+        if (stages[i].dryMassSteps == 0 || stages[i].fuelMassSteps == 0 || stages[i].engines.empty()) {
+            std::cerr << "[DesignSweep::run] Stage " << i << " has an empty range." << std::endl;
+            return 1;
+        }
+        for (size_t j = 0; j < engines[i].size(); j++) {
+            if (engines[i][j] == nullptr) {
+                std::cerr << "[DesignSweep::run] Engine " << stages[i].engines[j].value << " does not exist."
+                          << std::endl;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int DesignSweep::run(const std::string& path) {
+    FILE* out = fopen(path.c_str(), "w");
+    if (out == nullptr) {
+        std::cerr << "[DesignSweep::run] Could not open " << path << "." << std::endl;
+        return 1;
+    }
+    const int failed = run(out);
+    if (fclose(out) != 0) {
+        std::cerr << "[DesignSweep::run] Could not write " << path << "." << std::endl;
+        return 1;
+    }
+    return failed;
+}
+
+int DesignSweep::run(FILE* out) {
+    if (prepare() != 0) {
+        return 1;
+    }
+    const size_t chunkSize = options.chunkSize != 0 ? options.chunkSize : 1;
+    const int digits = std::numeric_limits<long double>::max_digits10;     // Round-trips through strtold
+
+    WorkStealingPool pool(options.threads);
+    std::vector<SweepShip> ships(pool.getThreadCount());                    // One per thread at most
+    std::vector<SweepShip*> idleShips;
+    for (auto &ship : ships) {
+        idleShips.push_back(&ship);
+    }
+    std::mutex idleMutex;
+
+    std::vector<std::pair<long double, long double>> results(std::min(chunkSize, candidateCount));  // deltaV, mass
+    std::vector<size_t> order;
+    std::vector<SweepStage> candidate;
+
+    fprintf(out, "candidate,deltaV,mass");
+    for (size_t i = 0; i < stages.size(); i++) {
+        fprintf(out, ",stage%zu.dryMass,stage%zu.fuelMass,stage%zu.engine", i, i, i);
+    }
+    fprintf(out, "\n");
+
+    for (size_t chunkStart = 0; chunkStart < candidateCount; chunkStart += chunkSize) {
+        const size_t chunkEnd = std::min(candidateCount, chunkStart + chunkSize);
+        order.resize((chunkEnd - chunkStart + candidatesPerTask - 1) / candidatesPerTask);
+        for (size_t task = 0; task < order.size(); task++) {
+            order[task] = task;
+        }
+
+        pool.run(order, [&](size_t task) {
+            SweepShip* sweepShip;
+            {
+                std::lock_guard<std::mutex> lock(idleMutex);
+                sweepShip = idleShips.back();
+                idleShips.pop_back();
+            }
+            if (sweepShip->ship == nullptr) {
+                sweepShip->ship.reset(new SpaceShipWrapper(handler.getPrecision()));
+                sweepShip->ship->setEvaluationMode(options.mode, options.relativeTolerance,
+                                                   options.absoluteTolerance);
+            }
+            SpaceShipWrapper* ship = sweepShip->ship.get();
+            std::vector<SweepStage> next;
+            const size_t begin = chunkStart + task * candidatesPerTask;
+            for (size_t index = begin; index < std::min(chunkEnd, begin + candidatesPerTask); index++) {
+                getCandidate(index, next);
+                for (size_t i = 0; i < next.size(); i++) {                   // Only what changed goes stale
+                    if (i >= sweepShip->stages.size()) {
+                        ship->addStage(next[i].dryMass, next[i].fuelMass, next[i].engine);
+                        continue;
+                    }
+                    const SweepStage& last = sweepShip->stages[i];
+                    if (next[i].dryMass != last.dryMass) {
+                        ship->setStageDryMass(i, next[i].dryMass);
+                    }
+                    if (next[i].fuelMass != last.fuelMass) {
+                        ship->setStageFuelMass(i, next[i].fuelMass);
+                    }
+                    if (next[i].engine != last.engine) {
+                        ship->setStageEngine(i, next[i].engine);
+                    }
+                }
+                sweepShip->stages.swap(next);
+                results[index - chunkStart] = {ship->getDeltaV(), ship->getMass()};
+            }
+            std::lock_guard<std::mutex> lock(idleMutex);
+            idleShips.push_back(sweepShip);
+        });
+
+        for (size_t index = chunkStart; index < chunkEnd; index++) {
+            getCandidate(index, candidate);
+            const auto &result = results[index - chunkStart];
+            fprintf(out, "%zu,%.*Lg,%.*Lg", index, digits, result.first, digits, result.second);
+            for (auto &stage : candidate) {
+                fprintf(out, ",%.*Lg,%.*Lg,", digits, stage.dryMass, digits, stage.fuelMass);
+                writeCsvField(out, stage.engine->name);
+            }
+            fputc('\n', out);
+        }
+        if (ferror(out)) {
+            std::cerr << "[DesignSweep::run] Could not write the results." << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+//
+// Created by user on 6/24/23.
+//
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include "SpaceShipHandler.h"
+#include "SweepCache.h"
+
+#ifndef IRA_DESIGNSWEEP_H
+#define IRA_DESIGNSWEEP_H
+
+/**
+ * @brief Values one stage of a swept design can take.
+ * @details The grid uses steps evenly spaced values from min to max (just min for 1 step). A Latin hypercube sample
+ *          draws from [min, max] and ignores the step counts.
+ */
+struct SweepStageRange {
+    long double minDryMass = 0, maxDryMass = 0;
+    uint dryMassSteps = 1;
+    long double minFuelMass = 0, maxFuelMass = 0;
+    uint fuelMassSteps = 1;
+    std::vector<EngineId> engines;              /**< Engines the stage can use, from the sweep's handler. */
+};
+
+/**
+ * @brief How DesignSweep picks candidates.
+ */
+enum class SweepSampling {
+    grid,           /**< Every combination of every stage's values. */
+    latinHypercube  /**< samples candidates; each mass and the engine choice hit each of samples strata once. */
+};
+
+struct SweepOptions {
+    SweepSampling sampling = SweepSampling::grid;
+    size_t samples = 1000;                      /**< Number of candidates for SweepSampling::latinHypercube. */
+    unsigned long seed = 0;                     /**< Seed of the Latin hypercube. */
+    unsigned threads = 0;                       /**< Evaluation threads, 0 for one per core. */
+    size_t chunkSize = 4096;                    /**< Candidates evaluated and written per chunk. */
+    EvaluationMode mode = EvaluationMode::exact;
+    long double relativeTolerance = 1e-15;      /**< Fast mode, see SpaceShip::setEvaluationMode. */
+    long double absoluteTolerance = 1e-9;       /**< Certified mode in m/s, see SpaceShip::setEvaluationMode. */
+};
+
+/**
+ * @brief Evaluates every candidate of a design space and streams the results to a CSV file.
+ * @details Candidates are evaluated a chunk at a time on a WorkStealingPool and written in candidate order before the
+ *          next chunk starts, so memory is bounded by chunkSize however large the space is. Each thread reuses one
+ *          SpaceShipWrapper, outside the handler's ship list, and only sets the values that changed since its last
+ *          candidate. In the grid, stage 0's dry mass varies fastest, so consecutive candidates mostly differ in
+ *          the lowest stages and only those are re-evaluated. The Latin hypercube is computed per candidate from
+ *          the seed with keyed permutations, so it needs no memory either, and the output does not depend on the
+ *          number of threads.
+ *
+ *          Rows are: candidate index, delta-V, mass, then dry mass, fuel mass and engine name for each stage.
+ * @note Engines must not be edited while a sweep runs.
+ */
+class DesignSweep {
+public:
+    /**
+     * @brief Sets up a sweep.
+     * @param handler Handler whose engines and precision the candidates use.
+     * @param stages Range of each stage, in burn order (0 is the first to burn).
+     * @param options Sampling, threads and chunking.
+     */
+    DesignSweep(SpaceShipHandler& handler, std::vector<SweepStageRange> stages, SweepOptions options = SweepOptions());
+
+    /**
+     * @brief Returns the number of candidates run evaluates.
+     * @return Number of candidates, or 0 if the grid has more than SIZE_MAX.
+     */
+    size_t getCandidateCount() const;
+
+    /**
+     * @brief Gets the stages of a candidate.
+     * @param index Candidate index, in [0, getCandidateCount()).
+     * @param candidate Filled in with the candidate's stages.
+     */
+    void getCandidate(size_t index, std::vector<SweepStage>& candidate) const;
+
+    /**
+     * @brief Evaluates every candidate and writes a CSV file.
+     * @param path File to write.
+     * @return 0 if successful, 1 if not.
+     */
+    int run(const std::string& path);
+
+    /**
+     * @brief Evaluates every candidate and writes CSV to an open file.
+     * @param out File to write to.
+     * @return 0 if successful, 1 if not.
+     */
+    int run(FILE* out);
+
+private:
+    SpaceShipHandler& handler;
+    std::vector<SweepStageRange> stages;
+    std::vector<std::vector<const Engine*>> engines;    /**< Each stage's engines, nullptr for bad ids. */
+    SweepOptions options;
+    size_t candidateCount;
+
+    /**
+     * @brief Checks the ranges and engines before a run.
+     * @return 0 if successful, 1 if not.
+     */
+    int prepare();
+
+    /**
+     * @brief Value of one dimension of a Latin hypercube candidate, as a fraction of its range in [0, 1).
+     * @param index Candidate index.
+     * @param dimension Dimension, 3 per stage: dry mass, fuel mass, engine.
+     */
+    double latinFraction(size_t index, size_t dimension) const;
+};
+
+
+#endif //IRA_DESIGNSWEEP_H
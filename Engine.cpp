@@ -5,62 +5,70 @@
 #include "Engine.h"
 #include <mpfr.h>
 
-Engine::Engine() {
-    mpfr_init(mass);
-    mpfr_init(exhaustVelocity);
+template <typename Backend>
+BasicEngine<Backend>::BasicEngine(const Backend& backend) {
+    backend.init(mass);
+    backend.init(exhaustVelocity);
 }
 
-Engine::~Engine() {
-    if (mass[0]._mpfr_d != nullptr) {                          // Errors pretaining to erroneous clearing should be
-        mpfr_clear(mass);                                      // resolved, so the lack of hard errors when nullptr is
-        mpfr_clear(exhaustVelocity);                           // encountered is acceptable and needed due to nullptrs
-    }                                                          // in the case that there is a move operation
-}
+template <typename Backend>
+BasicEngine<Backend>::~BasicEngine() {
+    Backend::clear(mass);                                      // Errors pretaining to erroneous clearing should be
+    Backend::clear(exhaustVelocity);                           // resolved, so clear skipping the nullptrs left behind
+}                                                              // by a move operation is acceptable and needed.
 
 // Copy operations:
-Engine::Engine(const Engine& other) {
-    mpfr_init(mass);
-    mpfr_init(exhaustVelocity);
-    mpfr_set(mass, other.mass, MPFR_RNDN);
-    mpfr_set(exhaustVelocity, other.exhaustVelocity, MPFR_RNDN);
+template <typename Backend>
+BasicEngine<Backend>::BasicEngine(const BasicEngine& other) {
+    Backend::initCopy(mass, other.mass);
+    Backend::initCopy(exhaustVelocity, other.exhaustVelocity);
 
     name = other.name;
+    id = other.id;
 }
-Engine& Engine::operator=(const Engine& other) {
+template <typename Backend>
+BasicEngine<Backend>& BasicEngine<Backend>::operator=(const BasicEngine& other) {
     if (this == &other) {
         return *this; // Handle self-assignment
     }
-    mpfr_set(mass, other.mass, MPFR_RNDN);
-    mpfr_set(exhaustVelocity, other.exhaustVelocity, MPFR_RNDN);
+    Backend::copy(mass, other.mass);
+    Backend::copy(exhaustVelocity, other.exhaustVelocity);
 
     name = other.name;
+    id = other.id;
 
     return *this;
 }
 
 // Move operations:
-Engine::Engine(Engine&& other) noexcept {
-    mass[0] = other.mass[0];
-    other.mass[0]._mpfr_d = nullptr;
-
-    exhaustVelocity[0] = other.exhaustVelocity[0];
-    other.exhaustVelocity[0]._mpfr_d = nullptr;
+template <typename Backend>
+BasicEngine<Backend>::BasicEngine(BasicEngine&& other) noexcept {
+    Backend::move(mass, other.mass);
+    Backend::move(exhaustVelocity, other.exhaustVelocity);
 
     name = std::move(other.name);
+    id = other.id;
 }
 
-Engine& Engine::operator=(Engine&& other)  noexcept {
+template <typename Backend>
+BasicEngine<Backend>& BasicEngine<Backend>::operator=(BasicEngine&& other)  noexcept {
     if (this == &other) {
         return *this; // Handle self-assignment
     }
 
-    mass[0] = other.mass[0];
-    other.mass[0]._mpfr_d = nullptr;
-
-    exhaustVelocity[0] = other.exhaustVelocity[0];
-    other.exhaustVelocity[0]._mpfr_d = nullptr;
+    Backend::move(mass, other.mass);
+    Backend::move(exhaustVelocity, other.exhaustVelocity);
 
     name = std::move(other.name);
+    id = other.id;
 
     return *this;
-}
\ No newline at end of file
+}
+
+template class BasicEngine<DoubleBackend>;
+template class BasicEngine<LongDoubleBackend>;
+template class BasicEngine<DoubleDoubleBackend>;
+template class BasicEngine<MpfrBackend>;
+#ifdef IRA_FLOAT128
+template class BasicEngine<Float128Backend>;
+#endif
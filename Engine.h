@@ -8,22 +8,61 @@
 #include <vector>
 #include <mpfr.h>
 #include <string>
+#include <cstdint>
+#include <limits>
+#include "NumericBackend.h"
 
-class Engine {
+/**
+ * @brief Dense handle of an engine within its SpaceShipHandler. Ids count up from 0 in creation order.
+ * @details Not an integer, so a count, an index or a status code can't be passed as an id by accident, and a literal 0
+ *          never has to choose between an EngineId and a null Engine*.
+ */
+struct EngineId {
+    uint32_t value;                             /**< Position of the engine in creation order. */
+
+    constexpr EngineId() : value(std::numeric_limits<uint32_t>::max()) {}
+    constexpr explicit EngineId(uint32_t value) : value(value) {}
+
+    bool operator==(const EngineId other) const {
+        return value == other.value;
+    }
+    bool operator!=(const EngineId other) const {
+        return value != other.value;
+    }
+    bool operator<(const EngineId other) const {
+        return value < other.value;
+    }
+};
+constexpr EngineId invalidEngineId;             /**< Id of no engine. */
+
+/**
+ * @brief An engine, with its values held by a numeric backend.
+ * @details The supported backends are instantiated in Engine.cpp.
+ * @tparam Backend A numeric backend from NumericBackend.h.
+ */
+template <typename Backend>
+class BasicEngine {
 public:
-    mpfr_t mass,                                /**< Mass of the engine. */
+    typename Backend::storage_type mass,        /**< Mass of the engine. */
     exhaustVelocity;                            /**< Exhaust velocity of the engine. */
     std::string name;                           /**< Name of the engine. */
+    EngineId id = invalidEngineId;              /**< Handle of the engine in its handler, if any. */
 
-    Engine();
-    ~Engine();
+    /**
+     * @brief Constructs an engine whose values are initialized by the given backend.
+     * @param backend Numeric backend, which holds the precision for MPFR.
+     */
+    explicit BasicEngine(const Backend& backend = Backend());
+    ~BasicEngine();
 
-    Engine& operator=(const Engine& other);
-    Engine(const Engine& other);
-    Engine& operator=(Engine&& other) noexcept;
-    Engine(Engine&& other) noexcept;
+    BasicEngine& operator=(const BasicEngine& other);
+    BasicEngine(const BasicEngine& other);
+    BasicEngine& operator=(BasicEngine&& other) noexcept;
+    BasicEngine(BasicEngine&& other) noexcept;
 
 };
 
+typedef BasicEngine<MpfrBackend> Engine;
+
 
 #endif //IRA_ENGINE_H
@@ -0,0 +1,237 @@
+//
+// Created by user on 6/25/23.
+//
+
+#include "EngineAssignment.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <limits>
+
+EngineAssignmentSolver::EngineAssignmentSolver(SpaceShipHandler& handler, std::vector<long double> dryMasses,
+                                               std::vector<long double> fuelMasses, std::vector<EngineId> engines)
+        : handler(handler), dryMasses(std::move(dryMasses)), fuelMasses(std::move(fuelMasses)),
+          engineIds(std::move(engines)) {}
+
+int EngineAssignmentSolver::prepare(const char* caller) {
+    nodesVisited = 0;
+    nodesPruned = 0;
+    candidatesConfirmed = 0;
+    candidates.clear();
+
+    if (dryMasses.empty() || dryMasses.size() != fuelMasses.size()) {
+        std::cerr << "[EngineAssignmentSolver::" << caller << "] Need the same number of dry and fuel masses."
+                  << std::endl;
+        return 1;
+    }
+    std::vector<EngineId> ids = engineIds;
+    if (ids.empty()) {
+        for (uint32_t id = 0; id < handler.getEngineCount(); id++) {
+            ids.push_back(EngineId(id));
+        }
+    }
+    if (ids.empty()) {
+        std::cerr << "[EngineAssignmentSolver::" << caller << "] No engines to pick from." << std::endl;
+        return 1;
+    }
+
+    std::vector<Option> all;
+    for (EngineId id : ids) {
+        if (id.value >= handler.getEngineCount()) {
+            std::cerr << "[EngineAssignmentSolver::" << caller << "] Engine " << id.value << " does not exist."
+                      << std::endl;
+            return 1;
+        }
+        const Engine* engine = handler.getEngine(id);
+        all.push_back({id, mpfr_get_d(engine->mass, MPFR_RNDN), mpfr_get_d(engine->exhaustVelocity, MPFR_RNDN)});
+    }
+    std::sort(all.begin(), all.end(), [](const Option& a, const Option& b) {
+        if (a.mass != b.mass) {
+            return a.mass < b.mass;
+        }
+        return a.exhaustVelocity != b.exhaustVelocity ? a.exhaustVelocity > b.exhaustVelocity : a.id < b.id;
+    });
+    options.clear();
+    for (auto &option : all) {                                              // Keep the Pareto front
+        if (options.empty() || option.exhaustVelocity > options.back().exhaustVelocity) {
+            options.push_back(option);
+        }
+    }
+
+    const size_t stageCount = dryMasses.size();
+    dryDoubles.resize(stageCount);
+    fuelDoubles.resize(stageCount);
+    payloadBelow.assign(stageCount + 1, 0);
+    for (size_t i = 0; i < stageCount; i++) {
+        dryDoubles[i] = (double) dryMasses[i];
+        fuelDoubles[i] = (double) fuelMasses[i];
+        payloadBelow[i + 1] = payloadBelow[i] + dryDoubles[i] + fuelDoubles[i];
+    }
+    tolerance = 16 * (double) (stageCount + 8) * DBL_EPSILON;
+    choice.assign(stageCount, 0);
+    return 0;
+}
+
+double EngineAssignmentSolver::deltaVBound(size_t stage, double massAbove) const {
+    const double lightest = options.front().mass;
+    double bound = 0;
+    for (size_t k = stage + 1; k-- > 0;) {
+        double best = 0;
+        for (auto &option : options) {
+            best = std::max(best, option.exhaustVelocity
+                                  * std::log1p(fuelDoubles[k] / (massAbove + dryDoubles[k] + option.mass)));
+        }
+        bound += best;
+        massAbove += dryDoubles[k] + fuelDoubles[k] + lightest;
+    }
+    return bound;
+}
+
+void EngineAssignmentSolver::search(size_t remaining, double massAbove, double deltaV) {
+    nodesVisited++;
+    if (remaining == 0) {
+        leaf(massAbove, deltaV);
+        return;
+    }
+    const size_t stage = remaining - 1;
+    const double bound = (deltaV + deltaVBound(stage, massAbove)) * (1 + tolerance);
+    if (goal == Goal::deltaV ? bound < incumbent * (1 - tolerance) : bound < target) {
+        nodesPruned++;
+        return;
+    }
+    if (goal == Goal::mass
+        && massAbove + payloadBelow[remaining] + remaining * options.front().mass > incumbent * (1 + tolerance)) {
+        nodesPruned++;
+        return;
+    }
+
+    for (size_t i = 0; i < options.size(); i++) {
+        // Fastest engines first when chasing delta-V, lightest first when saving mass.
+        const uint option = (uint) (goal == Goal::deltaV ? options.size() - 1 - i : i);
+        const double rest = massAbove + dryDoubles[stage] + options[option].mass;
+        choice[stage] = option;
+        search(stage, rest + fuelDoubles[stage],
+               deltaV + options[option].exhaustVelocity * std::log1p(fuelDoubles[stage] / rest));
+    }
+}
+
+void EngineAssignmentSolver::leaf(double mass, double deltaV) {
+    bool improved = false;
+    if (goal == Goal::deltaV) {
+        if (deltaV < incumbent * (1 - 2 * tolerance)) {
+            return;
+        }
+        if (deltaV > incumbent) {
+            incumbent = deltaV;
+            improved = true;
+        }
+    } else {
+        if (deltaV < target * (1 - tolerance) || mass > incumbent * (1 + tolerance)) {
+            return;
+        }
+        if (deltaV >= target * (1 + tolerance) && mass < incumbent) {      // Surely reaches the target
+            incumbent = mass;
+            improved = true;
+        }
+    }
+    candidates.push_back({choice, deltaV, mass});
+    if (!improved) {
+        return;
+    }
+    candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [&](const Candidate& candidate) {
+        return goal == Goal::deltaV ? candidate.deltaV < incumbent * (1 - 2 * tolerance)
+                                    : candidate.mass > incumbent * (1 + tolerance);
+    }), candidates.end());
+}
+
+int EngineAssignmentSolver::confirm(EngineAssignment& result, const char* caller) {
+    const size_t stageCount = dryMasses.size();
+    SpaceShipWrapper ship(handler.getPrecision());
+    std::vector<uint> shipOptions(stageCount, 0);
+    for (size_t i = 0; i < stageCount; i++) {
+        ship.addStage(dryMasses[i], fuelMasses[i], handler.getEngine(options[0].id));
+    }
+
+    mpfr_t bestDeltaV, bestMass, deltaV, mass;
+    mpfr_init2(bestDeltaV, handler.getPrecision());
+    mpfr_init2(bestMass, handler.getPrecision());
+    const Candidate* best = nullptr;
+    for (auto &candidate : candidates) {
+        for (size_t i = 0; i < stageCount; i++) {                           // Only the stages that differ go stale
+            if (candidate.options[i] != shipOptions[i]) {
+                ship.setStageEngine((uint) i, handler.getEngine(options[candidate.options[i]].id));
+                shipOptions[i] = candidate.options[i];
+            }
+        }
+        ship.getRawDeltaV(deltaV);
+        ship.getRawMass(mass);
+        candidatesConfirmed++;
+
+        bool better;
+        if (goal == Goal::deltaV) {
+            better = best == nullptr || mpfr_cmp(deltaV, bestDeltaV) > 0;
+        } else if (mpfr_cmp_ld(deltaV, target) < 0) {
+            better = false;
+        } else {
+            const int massOrder = best == nullptr ? -1 : mpfr_cmp(mass, bestMass);
+            better = massOrder < 0 || (massOrder == 0 && mpfr_cmp(deltaV, bestDeltaV) > 0);
+        }
+        if (better) {
+            best = &candidate;
+            mpfr_set(bestDeltaV, deltaV, MPFR_RNDN);
+            mpfr_set(bestMass, mass, MPFR_RNDN);
+        }
+        mpfr_clear(deltaV);
+        mpfr_clear(mass);
+    }
+
+    if (best != nullptr) {
+        result.engines.resize(stageCount);
+        for (size_t i = 0; i < stageCount; i++) {
+            result.engines[i] = options[best->options[i]].id;
+        }
+        result.deltaV = mpfr_get_ld(bestDeltaV, MPFR_RNDN);
+        result.mass = mpfr_get_ld(bestMass, MPFR_RNDN);
+    }
+    mpfr_clear(bestDeltaV);
+    mpfr_clear(bestMass);
+    if (best == nullptr) {
+        std::cerr << "[EngineAssignmentSolver::" << caller << "] No engine assignment reaches the target delta-V."
+                  << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int EngineAssignmentSolver::maximizeDeltaV(EngineAssignment& result) {
+    if (prepare("maximizeDeltaV") != 0) {
+        return 1;
+    }
+    goal = Goal::deltaV;
+    incumbent = 0;
+    search(dryMasses.size(), 0, 0);
+    return confirm(result, "maximizeDeltaV");
+}
+
+int EngineAssignmentSolver::minimizeMass(long double targetDeltaV, EngineAssignment& result) {
+    if (prepare("minimizeMass") != 0) {
+        return 1;
+    }
+    goal = Goal::mass;
+    target = targetDeltaV;
+    incumbent = std::numeric_limits<double>::infinity();
+    search(dryMasses.size(), 0, 0);
+    return confirm(result, "minimizeMass");
+}
+
+size_t EngineAssignmentSolver::getNodesVisited() const {
+    return nodesVisited;
+}
+
+size_t EngineAssignmentSolver::getNodesPruned() const {
+    return nodesPruned;
+}
+
+size_t EngineAssignmentSolver::getCandidatesConfirmed() const {
+    return candidatesConfirmed;
+}
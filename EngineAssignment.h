@@ -0,0 +1,152 @@
+//
+// Created by user on 6/25/23.
+//
+
+#include <vector>
+#include "SpaceShipHandler.h"
+
+#ifndef IRA_ENGINEASSIGNMENT_H
+#define IRA_ENGINEASSIGNMENT_H
+
+/**
+ * @brief Engines picked for each stage of a ship, and what they give.
+ */
+struct EngineAssignment {
+    std::vector<EngineId> engines;              /**< Engine of each stage, in burn order. */
+    long double deltaV = 0;                     /**< Total delta-V, computed at the handler's precision. */
+    long double mass = 0;                       /**< Total mass, computed at the handler's precision. */
+};
+
+/**
+ * @brief Picks the engine of every stage of a ship whose stage masses are fixed.
+ * @details A stage's delta-V only depends on itself and the stages above it, so the search assigns engines from the
+ *          top stage down, depth first. Each partial assignment is bounded in double precision: every stage below
+ *          gets the best delta-V any engine could give it under the lightest possible stack, and subtrees that cannot
+ *          beat the best assignment found so far are pruned. Engines that are both heavier and slower than another
+ *          are never worth picking and are dropped up front.
+ *
+ *          Bounds get a relative margin for double roundoff, and every assignment within that margin of the best is
+ *          kept and re-evaluated at the handler's precision, which decides the winner. Results are exact, not just
+ *          close in double.
+ * @note Engines must not be edited while solving.
+ */
+class EngineAssignmentSolver {
+public:
+    /**
+     * @brief Sets up a solver.
+     * @param handler Handler the engines belong to; also sets the precision of the final evaluation.
+     * @param dryMasses Dry mass of each stage, in burn order (0 is the first to burn).
+     * @param fuelMasses Fuel mass of each stage, in burn order.
+     * @param engines Engines to pick from. Empty for every engine of the handler.
+     */
+    EngineAssignmentSolver(SpaceShipHandler& handler, std::vector<long double> dryMasses,
+                           std::vector<long double> fuelMasses,
+                           std::vector<EngineId> engines = std::vector<EngineId>());
+
+    /**
+     * @brief Finds the assignment with the most delta-V.
+     * @param result Filled in with the best assignment.
+     * @return 0 if successful, 1 if not.
+     */
+    int maximizeDeltaV(EngineAssignment& result);
+
+    /**
+     * @brief Finds the lightest assignment that reaches a delta-V.
+     * @param targetDeltaV Delta-V the ship needs.
+     * @param result Filled in with the lightest assignment; on ties, the one with the most delta-V.
+     * @return 0 if successful, 1 if not or if no assignment reaches targetDeltaV.
+     */
+    int minimizeMass(long double targetDeltaV, EngineAssignment& result);
+
+    /**
+     * @brief Returns the number of search nodes the last solve visited.
+     * @return Number of partial and full assignments visited.
+     */
+    size_t getNodesVisited() const;
+
+    /**
+     * @brief Returns the number of search nodes the last solve pruned by their bound.
+     * @return Number of pruned nodes.
+     */
+    size_t getNodesPruned() const;
+
+    /**
+     * @brief Returns the number of assignments the last solve re-evaluated at full precision.
+     * @return Number of confirmed assignments.
+     */
+    size_t getCandidatesConfirmed() const;
+
+private:
+    enum class Goal {
+        deltaV,
+        mass
+    };
+
+    /**
+     * @brief An engine worth picking, with its values in double.
+     */
+    struct Option {
+        EngineId id;
+        double mass;
+        double exhaustVelocity;
+    };
+
+    /**
+     * @brief An assignment kept for the full precision evaluation.
+     */
+    struct Candidate {
+        std::vector<uint> options;              /**< Index into options of each stage's engine. */
+        double deltaV;
+        double mass;
+    };
+
+    SpaceShipHandler& handler;
+    std::vector<long double> dryMasses, fuelMasses;
+    std::vector<EngineId> engineIds;
+    std::vector<Option> options;                /**< Non-dominated engines, lightest (and slowest) first. */
+    std::vector<double> dryDoubles, fuelDoubles;
+    std::vector<double> payloadBelow;           /**< [k] is the dry and fuel mass of stages [0, k). */
+
+    Goal goal = Goal::deltaV;
+    long double target = 0;                     /**< Target delta-V of Goal::mass. */
+    double tolerance = 0;                       /**< Relative margin for double roundoff. */
+    double incumbent = 0;                       /**< Best delta-V, or lightest mass reaching the target, so far. */
+    std::vector<uint> choice;                   /**< Option of each assigned stage. */
+    std::vector<Candidate> candidates;
+    size_t nodesVisited = 0;
+    size_t nodesPruned = 0;
+    size_t candidatesConfirmed = 0;
+
+    /**
+     * @brief Checks the inputs and reads the engines.
+     * @return 0 if successful, 1 if not.
+     */
+    int prepare(const char* caller);
+
+    /**
+     * @brief Upper bound on the delta-V of stages [0, stage] under massAbove.
+     */
+    double deltaVBound(size_t stage, double massAbove) const;
+
+    /**
+     * @brief Assigns stages [0, remaining) below a partial assignment.
+     * @param remaining Number of stages left to assign.
+     * @param massAbove Mass of the assigned stages.
+     * @param deltaV Delta-V of the assigned stages.
+     */
+    void search(size_t remaining, double massAbove, double deltaV);
+
+    /**
+     * @brief Records a full assignment and drops the candidates it rules out.
+     */
+    void leaf(double mass, double deltaV);
+
+    /**
+     * @brief Evaluates every candidate at full precision and picks the winner.
+     * @return 0 if successful, 1 if no candidate meets the goal.
+     */
+    int confirm(EngineAssignment& result, const char* caller);
+};
+
+
+#endif //IRA_ENGINEASSIGNMENT_H
@@ -0,0 +1,78 @@
+//
+// Created by user on 6/20/23.
+//
+
+#include "EngineTable.h"
+
+EngineTable::EngineTable() : count(0) {
+    for (auto &chunk : chunks) {
+        chunk.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+EngineTable::~EngineTable() {
+    for (int chunk = 0; chunk < chunkCount; chunk++) {
+        std::atomic<Engine*>* slots = chunks[chunk].load(std::memory_order_acquire);
+        if (slots == nullptr) {
+            continue;
+        }
+        for (size_t slot = 0; slot < ((size_t) 1 << (chunk + firstChunkBits)); slot++) {
+            delete slots[slot].load(std::memory_order_relaxed);
+        }
+        delete[] slots;
+    }
+}
+
+void EngineTable::locate(EngineId id, int& chunk, size_t& slot) {
+    // Chunk k starts at id 16 * (2^k - 1), so k = floor(log2(id / 16 + 1)).
+    const size_t position = ((size_t) id.value >> firstChunkBits) + 1;
+    chunk = 0;
+    while (((size_t) 2 << chunk) <= position) {
+        chunk++;
+    }
+    slot = (size_t) id.value - ((((size_t) 1 << chunk) - 1) << firstChunkBits);
+}
+
+std::atomic<Engine*>* EngineTable::chunkSlots(int chunk) {
+    std::atomic<Engine*>* slots = chunks[chunk].load(std::memory_order_acquire);
+    if (slots != nullptr) {
+        return slots;
+    }
+    auto* fresh = new std::atomic<Engine*>[(size_t) 1 << (chunk + firstChunkBits)]();
+    if (chunks[chunk].compare_exchange_strong(slots, fresh, std::memory_order_acq_rel)) {
+        return fresh;
+    }
+    delete[] fresh;                                                         // Another thread got there first
+    return slots;
+}
+
+EngineId EngineTable::reserve() {
+    const EngineId id(count.fetch_add(1, std::memory_order_relaxed));
+    int chunk;
+    size_t slot;
+    locate(id, chunk, slot);
+    chunkSlots(chunk);
+    return id;
+}
+
+void EngineTable::publish(EngineId id, Engine* engine) {
+    int chunk;
+    size_t slot;
+    locate(id, chunk, slot);
+    chunkSlots(chunk)[slot].store(engine, std::memory_order_release);
+}
+
+Engine* EngineTable::get(EngineId id) const {
+    if (id.value >= count.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    int chunk;
+    size_t slot;
+    locate(id, chunk, slot);
+    std::atomic<Engine*>* slots = chunks[chunk].load(std::memory_order_acquire);
+    return slots == nullptr ? nullptr : slots[slot].load(std::memory_order_acquire);
+}
+
+uint32_t EngineTable::size() const {
+    return count.load(std::memory_order_acquire);
+}
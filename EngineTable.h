@@ -0,0 +1,72 @@
+//
+// Created by user on 6/20/23.
+//
+
+#include <atomic>
+#include <cstddef>
+#include "Engine.h"
+
+#ifndef IRA_ENGINETABLE_H
+#define IRA_ENGINETABLE_H
+
+/**
+ * @brief Engines by EngineId, readable while other threads add engines.
+ * @details Slots live in chunks that double in size and never move, so a published Engine* stays valid without any
+ *          lock. Adding an engine is a reserve (one atomic increment) followed by a publish (one release store);
+ *          get pairs with the publish through an acquire load, so a reader that sees the pointer also sees the engine
+ *          fully constructed. The table owns its engines.
+ */
+class EngineTable {
+public:
+    EngineTable();
+    ~EngineTable();
+
+    EngineTable(const EngineTable& other) = delete;
+    EngineTable& operator=(const EngineTable& other) = delete;
+
+    /**
+     * @brief Reserves the next id. Its slot reads as empty until publish is called.
+     * @return The id.
+     */
+    EngineId reserve();
+
+    /**
+     * @brief Stores the engine for a reserved id and makes it visible to every thread.
+     * @param id Reserved id.
+     * @param engine The engine, owned by the table from now on.
+     */
+    void publish(EngineId id, Engine* engine);
+
+    /**
+     * @brief Gets an engine by id.
+     * @param id Id of the engine.
+     * @return The engine, or nullptr if the id is out of range or not published yet.
+     */
+    Engine* get(EngineId id) const;
+
+    /**
+     * @brief Returns the number of reserved ids. Valid ids are [0, size()), though the latest may not be published.
+     * @return Number of ids.
+     */
+    uint32_t size() const;
+
+private:
+    static const int firstChunkBits = 4;        // Chunk k holds 16 << k slots,
+    static const int chunkCount = 29;           // enough for every EngineId.
+
+    std::atomic<std::atomic<Engine*>*> chunks[chunkCount];  /**< Slot arrays, allocated on first use. */
+    std::atomic<uint32_t> count;                              /**< Number of reserved ids. */
+
+    /**
+     * @brief Finds the chunk and the slot within it for an id.
+     */
+    static void locate(EngineId id, int& chunk, size_t& slot);
+
+    /**
+     * @brief Returns a chunk's slots, allocating them if no thread has yet.
+     */
+    std::atomic<Engine*>* chunkSlots(int chunk);
+};
+
+
+#endif //IRA_ENGINETABLE_H
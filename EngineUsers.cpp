@@ -0,0 +1,97 @@
+//
+// Created by user on 6/15/23.
+//
+
+#include "EngineUsers.h"
+#include "SpaceShip.h"
+#include <algorithm>
+
+EngineUsers::EditGuard::EditGuard(EngineUsers& index, const Engine* engine)
+        : lock(index.usersMutex) {
+    for (;;) {
+        auto engineUsers = index.users.find(engine);
+        if (engineUsers == index.users.end()) {
+            return;
+        }
+        SpaceShip* busy = nullptr;
+        for (auto &shipStages : engineUsers->second) {                     // Only tried: a busy ship may be waiting
+            if (!shipStages.first->operations.try_lock()) {                 // for the index this thread holds.
+                busy = shipStages.first;
+                break;
+            }
+            ships.push_back(&shipStages.first->operations);
+        }
+        if (busy == nullptr) {
+            return;
+        }
+        unlockShips();
+        index.pins[busy]++;                                                 // Can't be destroyed while pinned
+        lock.unlock();
+        busy->operations.lock();                                            // Sleeps until its operation ends
+        busy->operations.unlock();
+        lock.lock();
+        if (--index.pins[busy] == 0) {
+            index.pins.erase(busy);
+            index.unpinned.notify_all();
+        }
+    }
+}
+
+EngineUsers::EditGuard::~EditGuard() {
+    unlockShips();
+}
+
+void EngineUsers::EditGuard::unlockShips() {
+    for (auto &ship : ships) {
+        ship->unlock();
+    }
+    ships.clear();
+}
+
+void EngineUsers::attach(const Engine* engine, SpaceShip* ship, Stage* stage) {
+    users[engine][ship].push_back(stage);
+}
+
+void EngineUsers::detach(const Engine* engine, SpaceShip* ship, Stage* stage) {
+    auto engineUsers = users.find(engine);
+    if (engineUsers == users.end()) {
+        return;
+    }
+    auto shipStages = engineUsers->second.find(ship);
+    if (shipStages == engineUsers->second.end()) {
+        return;
+    }
+
+    auto &stages = shipStages->second;
+    auto position = std::find(stages.begin(), stages.end(), stage);
+    if (position != stages.end()) {
+        *position = stages.back();                                          // Order doesn't matter
+        stages.pop_back();
+    }
+    if (stages.empty()) {
+        engineUsers->second.erase(shipStages);
+    }
+    if (engineUsers->second.empty()) {
+        users.erase(engineUsers);
+    }
+}
+
+void EngineUsers::detachShip(SpaceShip* ship, const std::vector<Stage*>& stages) {
+    std::unique_lock<std::mutex> lock(usersMutex);
+    unpinned.wait(lock, [&]() { return pins.find(ship) == pins.end(); });
+    for (auto &stage : stages) {
+        auto engineUsers = users.find(stage->engine);
+        if (engineUsers == users.end()) {
+            continue;
+        }
+        engineUsers->second.erase(ship);
+        if (engineUsers->second.empty()) {
+            users.erase(engineUsers);
+        }
+    }
+}
+
+const EngineUsers::ShipStages* EngineUsers::find(const Engine* engine) const {
+    auto engineUsers = users.find(engine);
+    return engineUsers == users.end() ? nullptr : &engineUsers->second;
+}
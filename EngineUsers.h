@@ -0,0 +1,130 @@
+//
+// Created by user on 6/15/23.
+//
+
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include "Engine.h"
+#include "Stage.h"
+
+#ifndef IRA_ENGINEUSERS_H
+#define IRA_ENGINEUSERS_H
+
+class SpaceShip;
+
+/**
+ * @brief Reverse index from each engine to the ships, and the stages within them, that use it.
+ * @details Kept up to date by SpaceShip whenever a stage is added or its engine changes, so that an edit to an engine
+ *          only has to touch the stages that use it.
+ *
+ *          It also orders engine edits against ship operations. Every public operation of a ship registered here
+ *          holds that ship's own ShipGuard, so operations on different ships never wait for each other. An engine
+ *          edit holds an EditGuard, which takes the index and then the ShipGuard lock of every ship using the engine,
+ *          and nothing else. An edit therefore never overlaps a ship reading the engine, nor the ship state the edit
+ *          updates, and only waits for the ships it changes. A ship holds an IndexGuard while it starts or stops
+ *          using an engine, so it can't read an engine that is being edited before it is recorded as a user.
+ *
+ *          Locks are always taken ship first, then index. An EditGuard holding the index only tries the ship locks.
+ *          When one is busy it lets go of everything, sleeps on that ship's lock until its operation ends, and tries
+ *          again, so it neither spins nor deadlocks against a ship waiting for the index. The ship is pinned while
+ *          the edit waits on it without the index, and detachShip, which a ship calls as it is destroyed, waits for
+ *          its pins to go. Public ship methods may call each other, as ShipGuard is recursive. Engines must not be
+ *          edited from inside a ship operation: two such edits, each waiting for the other's ship, would deadlock.
+ */
+class EngineUsers {
+public:
+    typedef std::unordered_map<SpaceShip*, std::vector<Stage*>> ShipStages;
+
+    /**
+     * @brief Lock on one ship, held for the duration of an operation on it. Recursive, so public ship methods can
+     *        call each other. A ship without an index takes no lock.
+     */
+    class ShipGuard {
+    public:
+        ShipGuard(const EngineUsers* index, std::recursive_mutex& ship) : lock(ship, std::defer_lock) {
+            if (index != nullptr) {
+                lock.lock();
+            }
+        }
+
+    private:
+        std::unique_lock<std::recursive_mutex> lock;
+    };
+
+    /**
+     * @brief Lock on the index, held by a ship while it attaches or detaches a stage. A nullptr index takes no lock.
+     */
+    class IndexGuard {
+    public:
+        explicit IndexGuard(EngineUsers* index) {
+            if (index != nullptr) {
+                lock = std::unique_lock<std::mutex>(index->usersMutex);
+            }
+        }
+
+    private:
+        std::unique_lock<std::mutex> lock;
+    };
+
+    /**
+     * @brief Lock held while editing an engine in place: the index, and every ship using the engine.
+     */
+    class EditGuard {
+    public:
+        EditGuard(EngineUsers& index, const Engine* engine);
+        ~EditGuard();
+
+        EditGuard(const EditGuard& other) = delete;
+        EditGuard& operator=(const EditGuard& other) = delete;
+
+    private:
+        std::unique_lock<std::mutex> lock;              /**< Lock on the index. */
+        std::vector<std::recursive_mutex*> ships;       /**< Locks of the ships using the engine. */
+
+        void unlockShips();
+    };
+
+    /**
+     * @brief Records that a stage of a ship now uses an engine.
+     * @note Only while an IndexGuard is held.
+     * @param engine The engine.
+     * @param ship The ship owning the stage.
+     * @param stage The stage.
+     */
+    void attach(const Engine* engine, SpaceShip* ship, Stage* stage);
+
+    /**
+     * @brief Records that a stage of a ship no longer uses an engine.
+     * @note Only while an IndexGuard is held.
+     * @param engine The engine.
+     * @param ship The ship owning the stage.
+     * @param stage The stage.
+     */
+    void detach(const Engine* engine, SpaceShip* ship, Stage* stage);
+
+    /**
+     * @brief Removes every record of a ship. Waits for edits that are waiting on the ship to let go of it.
+     * @param ship The ship.
+     * @param stages Stages of the ship.
+     */
+    void detachShip(SpaceShip* ship, const std::vector<Stage*>& stages);
+
+    /**
+     * @brief Gets the ships and stages that use an engine.
+     * @note Only valid while an EditGuard for the engine is held, which keeps ships from changing the index.
+     * @param engine The engine.
+     * @return Stages by ship, or nullptr if nothing uses the engine.
+     */
+    const ShipStages* find(const Engine* engine) const;
+
+private:
+    std::unordered_map<const Engine*, ShipStages> users;   /**< Stages using each engine, by ship. */
+    std::mutex usersMutex;                                  /**< Guards users and pins between ships. */
+    std::unordered_map<const SpaceShip*, size_t> pins;     /**< Edits waiting on each ship without the index. */
+    std::condition_variable unpinned;                       /**< Notified when a ship's last pin goes. */
+};
+
+
+#endif //IRA_ENGINEUSERS_H
@@ -0,0 +1,362 @@
+//
+// Created by user on 6/28/23.
+//
+
+#include "MonteCarlo.h"
+#include "DeltaVBatch.h"
+#include "WorkStealingPool.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+
+namespace {
+    const size_t samplesPerTask = 1024;             // Consecutive samples one thread draws and evaluates at once
+
+    const size_t philoxLanes = 16;                  // Counters run through Philox side by side
+
+    /**
+     * @brief Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"): 128 random bits for
+     *        each counter and key, no state. Runs philoxLanes counters at once, words[k][lane] being word k of a
+     *        lane's counter, which keeps the multiplies of independent counters in flight together.
+     */
+    void philox(uint32_t (&words)[4][philoxLanes], const uint64_t key) {
+        uint32_t low = (uint32_t) key, high = (uint32_t) (key >> 32);
+        for (int round = 0; round < 10; round++) {
+            for (size_t lane = 0; lane < philoxLanes; lane++) {
+                const uint64_t first = (uint64_t) 0xD2511F53 * words[0][lane];
+                const uint64_t second = (uint64_t) 0xCD9E8D57 * words[2][lane];
+                words[0][lane] = (uint32_t) (second >> 32) ^ words[1][lane] ^ low;
+                words[1][lane] = (uint32_t) second;
+                words[2][lane] = (uint32_t) (first >> 32) ^ words[3][lane] ^ high;
+                words[3][lane] = (uint32_t) first;
+            }
+            low += 0x9E3779B9;
+            high += 0xBB67AE85;
+        }
+    }
+
+    /**
+     * @brief Uniform draw in (0, 1) from 64 random bits, never 0 or 1.
+     */
+    double uniform(uint32_t high, uint32_t low) {
+        const uint64_t bits = ((uint64_t) high << 32) | low;
+        return ((double) (bits >> 11) + 0.5) / 9007199254740992.0;              // 2^53
+    }
+
+    /**
+     * @brief Inverse of the standard normal CDF, by Acklam's rational approximation.
+     */
+    double inverseNormal(double p) {
+        static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                                   1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00};
+        static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                                   6.680131188771972e+01, -1.328068155288572e+01};
+        static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                                   -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00};
+        static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+                                   3.754408661907416e+00};
+        const double tail = 0.02425;
+        if (p < tail || p > 1 - tail) {
+            const double q = std::sqrt(-2 * std::log(p < tail ? p : 1 - p));
+            const double x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5])
+                             / ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+            return p < tail ? x : -x;
+        }
+        const double q = p - 0.5, r = q * q;
+        return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q
+               / (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+    }
+
+    /**
+     * @brief Count, mean and sum of squared deviations of a run of samples, merged by Chan's formula.
+     */
+    struct Moments {
+        uint64_t count = 0;
+        double mean = 0, squares = 0, min = 0, max = 0;
+
+        void merge(const Moments& other) {
+            if (other.count == 0) {
+                return;
+            }
+            if (count == 0) {
+                *this = other;
+                return;
+            }
+            const double total = (double) (count + other.count), delta = other.mean - mean;
+            mean += delta * (double) other.count / total;
+            squares += other.squares + delta * delta * (double) count * (double) other.count / total;
+            min = std::min(min, other.min);
+            max = std::max(max, other.max);
+            count += other.count;
+        }
+    };
+
+    struct TaskResult {
+        Moments moments;
+        std::vector<uint64_t> violations;           // Samples below each required delta-V
+    };
+
+    struct Worker {
+        QuantileSketch sketch;
+        std::vector<double> values[4];
+        std::vector<double> deltaVs;
+
+        explicit Worker(double relativeAccuracy) : sketch(relativeAccuracy) {}
+    };
+}
+
+MonteCarlo::MonteCarlo(SpaceShipHandler& handler, SpaceShipWrapper* ship, std::vector<StageTolerance> stages,
+                       std::vector<EngineTolerance> engines, MonteCarloOptions options)
+        : handler(handler), ship(ship), stageTolerances(std::move(stages)), engineTolerances(std::move(engines)),
+          options(std::move(options)) {
+    if (ship == nullptr) {
+        throw std::runtime_error("Null pointer exception");
+    }
+}
+
+int MonteCarlo::prepare(const char* caller) {
+    auto valid = [](const Distribution& distribution) {
+        return distribution.spread >= 0 && !std::isinf(distribution.spread);
+    };
+    const std::vector<Stage*>& stages = *ship->getStages();
+    if (stages.empty()) {
+        std::cerr << "[MonteCarlo::" << caller << "] The ship has no stages." << std::endl;
+        return 1;
+    }
+    if (!stageTolerances.empty() && stageTolerances.size() != stages.size()) {
+        std::cerr << "[MonteCarlo::" << caller << "] Need one stage tolerance per stage, or none." << std::endl;
+        return 1;
+    }
+    for (auto &tolerance : stageTolerances) {
+        if (!valid(tolerance.dryMass) || !valid(tolerance.fuelMass)) {
+            std::cerr << "[MonteCarlo::" << caller << "] Spreads have to be non-negative and finite." << std::endl;
+            return 1;
+        }
+    }
+    std::vector<const Engine*> tolerancedEngines;
+    for (auto &tolerance : engineTolerances) {
+        if (tolerance.engine.value >= handler.getEngineCount()) {
+            std::cerr << "[MonteCarlo::" << caller << "] Engine " << tolerance.engine.value << " does not exist."
+                      << std::endl;
+            return 1;
+        }
+        if (!valid(tolerance.mass) || !valid(tolerance.exhaustVelocity)) {
+            std::cerr << "[MonteCarlo::" << caller << "] Spreads have to be non-negative and finite." << std::endl;
+            return 1;
+        }
+        const Engine* engine = handler.getEngine(tolerance.engine);
+        if (std::find(tolerancedEngines.begin(), tolerancedEngines.end(), engine) != tolerancedEngines.end()) {
+            std::cerr << "[MonteCarlo::" << caller << "] Engine " << tolerance.engine.value << " has two tolerances."
+                      << std::endl;
+            return 1;
+        }
+        tolerancedEngines.push_back(engine);
+    }
+    for (double quantile : options.percentiles) {
+        if (!(quantile >= 0 && quantile <= 1)) {
+            std::cerr << "[MonteCarlo::" << caller << "] Percentiles have to be in [0, 1]." << std::endl;
+            return 1;
+        }
+    }
+
+    variables.resize(4 * stages.size());
+    for (size_t i = 0; i < stages.size(); i++) {
+        const Stage* stage = stages[i];
+        const StageTolerance stageTolerance = stageTolerances.empty() ? StageTolerance() : stageTolerances[i];
+        EngineTolerance engineTolerance;
+        uint32_t engineStream = (uint32_t) (2 * i + 1);
+        const size_t found = std::find(tolerancedEngines.begin(), tolerancedEngines.end(), stage->engine)
+                             - tolerancedEngines.begin();
+        if (found < tolerancedEngines.size()) {
+            engineTolerance = engineTolerances[found];
+        }
+        for (size_t j = 0; options.sharedEngineDraws && j < i; j++) {      // Draws of the first stage using it
+            if (stages[j]->engine == stage->engine) {
+                engineStream = (uint32_t) (2 * j + 1);
+                break;
+            }
+        }
+        const Distribution* distributions[4] = {&stageTolerance.dryMass, &stageTolerance.fuelMass,
+                                                &engineTolerance.mass, &engineTolerance.exhaustVelocity};
+        const double nominals[4] = {mpfr_get_d(stage->dryMass, MPFR_RNDN), mpfr_get_d(stage->fuelMass, MPFR_RNDN),
+                                    mpfr_get_d(stage->engine->mass, MPFR_RNDN),
+                                    mpfr_get_d(stage->engine->exhaustVelocity, MPFR_RNDN)};
+        for (size_t k = 0; k < 4; k++) {
+            variables[4 * i + k] = {nominals[k], distributions[k]->kind, (double) distributions[k]->spread,
+                                    k < 2 ? (uint32_t) (2 * i) : engineStream};
+        }
+    }
+    nominalDeltaV = ship->getDeltaV();
+    return 0;
+}
+
+void MonteCarlo::draw(uint64_t begin, size_t count, std::vector<double>* values) const {
+    const size_t stageCount = variables.size() / 4;
+    for (size_t k = 0; k < 4; k++) {
+        values[k].resize(count * stageCount);
+    }
+    for (size_t i = 0; i < stageCount; i++) {
+        const Variable* stageVariables = &variables[4 * i];
+        for (size_t pair = 0; pair < 2; pair++) {                           // Masses, then engine
+            const Variable* drawn = stageVariables + 2 * pair;
+            const bool random = drawn[0].kind != DistributionKind::fixed || drawn[1].kind != DistributionKind::fixed;
+            if (!random) {
+                std::fill_n(&values[2 * pair][i * count], count, drawn[0].nominal);
+                std::fill_n(&values[2 * pair + 1][i * count], count, drawn[1].nominal);
+                continue;
+            }
+            for (size_t first = 0; first < count; first += philoxLanes) {
+                const size_t lanes = std::min(philoxLanes, count - first);
+                uint32_t words[4][philoxLanes];
+                for (size_t lane = 0; lane < philoxLanes; lane++) {        // Counter: sample, value pair
+                    const uint64_t sample = begin + first + lane;
+                    words[0][lane] = (uint32_t) sample;
+                    words[1][lane] = (uint32_t) (sample >> 32);
+                    words[2][lane] = drawn[0].stream;
+                    words[3][lane] = 0;
+                }
+                philox(words, options.seed);
+                for (size_t k = 0; k < 2; k++) {                            // 64 bits for each value of the pair
+                    const Variable& variable = drawn[k];
+                    double* out = &values[2 * pair + k][i * count + first];
+                    for (size_t lane = 0; lane < lanes; lane++) {
+                        const double u = uniform(words[2 * k][lane], words[2 * k + 1][lane]);
+                        double deviation = 0;
+                        if (variable.kind == DistributionKind::normal) {
+                            deviation = inverseNormal(u);
+                        } else if (variable.kind == DistributionKind::uniform) {
+                            deviation = 2 * u - 1;
+                        }
+                        out[lane] = std::max(variable.nominal * (1 + variable.spread * deviation), 0.0);
+                    }
+                }
+            }
+        }
+    }
+}
+
+int MonteCarlo::getSample(uint64_t sample, std::vector<double>& values) {
+    if (prepare("getSample") != 0) {
+        return 1;
+    }
+    std::vector<double> drawn[4];
+    draw(sample, 1, drawn);
+    values.resize(variables.size());
+    for (size_t i = 0; i < variables.size(); i++) {
+        values[i] = drawn[i % 4][i / 4];
+    }
+    return 0;
+}
+
+int MonteCarlo::run(MonteCarloResult& result) {
+    if (prepare("run") != 0) {
+        return 1;
+    }
+    if (options.samples == 0) {
+        std::cerr << "[MonteCarlo::run] Need at least one sample." << std::endl;
+        return 1;
+    }
+    const size_t stageCount = variables.size() / 4;
+    const size_t requiredCount = options.requiredDeltaVs.size();
+    const size_t chunkSize = std::max(options.chunkSize / samplesPerTask, (size_t) 1) * samplesPerTask;
+
+    WorkStealingPool pool(options.threads);
+    std::vector<Worker> workers(pool.getThreadCount(), Worker(options.relativeAccuracy));
+    std::vector<Worker*> idleWorkers;
+    for (auto &worker : workers) {
+        idleWorkers.push_back(&worker);
+    }
+    std::mutex idleMutex;
+
+    std::vector<TaskResult> taskResults(std::min(chunkSize, options.samples) / samplesPerTask + 1);
+    Moments total;
+    std::vector<uint64_t> violations(requiredCount, 0);
+    std::vector<size_t> order;
+
+    for (size_t chunkStart = 0; chunkStart < options.samples; chunkStart += chunkSize) {
+        const size_t chunkEnd = std::min(options.samples, chunkStart + chunkSize);
+        order.resize((chunkEnd - chunkStart + samplesPerTask - 1) / samplesPerTask);
+        for (size_t task = 0; task < order.size(); task++) {
+            order[task] = task;
+        }
+
+        pool.run(order, [&](size_t task) {
+            Worker* worker;
+            {
+                std::lock_guard<std::mutex> lock(idleMutex);
+                worker = idleWorkers.back();
+                idleWorkers.pop_back();
+            }
+            const size_t begin = chunkStart + task * samplesPerTask;
+            const size_t count = std::min(chunkEnd, begin + samplesPerTask) - begin;
+            draw(begin, count, worker->values);
+            worker->deltaVs.resize(count);
+
+            ShipBatch batch;
+            batch.shipCount = count;
+            batch.stageCount = stageCount;
+            batch.dryMasses = worker->values[0].data();
+            batch.fuelMasses = worker->values[1].data();
+            batch.engineMasses = worker->values[2].data();
+            batch.exhaustVelocities = worker->values[3].data();
+            batch.deltaVs = worker->deltaVs.data();
+            DeltaVBatch::evaluate(batch);
+
+            TaskResult& taskResult = taskResults[task];
+            Moments& moments = taskResult.moments;
+            moments = Moments();
+            moments.count = count;
+            moments.min = moments.max = worker->deltaVs[0];
+            double sum = 0;
+            for (double deltaV : worker->deltaVs) {
+                sum += deltaV;
+                moments.min = std::min(moments.min, deltaV);
+                moments.max = std::max(moments.max, deltaV);
+                worker->sketch.add(deltaV);
+            }
+            moments.mean = sum / (double) count;
+            for (double deltaV : worker->deltaVs) {                         // Two passes: no cancellation
+                moments.squares += (deltaV - moments.mean) * (deltaV - moments.mean);
+            }
+            taskResult.violations.assign(requiredCount, 0);
+            for (size_t j = 0; j < requiredCount; j++) {
+                const double required = (double) options.requiredDeltaVs[j];
+                for (double deltaV : worker->deltaVs) {
+                    taskResult.violations[j] += deltaV < required;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(idleMutex);
+            idleWorkers.push_back(worker);
+        });
+
+        for (size_t task = 0; task < order.size(); task++) {               // In sample order, whatever the threads
+            total.merge(taskResults[task].moments);
+            for (size_t j = 0; j < requiredCount; j++) {
+                violations[j] += taskResults[task].violations[j];
+            }
+        }
+    }
+
+    result.samples = options.samples;
+    result.nominalDeltaV = nominalDeltaV;
+    result.mean = total.mean;
+    result.standardDeviation = total.count > 1 ? std::sqrt(total.squares / (double) (total.count - 1)) : 0;
+    result.min = total.min;
+    result.max = total.max;
+    result.sketch = QuantileSketch(options.relativeAccuracy);
+    for (auto &worker : workers) {
+        result.sketch.merge(worker.sketch);
+    }
+    result.percentiles.clear();
+    for (double quantile : options.percentiles) {
+        result.percentiles.push_back(result.sketch.getQuantile(quantile));
+    }
+    result.violationProbabilities.clear();
+    for (size_t j = 0; j < requiredCount; j++) {
+        result.violationProbabilities.push_back((double) violations[j] / (double) options.samples);
+    }
+    return 0;
+}
@@ -0,0 +1,150 @@
+//
+// Created by user on 6/28/23.
+//
+
+#include <vector>
+#include <cstdint>
+#include "SpaceShipHandler.h"
+#include "QuantileSketch.h"
+
+#ifndef IRA_MONTECARLO_H
+#define IRA_MONTECARLO_H
+
+/**
+ * @brief Shapes of the distribution of an uncertain value.
+ */
+enum class DistributionKind {
+    fixed,      /**< Always the nominal value. */
+    normal,     /**< Normal around the nominal value, spread is the standard deviation. */
+    uniform     /**< Uniform around the nominal value, spread is the half width. */
+};
+
+/**
+ * @brief Distribution of a value around its nominal value. Draws below 0 are clamped to 0.
+ */
+struct Distribution {
+    DistributionKind kind = DistributionKind::fixed;
+    long double spread = 0;                     /**< Relative to the nominal value: 0.01 is 1%. */
+};
+
+/**
+ * @brief Manufacturing and loading tolerances of one stage.
+ */
+struct StageTolerance {
+    Distribution dryMass;
+    Distribution fuelMass;
+};
+
+/**
+ * @brief Performance tolerances of an engine, applied to every stage that uses it.
+ */
+struct EngineTolerance {
+    EngineId engine;                            /**< Engine of the handler. */
+    Distribution mass;
+    Distribution exhaustVelocity;
+};
+
+struct MonteCarloOptions {
+    size_t samples = 1'000'000;
+    uint64_t seed = 0;                          /**< Key of the random streams. */
+    unsigned threads = 0;                       /**< Sampling threads, 0 for one per core. */
+    size_t chunkSize = 1 << 16;                 /**< Samples per round of tasks. */
+    bool sharedEngineDraws = false;             /**< One draw per engine and sample, shared by every stage using it,
+                                                     for errors in the engine's figures rather than unit to unit
+                                                     scatter. By default each stage draws its own. */
+    double relativeAccuracy = 1e-3;             /**< Relative accuracy of the percentiles. */
+    std::vector<double> percentiles = {0.01, 0.05, 0.5, 0.95, 0.99};   /**< Quantiles to report, in [0, 1]. */
+    std::vector<long double> requiredDeltaVs;   /**< Delta-Vs whose probability of being missed is reported. */
+};
+
+/**
+ * @brief Statistics of the sampled delta-Vs.
+ */
+struct MonteCarloResult {
+    size_t samples = 0;
+    long double nominalDeltaV = 0;              /**< Delta-V of the ship as it is, at its precision. */
+    double mean = 0, standardDeviation = 0, min = 0, max = 0;
+    std::vector<double> percentiles;            /**< Delta-V at each of MonteCarloOptions::percentiles. */
+    std::vector<double> violationProbabilities; /**< Fraction of samples below each required delta-V. */
+    QuantileSketch sketch;                      /**< Every sample, for other quantiles. */
+};
+
+/**
+ * @brief Propagates engine and stage tolerances to a ship's delta-V by Monte Carlo sampling.
+ * @details Samples are drawn into flat double arrays and evaluated by DeltaVBatch, the vectorized hardware float
+ *          kernel, so no SpaceShipWrapper is built per sample. They are split into tasks of consecutive samples on a
+ *          WorkStealingPool, one chunk of tasks at a time. Each task's statistics are folded into the totals in
+ *          sample order after its chunk, and each thread keeps its own QuantileSketch, merged at the end, so memory
+ *          is bounded by chunkSize and the sketch's buckets however many samples are run.
+ *
+ *          Every draw comes from Philox4x32-10, a counter-based generator: the seed is the key and the counter is the
+ *          sample index and the value drawn. Any thread can draw any sample without a stream to carry, and results
+ *          are the same for a seed whatever the threads and chunk size. Normal draws go through the inverse normal
+ *          CDF (Acklam's approximation, relative error below 1.2e-9).
+ *
+ *          Delta-Vs are in double and agree with the ship's own to about ten units of double roundoff, see
+ *          DeltaVBatch; the nominal delta-V is reported at the ship's precision.
+ * @note The ship and engines must not be edited during run.
+ */
+class MonteCarlo {
+public:
+    /**
+     * @brief Sets up a propagation.
+     * @param handler Handler the tolerances' engines belong to.
+     * @param ship Ship whose current values are the nominal ones. Must outlive the propagation.
+     * @param stages Tolerances of each stage, in burn order, or empty for fixed stage masses.
+     * @param engines Tolerances of engines; engines not listed are fixed.
+     * @param options Samples, seed, threads and what to report.
+     */
+    MonteCarlo(SpaceShipHandler& handler, SpaceShipWrapper* ship, std::vector<StageTolerance> stages,
+               std::vector<EngineTolerance> engines, MonteCarloOptions options = MonteCarloOptions());
+
+    /**
+     * @brief Draws and evaluates every sample.
+     * @param result Filled in with the statistics.
+     * @return 0 if successful, 1 if not.
+     */
+    int run(MonteCarloResult& result);
+
+    /**
+     * @brief Draws the values of one sample, as run does.
+     * @param sample Sample index.
+     * @param values Resized to 4 per stage (dry mass, fuel mass, engine mass, exhaust velocity) and filled in.
+     * @return 0 if successful, 1 if not.
+     */
+    int getSample(uint64_t sample, std::vector<double>& values);
+
+private:
+    /**
+     * @brief One uncertain value of a stage, with where its draws come from.
+     */
+    struct Variable {
+        double nominal;
+        DistributionKind kind;
+        double spread;
+        uint32_t stream;                        /**< Counter word that picks the value's draws. */
+    };
+
+    SpaceShipHandler& handler;
+    SpaceShipWrapper* ship;
+    std::vector<StageTolerance> stageTolerances;
+    std::vector<EngineTolerance> engineTolerances;
+    MonteCarloOptions options;
+    std::vector<Variable> variables;            /**< 4 per stage, like getSample's values. */
+    long double nominalDeltaV = 0;
+
+    /**
+     * @brief Checks the tolerances and reads the ship's nominal values.
+     * @return 0 if successful, 1 if not.
+     */
+    int prepare(const char* caller);
+
+    /**
+     * @brief Draws samples [begin, begin + count) in DeltaVBatch's stage-major layout.
+     * @param values 4 arrays of count * stageCount values: dry masses, fuel masses, engine masses, velocities.
+     */
+    void draw(uint64_t begin, size_t count, std::vector<double>* values) const;
+};
+
+
+#endif //IRA_MONTECARLO_H
@@ -0,0 +1,176 @@
+//
+// Created by user on 6/14/23.
+//
+
+#include "MpfrScratch.h"
+#include <vector>
+#include <utility>
+#include <mutex>
+#include <cstring>
+
+namespace {
+    struct Bucket {
+        mpfr_prec_t precision;
+        std::vector<mpfr_ptr> idle;
+    };
+
+    struct Pool {
+        std::vector<Bucket> buckets;                // Few precisions are in use at once, so a scan is fastest.
+        size_t created = 0;
+
+        ~Pool() {
+            release();
+        }
+
+        Bucket& bucket(mpfr_prec_t precision) {
+            for (auto &bucket : buckets) {
+                if (bucket.precision == precision) {
+                    return bucket;
+                }
+            }
+            buckets.push_back({precision, {}});
+            return buckets.back();
+        }
+
+        void release() {
+            for (auto &bucket : buckets) {
+                for (auto &value : bucket.idle) {
+                    mpfr_clear(value);
+                    delete value;
+                }
+                created -= bucket.idle.size();
+                bucket.idle.clear();
+            }
+        }
+    };
+
+    thread_local Pool pool;
+
+    // ===== GMP allocation recycling =====
+    const size_t maxIdleBlocks = 64;                // Per size, so a burst of frees can't hoard memory
+
+    void* (*heapAlloc)(size_t);
+    void* (*heapRealloc)(void*, size_t, size_t);
+    void (*heapFree)(void*, size_t);
+
+    struct FreeLists {
+        std::vector<std::pair<size_t, std::vector<void*>>> sizes;
+        size_t heapAllocations = 0;
+
+        ~FreeLists();
+
+        std::vector<void*>& blocks(size_t size) {
+            for (auto &entry : sizes) {
+                if (entry.first == size) {
+                    return entry.second;
+                }
+            }
+            sizes.push_back({size, {}});
+            return sizes.back().second;
+        }
+    };
+
+    enum FreeListsState : char { unused, alive, destroyed };
+    thread_local FreeListsState freeListsState = unused;    // Trivially destructible, readable during thread exit
+    thread_local FreeLists freeLists;
+
+    FreeLists::~FreeLists() {
+        freeListsState = destroyed;
+        for (auto &entry : sizes) {
+            for (auto &block : entry.second) {
+                heapFree(block, entry.first);
+            }
+        }
+    }
+
+    /**
+     * @brief Returns the calling thread's free lists, or nullptr once they have been destroyed at thread exit.
+     */
+    FreeLists* localFreeLists() {
+        if (freeListsState == destroyed) {
+            return nullptr;
+        }
+        freeListsState = alive;
+        return &freeLists;
+    }
+
+    void* recycledAlloc(size_t size) {
+        FreeLists* lists = localFreeLists();
+        if (lists == nullptr) {
+            return heapAlloc(size);
+        }
+        auto &blocks = lists->blocks(size);
+        if (blocks.empty()) {
+            lists->heapAllocations++;
+            return heapAlloc(size);
+        }
+        void* block = blocks.back();
+        blocks.pop_back();
+        return block;
+    }
+
+    void recycledFree(void* ptr, size_t size);
+
+    // MPFR grows some working buffers (mpfr_log's, for one) with realloc. Going through the free lists keeps both the
+    // old and the new size recycled; a plain realloc would drain one list into the other on every call.
+    void* recycledRealloc(void* ptr, size_t oldSize, size_t newSize) {
+        if (localFreeLists() == nullptr) {
+            return heapRealloc(ptr, oldSize, newSize);
+        }
+        void* block = recycledAlloc(newSize);
+        std::memcpy(block, ptr, oldSize < newSize ? oldSize : newSize);
+        recycledFree(ptr, oldSize);
+        return block;
+    }
+
+    void recycledFree(void* ptr, size_t size) {
+        FreeLists* lists = localFreeLists();
+        if (lists == nullptr) {
+            heapFree(ptr, size);
+            return;
+        }
+        auto &blocks = lists->blocks(size);
+        if (blocks.size() >= maxIdleBlocks) {
+            heapFree(ptr, size);
+            return;
+        }
+        blocks.push_back(ptr);
+    }
+}
+
+MpfrScratch::MpfrScratch(mpfr_prec_t precision) {
+    auto &idle = pool.bucket(precision).idle;
+    if (idle.empty()) {
+        value = new __mpfr_struct;
+        mpfr_init2(value, precision);
+        pool.created++;
+    } else {
+        value = idle.back();
+        idle.pop_back();
+    }
+}
+
+MpfrScratch::~MpfrScratch() {
+    pool.bucket(mpfr_get_prec(value)).idle.push_back(value);
+}
+
+size_t MpfrScratch::created() {
+    return pool.created;
+}
+
+void MpfrScratch::release() {
+    pool.release();
+}
+
+void MpfrScratch::recycleAllocations() {
+    static std::once_flag installed;
+    std::call_once(installed, []() {
+        mp_get_memory_functions(&heapAlloc, &heapRealloc, &heapFree);
+        mp_set_memory_functions(recycledAlloc, recycledRealloc, recycledFree);
+    });
+}
+
+size_t MpfrScratch::heapAllocations() {
+    FreeLists* lists = localFreeLists();
+    return lists != nullptr ? lists->heapAllocations : 0;
+}
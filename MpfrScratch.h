@@ -0,0 +1,68 @@
+//
+// Created by user on 6/14/23.
+//
+
+#include <mpfr.h>
+#include <cstddef>
+
+#ifndef IRA_MPFRSCRATCH_H
+#define IRA_MPFRSCRATCH_H
+
+/**
+ * @brief Borrows a temporary mpfr_t from the calling thread's scratch pool for the lifetime of the object.
+ * @details Values are kept per precision and handed back to the pool on destruction instead of being cleared, so hot
+ *          paths stop paying an mpfr_init2/mpfr_clear pair (a malloc and a free) per call once the pool is warm.
+ *          Each thread has its own pool, so borrowing takes no locks. The value's contents are unspecified when
+ *          borrowed.
+ */
+class MpfrScratch {
+public:
+    /**
+     * @brief Borrows a value.
+     * @param precision Precision of the value in bits.
+     */
+    explicit MpfrScratch(mpfr_prec_t precision);
+    ~MpfrScratch();
+
+    MpfrScratch(const MpfrScratch& other) = delete;
+    MpfrScratch& operator=(const MpfrScratch& other) = delete;
+
+    operator mpfr_ptr() const {
+        return value;
+    }
+
+    /**
+     * @brief Returns how many values the calling thread's pool has created, borrowed or not.
+     * @return Number of values.
+     */
+    static size_t created();
+
+    /**
+     * @brief Frees the values in the calling thread's pool that are not borrowed.
+     */
+    static void release();
+
+    /**
+     * @brief Routes GMP's (and so MPFR's) allocations through per-thread free lists.
+     * @details MPFR allocates working memory inside functions like mpfr_log and mpfr_set_ld on every call. With this
+     *          installed, blocks freed by those calls are kept by size and reused by the next call on the same
+     *          thread instead of going back to the heap. The previous GMP memory functions are used underneath.
+     * @note Opt-in. This replaces GMP's memory functions for the whole process, so nothing in IRA calls it; the
+     *       program does, once, at the start of main before any GMP or MPFR value exists and before other threads
+     *       start. Code that installs its own GMP memory functions has to do so before calling this, not after.
+     */
+    static void recycleAllocations();
+
+    /**
+     * @brief Returns how many blocks the calling thread has taken from the underlying GMP allocator since
+     *        recycleAllocations was installed. Blocks reused from the free lists are not counted.
+     * @return Number of heap allocations.
+     */
+    static size_t heapAllocations();
+
+private:
+    mpfr_ptr value;               /**< The borrowed value. */
+};
+
+
+#endif //IRA_MPFRSCRATCH_H
@@ -0,0 +1,359 @@
+//
+// Created by user on 6/18/23.
+//
+
+#include <cmath>
+#include <cfloat>
+#include <mpfr.h>
+#include "MpfrScratch.h"
+#ifdef IRA_FLOAT128
+#include <quadmath.h>
+#endif
+
+#ifndef IRA_NUMERICBACKEND_H
+#define IRA_NUMERICBACKEND_H
+
+// A numeric backend is a policy class the ship model (BasicEngine, BasicStage, BasicSpaceShip) is templated on. Every
+// backend provides:
+//     typedef ... value_type;          A value that can be kept in containers.
+//     typedef ... storage_type;        How engines and stages hold a value: value_type, or mpfr_t for MPFR.
+//     typedef ... const_reference;     Read-only argument that binds to either.
+//     class Scratch;                   Temporary for the length of a scope, constructed from the backend.
+//     void init(value&) / clear(value&)                     Lifetime of a value (no-ops for hardware floats).
+//     size_t customSize() / void initCustom(value&, void*)  Lifetime of a value whose significand is caller owned.
+//     static void move(to, from) / initCopy(to, from)       What the ship model's copy and move constructors use.
+//     void set(value&, long double) / setMpfr(value&, mpfr_srcptr)
+//     long double get(value)
+//     void copy / add / sub / mul / div / log1p(result, operands...)
+// Operations write to their first argument, MPFR style, and may alias it with an operand. Hardware float backends
+// are empty and fully inline, so code templated on them compiles to plain arithmetic.
+
+/**
+ * @brief Scratch value of a backend whose values need no lifetime management.
+ * @tparam T value_type of the backend.
+ */
+template <typename T>
+class ValueScratch {
+public:
+    template <typename Backend>
+    explicit ValueScratch(const Backend&) : value() {}
+
+    ValueScratch(const ValueScratch& other) = delete;
+    ValueScratch& operator=(const ValueScratch& other) = delete;
+
+    operator T&() const {
+        return value;
+    }
+
+private:
+    mutable T value;                            /**< Mutable like the value behind an MpfrScratch. */
+};
+
+/**
+ * @brief Backend for a hardware floating point type.
+ * @tparam T float, double or long double (or __float128 through Float128Backend).
+ */
+template <typename T>
+class FloatBackend {
+public:
+    typedef T value_type;
+    typedef T storage_type;
+    typedef const T& const_reference;
+    typedef ValueScratch<T> Scratch;
+
+    void init(T& value) const { value = 0; }
+    static void clear(T&) {}
+    size_t customSize() const { return 0; }
+    void initCustom(T& value, void*) const { value = 0; }
+    static void move(T& to, T& from) { to = from; }
+    static void initCopy(T& to, const T& from) { to = from; }
+    void set(T& result, const long double value) const { result = (T) value; }
+    void setMpfr(T& result, mpfr_srcptr value) const { result = (T) mpfr_get_ld(value, MPFR_RNDN); }
+    long double get(const T& value) const { return (long double) value; }
+
+    static void copy(T& result, const T& a) { result = a; }
+    void add(T& result, const T& a, const T& b) const { result = a + b; }
+    void sub(T& result, const T& a, const T& b) const { result = a - b; }
+    void mul(T& result, const T& a, const T& b) const { result = a * b; }
+    void div(T& result, const T& a, const T& b) const { result = a / b; }
+    void log1p(T& result, const T& a) const { result = std::log1p(a); }
+};
+
+typedef FloatBackend<double> DoubleBackend;
+typedef FloatBackend<long double> LongDoubleBackend;
+
+#ifdef IRA_FLOAT128
+typedef FloatBackend<__float128> Float128Backend;
+
+template <>
+inline void Float128Backend::setMpfr(__float128& result, mpfr_srcptr value) const {
+    const long double high = mpfr_get_ld(value, MPFR_RNDN);                 // long double holds 64 of the 113 bits,
+    MpfrScratch low(mpfr_get_prec(value));                                  // the rest comes from the remainder.
+    mpfr_set_ld(low, high, MPFR_RNDN);
+    mpfr_sub(low, value, low, MPFR_RNDN);
+    result = (__float128) high + (__float128) mpfr_get_ld(low, MPFR_RNDN);
+}
+
+template <>
+inline void Float128Backend::log1p(__float128& result, const __float128& a) const {
+    result = log1pq(a);
+}
+#endif
+
+/**
+ * @brief Unevaluated sum of two doubles, giving about 106 bits of precision.
+ */
+struct DoubleDouble {
+    double hi,                                  /**< Leading part. */
+    lo;                                         /**< Trailing part, |lo| <= ulp(hi) / 2. */
+};
+
+/**
+ * @brief Double-double backend: twice the precision of double at a fraction of the cost of MPFR, with no allocation.
+ * @details Arithmetic follows the usual error-free transformations (Dekker, Knuth). log1p starts from the double
+ *          result and takes one Newton step against a double-double expm1, which doubles the correct bits.
+ */
+class DoubleDoubleBackend {
+public:
+    typedef DoubleDouble value_type;
+    typedef DoubleDouble storage_type;
+    typedef const DoubleDouble& const_reference;
+    typedef ValueScratch<DoubleDouble> Scratch;
+
+    void init(DoubleDouble& value) const { value = {0, 0}; }
+    static void clear(DoubleDouble&) {}
+    size_t customSize() const { return 0; }
+    void initCustom(DoubleDouble& value, void*) const { value = {0, 0}; }
+    static void move(DoubleDouble& to, DoubleDouble& from) { to = from; }
+    static void initCopy(DoubleDouble& to, const DoubleDouble& from) { to = from; }
+    void set(DoubleDouble& result, const long double value) const {
+        result.hi = (double) value;
+        result.lo = (double) (value - result.hi);
+    }
+    void setMpfr(DoubleDouble& result, mpfr_srcptr value) const {
+        result.hi = mpfr_get_d(value, MPFR_RNDN);
+        MpfrScratch low(mpfr_get_prec(value));
+        mpfr_sub_d(low, value, result.hi, MPFR_RNDN);
+        result.lo = mpfr_get_d(low, MPFR_RNDN);
+    }
+    long double get(const DoubleDouble& value) const { return (long double) value.hi + value.lo; }
+
+    static void copy(DoubleDouble& result, const DoubleDouble& a) { result = a; }
+    void add(DoubleDouble& result, const DoubleDouble& a, const DoubleDouble& b) const { result = sum(a, b); }
+    void sub(DoubleDouble& result, const DoubleDouble& a, const DoubleDouble& b) const {
+        result = sum(a, negate(b));
+    }
+    void mul(DoubleDouble& result, const DoubleDouble& a, const DoubleDouble& b) const { result = product(a, b); }
+    void div(DoubleDouble& result, const DoubleDouble& a, const DoubleDouble& b) const { result = quotient(a, b); }
+
+    void log1p(DoubleDouble& result, const DoubleDouble& a) const {
+        const double start = std::log1p(a.hi);
+        if (a.hi == 0 || !std::isfinite(start)) {
+            result = {start, 0};
+            return;
+        }
+        DoubleDouble y = {start, 0};                                        // y -= (expm1(y) - a) / (expm1(y) + 1)
+        const DoubleDouble e = expm1(y);
+        if (!std::isfinite(e.hi)) {
+            result = y;
+            return;
+        }
+        const DoubleDouble step = quotient(sum(e, negate(a)), sum(e, {1, 0}));
+        result = sum(y, negate(step));
+    }
+
+private:
+    static DoubleDouble twoSum(const double a, const double b) {
+        const double s = a + b;
+        const double bb = s - a;
+        return {s, (a - (s - bb)) + (b - bb)};
+    }
+    static DoubleDouble quickTwoSum(const double a, const double b) {       // |a| >= |b|
+        const double s = a + b;
+        return {s, b - (s - a)};
+    }
+    static DoubleDouble twoProduct(const double a, const double b) {
+        const double p = a * b;
+        return {p, std::fma(a, b, -p)};
+    }
+
+    static DoubleDouble sum(const DoubleDouble& a, const DoubleDouble& b) {
+        DoubleDouble s = twoSum(a.hi, b.hi);
+        const DoubleDouble t = twoSum(a.lo, b.lo);
+        s.lo += t.hi;
+        s = quickTwoSum(s.hi, s.lo);
+        s.lo += t.lo;
+        return quickTwoSum(s.hi, s.lo);
+    }
+    static DoubleDouble product(const DoubleDouble& a, const DoubleDouble& b) {
+        DoubleDouble p = twoProduct(a.hi, b.hi);
+        p.lo += a.hi * b.lo + a.lo * b.hi;
+        return quickTwoSum(p.hi, p.lo);
+    }
+    static DoubleDouble quotient(const DoubleDouble& a, const DoubleDouble& b) {
+        const double q1 = a.hi / b.hi;                                      // Long division, a double at a time
+        DoubleDouble r = sum(a, negate(product(b, {q1, 0})));
+        const double q2 = r.hi / b.hi;
+        r = sum(r, negate(product(b, {q2, 0})));
+        const double q3 = r.hi / b.hi;
+        return sum(quickTwoSum(q1, q2), {q3, 0});
+    }
+    static DoubleDouble negate(const DoubleDouble& a) {
+        return {-a.hi, -a.lo};
+    }
+
+    struct InverseFactorials {
+        static const int count = 12;
+        DoubleDouble terms[count];              /**< terms[k] = 1 / (k + 1)! */
+
+        InverseFactorials() {
+            double factorial = 1;               // Exact up to 22!
+            for (int k = 0; k < count; k++) {
+                factorial *= k + 1;
+                terms[k] = quotient({1, 0}, {factorial, 0});
+            }
+        }
+    };
+
+    /**
+     * @brief e^a - 1 without cancellation for small a.
+     * @details Halves a until it is below 2^-10, sums the Taylor series there and undoes the halving with
+     *          expm1(2t) = expm1(t) * (expm1(t) + 2). For |a| >= 0.5 it goes through exp instead.
+     */
+    static DoubleDouble expm1(const DoubleDouble& a) {
+        if (std::fabs(a.hi) >= 0.5) {
+            const DoubleDouble ln2 = {6.931471805599452862e-01, 2.319046813846299558e-17};
+            const double k = std::nearbyint(a.hi / ln2.hi);                 // e^a = 2^k * e^(a - k ln2)
+            DoubleDouble e = sum(expm1Small(sum(a, negate(product(ln2, {k, 0})))), {1, 0});
+            e = {std::ldexp(e.hi, (int) k), std::ldexp(e.lo, (int) k)};
+            return sum(e, {-1, 0});
+        }
+        return expm1Small(a);
+    }
+    static DoubleDouble expm1Small(DoubleDouble a) {
+        int halvings = 0;
+        while (std::fabs(a.hi) > 9.765625e-4) {                            // 2^-10
+            a = {a.hi / 2, a.lo / 2};
+            halvings++;
+        }
+        static const InverseFactorials inverse;
+        DoubleDouble e = inverse.terms[InverseFactorials::count - 1];      // a + a^2/2! + ... + a^12/12!
+        for (int k = InverseFactorials::count - 2; k >= 0; k--) {
+            e = sum(inverse.terms[k], product(a, e));
+        }
+        e = product(a, e);
+        for (; halvings > 0; halvings--) {
+            e = product(e, sum(e, {2, 0}));
+        }
+        return e;
+    }
+};
+
+/**
+ * @brief Backend for MPFR values of a fixed precision.
+ * @details value_type is the struct behind mpfr_t, so values can be kept in containers, and storage_type is mpfr_t
+ *          itself, so the engines and stages of a SpaceShip keep their mpfr_t members. Operations take either, or
+ *          anything that converts to mpfr_srcptr. Copying the struct aliases the significand; init and clear still
+ *          have to be paired exactly once per value.
+ */
+class MpfrBackend {
+public:
+    typedef __mpfr_struct value_type;
+    typedef mpfr_t storage_type;
+    typedef mpfr_srcptr const_reference;
+
+    /**
+     * @brief Borrows a value of the backend's precision from the calling thread's MpfrScratch pool.
+     */
+    class Scratch : public MpfrScratch {
+    public:
+        explicit Scratch(const MpfrBackend& backend) : MpfrScratch(backend.getPrecision()) {}
+    };
+
+    explicit MpfrBackend(mpfr_prec_t precision = mpfr_get_default_prec()) : precision(precision) {}
+
+    template <typename V>
+    void init(V& value) const {
+        mpfr_init2(ptr(value), precision);
+        mpfr_set_zero(ptr(value), 0);
+    }
+    /**
+     * @brief Clears a value, unless it was moved from.
+     */
+    template <typename V>
+    static void clear(V& value) {
+        if (ptr(value)->_mpfr_d != nullptr) {
+            mpfr_clear(ptr(value));
+        }
+    }
+    size_t customSize() const { return mpfr_custom_get_size(precision); }
+    template <typename V>
+    void initCustom(V& value, void* significand) const {
+        mpfr_custom_init(significand, precision);
+        mpfr_custom_init_set(ptr(value), MPFR_ZERO_KIND, 0, precision, significand);
+    }
+    /**
+     * @brief Takes over from's significand and leaves from empty, so clearing it is a no-op.
+     */
+    template <typename V>
+    static void move(V& to, V& from) {
+        *ptr(to) = *ptr(from);
+        ptr(from)->_mpfr_d = nullptr;
+    }
+    template <typename V, typename A>
+    static void initCopy(V& to, const A& from) {
+        mpfr_init2(ptr(to), mpfr_get_prec(ptr(from)));
+        mpfr_set(ptr(to), ptr(from), MPFR_RNDN);
+    }
+
+    template <typename R>
+    void set(R& result, const long double value) const { mpfr_set_ld(ptr(result), value, MPFR_RNDN); }
+    template <typename R>
+    void setMpfr(R& result, mpfr_srcptr value) const { mpfr_set(ptr(result), value, MPFR_RNDN); }
+    template <typename A>
+    long double get(const A& value) const { return mpfr_get_ld(ptr(value), MPFR_RNDN); }
+
+    template <typename R, typename A>
+    static void copy(R& result, const A& a) { mpfr_set(ptr(result), ptr(a), MPFR_RNDN); }
+    template <typename R, typename A, typename B>
+    void add(R& result, const A& a, const B& b) const { mpfr_add(ptr(result), ptr(a), ptr(b), MPFR_RNDN); }
+    template <typename R, typename A, typename B>
+    void sub(R& result, const A& a, const B& b) const { mpfr_sub(ptr(result), ptr(a), ptr(b), MPFR_RNDN); }
+    template <typename R, typename A, typename B>
+    void mul(R& result, const A& a, const B& b) const { mpfr_mul(ptr(result), ptr(a), ptr(b), MPFR_RNDN); }
+    template <typename R, typename A, typename B>
+    void div(R& result, const A& a, const B& b) const { mpfr_div(ptr(result), ptr(a), ptr(b), MPFR_RNDN); }
+    template <typename R, typename A>
+    void log1p(R& result, const A& a) const { mpfr_log1p(ptr(result), ptr(a), MPFR_RNDN); }
+
+    mpfr_prec_t getPrecision() const { return precision; }
+
+private:
+    mpfr_prec_t precision;                      /**< Precision of every value this backend initializes. */
+
+    static mpfr_ptr ptr(mpfr_ptr value) { return value; }                  // mpfr_t and MpfrScratch
+    static mpfr_srcptr ptr(mpfr_srcptr value) { return value; }
+    static mpfr_ptr ptr(value_type& value) { return &value; }
+    static mpfr_srcptr ptr(const value_type& value) { return &value; }
+};
+
+/**
+ * @brief Delta-V of a single stage: dv = ve * ln((rest + fuel) / rest) = ve * log1p(fuel / rest).
+ * @details Shared by every backend, including SpaceShip's MPFR evaluation. Operands can be any value the backend
+ *          takes, so stage members, containers and scratch values mix freely.
+ * @param backend Numeric backend.
+ * @param result Delta-V of the stage. May alias an operand.
+ * @param fuel Fuel mass of the stage.
+ * @param rest Mass left after the stage burns: its dry and engine mass plus every stage after it.
+ * @param exhaustVelocity Exhaust velocity of the stage's engine.
+ */
+template <typename Backend, typename Result, typename Fuel, typename Rest, typename Velocity>
+inline void rocketDeltaV(const Backend& backend, Result& result, const Fuel& fuel, const Rest& rest,
+                         const Velocity& exhaustVelocity) {
+    backend.div(result, fuel, rest);
+    backend.log1p(result, result);
+    backend.mul(result, result, exhaustVelocity);
+}
+
+
+#endif //IRA_NUMERICBACKEND_H
@@ -0,0 +1,109 @@
+//
+// Created by user on 6/28/23.
+//
+
+#include "QuantileSketch.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+QuantileSketch::QuantileSketch(double relativeAccuracy, size_t maxBuckets)
+        : relativeAccuracy(relativeAccuracy), maxBuckets(std::max<size_t>(maxBuckets, 1)) {
+    if (!(relativeAccuracy > 0 && relativeAccuracy < 1)) {
+        throw std::out_of_range("Relative accuracy has to be in (0, 1)");
+    }
+    logGamma = std::log1p(2 * relativeAccuracy / (1 - relativeAccuracy));
+}
+
+int64_t QuantileSketch::bucketOf(double value) const {
+    return (int64_t) std::ceil(std::log(value) / logGamma);
+}
+
+void QuantileSketch::reserve(int64_t low, int64_t high) {
+    int64_t newLow = low, newHigh = high;
+    if (!buckets.empty()) {
+        newLow = std::min(newLow, offset);
+        newHigh = std::max(newHigh, offset + (int64_t) buckets.size() - 1);
+    }
+    if (newHigh - newLow + 1 > (int64_t) maxBuckets) {                      // Fold the lowest buckets
+        newLow = newHigh - (int64_t) maxBuckets + 1;
+    }
+    if (!buckets.empty() && newLow == offset && newHigh == offset + (int64_t) buckets.size() - 1) {
+        return;
+    }
+
+    std::vector<uint64_t> resized((size_t) (newHigh - newLow + 1), 0);
+    for (size_t k = 0; k < buckets.size(); k++) {
+        resized[(size_t) (std::max(offset + (int64_t) k, newLow) - newLow)] += buckets[k];
+    }
+    buckets.swap(resized);
+    offset = newLow;
+}
+
+void QuantileSketch::add(double value) {
+    count++;
+    if (!(value > 0)) {
+        zeroCount++;
+        return;
+    }
+    const int64_t bucket = bucketOf(value);
+    if (buckets.empty() || bucket > offset + (int64_t) buckets.size() - 1
+        || (bucket < offset && buckets.size() < maxBuckets)) {
+        reserve(bucket, bucket);
+    }
+    buckets[(size_t) (std::max(bucket, offset) - offset)]++;                // Below a folded range: lowest bucket
+}
+
+int QuantileSketch::merge(const QuantileSketch& other) {
+    if (other.relativeAccuracy != relativeAccuracy) {
+        return 1;
+    }
+    if (!other.buckets.empty()) {
+        reserve(other.offset, other.offset + (int64_t) other.buckets.size() - 1);
+        for (size_t k = 0; k < other.buckets.size(); k++) {
+            buckets[(size_t) (std::max(other.offset + (int64_t) k, offset) - offset)] += other.buckets[k];
+        }
+    }
+    zeroCount += other.zeroCount;
+    count += other.count;
+    return 0;
+}
+
+double QuantileSketch::getQuantile(double quantile) const {
+    if (count == 0) {
+        return NAN;
+    }
+    const double rank = std::min(std::max(quantile, 0.0), 1.0) * (double) (count - 1);
+    uint64_t below = zeroCount;
+    if ((double) below > rank) {
+        return 0;
+    }
+    size_t k = 0;
+    for (; k + 1 < buckets.size(); k++) {
+        below += buckets[k];
+        if ((double) below > rank) {
+            break;
+        }
+    }
+    // Middle of bucket (gamma^(i-1), gamma^i] in relative terms: 2 * gamma^i / (gamma + 1).
+    return std::exp((double) (offset + (int64_t) k) * logGamma) * (1 - relativeAccuracy);
+}
+
+uint64_t QuantileSketch::getCount() const {
+    return count;
+}
+
+double QuantileSketch::getRelativeAccuracy() const {
+    return relativeAccuracy;
+}
+
+size_t QuantileSketch::getBucketCount() const {
+    return buckets.size();
+}
+
+void QuantileSketch::clear() {
+    buckets.clear();
+    offset = 0;
+    zeroCount = 0;
+    count = 0;
+}
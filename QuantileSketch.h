@@ -0,0 +1,97 @@
+//
+// Created by user on 6/28/23.
+//
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#ifndef IRA_QUANTILESKETCH_H
+#define IRA_QUANTILESKETCH_H
+
+/**
+ * @brief Streaming quantiles of non-negative values with a relative error bound, in memory that doesn't grow with
+ *        the number of values.
+ * @details Values are counted in logarithmic buckets, bucket i holding (gamma^(i-1), gamma^i] with
+ *          gamma = (1 + relativeAccuracy) / (1 - relativeAccuracy), as in DDSketch. Every quantile is then within
+ *          relativeAccuracy of a value of the right rank. The buckets span the range of the values, not their count:
+ *          delta-Vs from 1 m/s to 100 km/s at 0.1% take about 5800 buckets. If maxBuckets would be exceeded, the
+ *          lowest buckets are folded into one, which only costs accuracy at the low end.
+ *
+ *          Sketches with the same relativeAccuracy merge exactly, in any order, so threads can keep their own.
+ *          Values of 0 or less are counted as 0.
+ */
+class QuantileSketch {
+public:
+    /**
+     * @brief Creates an empty sketch.
+     * @param relativeAccuracy Relative error bound of the quantiles, in (0, 1).
+     * @param maxBuckets Most buckets kept before the lowest ones are folded together.
+     */
+    explicit QuantileSketch(double relativeAccuracy = 1e-3, size_t maxBuckets = 16384);
+
+    /**
+     * @brief Counts a value.
+     * @param value Value to count.
+     */
+    void add(double value);
+
+    /**
+     * @brief Adds every value counted by another sketch.
+     * @param other Sketch with the same relative accuracy.
+     * @return 0 if successful, 1 if the accuracies differ.
+     */
+    int merge(const QuantileSketch& other);
+
+    /**
+     * @brief Estimates a quantile.
+     * @param quantile Quantile in [0, 1]; 0.5 is the median.
+     * @return Value at that quantile, within the relative accuracy; NaN if the sketch is empty.
+     */
+    double getQuantile(double quantile) const;
+
+    /**
+     * @brief Returns the number of values counted.
+     * @return Count.
+     */
+    uint64_t getCount() const;
+
+    /**
+     * @brief Returns the relative error bound of the quantiles.
+     * @return Relative accuracy.
+     */
+    double getRelativeAccuracy() const;
+
+    /**
+     * @brief Returns the number of buckets in use, which is what the sketch's memory grows with.
+     * @return Number of buckets.
+     */
+    size_t getBucketCount() const;
+
+    /**
+     * @brief Forgets every value.
+     */
+    void clear();
+
+private:
+    double relativeAccuracy;
+    double logGamma;                            /**< log(gamma), the width of a bucket in log space. */
+    size_t maxBuckets;
+    std::vector<uint64_t> buckets;              /**< [k] counts bucket offset + k. */
+    int64_t offset = 0;
+    uint64_t zeroCount = 0;
+    uint64_t count = 0;
+
+    /**
+     * @brief Bucket of a positive value.
+     */
+    int64_t bucketOf(double value) const;
+
+    /**
+     * @brief Makes room for buckets [low, high], folding the lowest buckets if that would exceed maxBuckets.
+     */
+    void reserve(int64_t low, int64_t high);
+};
+
+
+#endif //IRA_QUANTILESKETCH_H
@@ -0,0 +1,155 @@
+//
+// Created by user on 6/26/23.
+//
+
+#include "RefuelAnalysis.h"
+#include "MpfrScratch.h"
+#include "NumericBackend.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+    const size_t scenariosPerTask = 64;
+}
+
+RefuelAnalysis::RefuelAnalysis(SpaceShipWrapper* ship) : ship(ship), stagesEvaluated(0) {
+    if (ship == nullptr) {
+        throw std::runtime_error("Null pointer exception");
+    }
+}
+
+RefuelAnalysis::~RefuelAnalysis() {
+    for (auto &sum : prefixDeltaVs) {
+        mpfr_clear(&sum);
+    }
+    for (auto &sum : suffixDeltaVs) {
+        mpfr_clear(&sum);
+    }
+}
+
+const std::vector<Stage*>& RefuelAnalysis::refresh() {
+    const std::vector<Stage*>& stages = *ship->getStages();                // Generates every stale stage once
+    if (sumsValid && ship->getRevision() == sumsRevision) {
+        return stages;
+    }
+    const mpfr_prec_t precision = ship->getPrecision();
+    while (prefixDeltaVs.size() < stages.size() + 1) {
+        prefixDeltaVs.emplace_back();
+        mpfr_init2(&prefixDeltaVs.back(), precision);
+        suffixDeltaVs.emplace_back();
+        mpfr_init2(&suffixDeltaVs.back(), precision);
+    }
+
+    mpfr_set_zero(&prefixDeltaVs[0], 0);
+    for (size_t i = 0; i < stages.size(); i++) {
+        mpfr_add(&prefixDeltaVs[i + 1], &prefixDeltaVs[i], stages[i]->deltaV, MPFR_RNDN);
+    }
+    mpfr_set_zero(&suffixDeltaVs[stages.size()], 0);
+    for (size_t i = stages.size(); i-- > 0;) {
+        mpfr_add(&suffixDeltaVs[i], &suffixDeltaVs[i + 1], stages[i]->deltaV, MPFR_RNDN);
+    }
+    sumsRevision = ship->getRevision();
+    sumsValid = true;
+    return stages;
+}
+
+size_t RefuelAnalysis::evaluateScenario(const std::vector<Stage*>& stages, const RefuelScenario& scenario,
+                                        RefuelResult& result) const {
+    const auto &refuels = scenario.refuels;
+    result.deltaVBefore.assign(refuels.size(), 0);
+    result.deltaVAfter.assign(refuels.size(), 0);
+    if (refuels.empty()) {
+        result.deltaV = mpfr_get_ld(&suffixDeltaVs[0], MPFR_RNDN);
+        return 0;
+    }
+
+    size_t lowest = stages.size(), highest = 0;                             // Stages whose burn changes
+    for (auto &refuel : refuels) {
+        lowest = std::min(lowest, refuel.depot);
+        highest = std::max(highest, refuel.stage);
+    }
+
+    const mpfr_prec_t precision = ship->getPrecision();
+    const MpfrBackend backend(precision);
+    MpfrScratch running(precision), fuel(precision), rest(precision), stageDeltaV(precision), added(precision);
+    std::vector<__mpfr_struct> before(refuels.size());
+    for (auto &value : before) {
+        mpfr_init2(&value, precision);
+    }
+
+    mpfr_set(running, &prefixDeltaVs[lowest], MPFR_RNDN);
+    for (size_t i = lowest; i <= highest; i++) {
+        const Stage* stage = stages[i];
+        mpfr_set(fuel, stage->fuelMass, MPFR_RNDN);
+        mpfr_add(rest, stage->dryMass, stage->engine->mass, MPFR_RNDN);                // Same rest as SpaceShip
+        if (i + 1 < stages.size()) {
+            mpfr_add(rest, rest, stages[i + 1]->remainingMass, MPFR_RNDN);
+        }
+        for (size_t j = 0; j < refuels.size(); j++) {
+            const Refuel& refuel = refuels[j];
+            if (refuel.depot == i) {
+                mpfr_set(&before[j], running, MPFR_RNDN);
+            }
+            if (refuel.depot > i || refuel.stage < i) {                     // Not loaded yet, or already dropped
+                continue;
+            }
+            const mpfr_ptr target = refuel.stage == i ? (mpfr_ptr) fuel : (mpfr_ptr) rest;
+            mpfr_set_ld(added, refuel.fuelMass, MPFR_RNDN);
+            mpfr_add(target, target, added, MPFR_RNDN);
+        }
+        rocketDeltaV(backend, stageDeltaV, fuel, rest, stage->engine->exhaustVelocity);
+        mpfr_add(running, running, stageDeltaV, MPFR_RNDN);
+    }
+    mpfr_add(running, running, &suffixDeltaVs[highest + 1], MPFR_RNDN);
+
+    result.deltaV = mpfr_get_ld(running, MPFR_RNDN);
+    for (size_t j = 0; j < refuels.size(); j++) {
+        result.deltaVBefore[j] = mpfr_get_ld(&before[j], MPFR_RNDN);
+        mpfr_sub(&before[j], running, &before[j], MPFR_RNDN);
+        result.deltaVAfter[j] = mpfr_get_ld(&before[j], MPFR_RNDN);
+        mpfr_clear(&before[j]);
+    }
+    return highest + 1 - lowest;
+}
+
+void RefuelAnalysis::evaluate(const std::vector<RefuelScenario>& scenarios, std::vector<RefuelResult>& results,
+                              WorkStealingPool* pool) {
+    const std::vector<Stage*>& stages = refresh();
+    for (auto &scenario : scenarios) {                                      // Check everything before any work
+        for (auto &refuel : scenario.refuels) {
+            if (refuel.stage >= stages.size() || refuel.depot > refuel.stage) {
+                throw std::out_of_range("Refuel of a missing or already burned stage");
+            }
+        }
+    }
+    results.resize(scenarios.size());
+
+    auto task = [&](size_t begin, size_t end) {
+        size_t evaluated = 0;
+        for (size_t i = begin; i < end; i++) {
+            evaluated += evaluateScenario(stages, scenarios[i], results[i]);
+        }
+        stagesEvaluated += evaluated;
+    };
+    if (pool == nullptr || scenarios.size() <= scenariosPerTask) {
+        task(0, scenarios.size());
+        return;
+    }
+    std::vector<size_t> order((scenarios.size() + scenariosPerTask - 1) / scenariosPerTask);
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    pool->run(order, [&](size_t chunk) {
+        task(chunk * scenariosPerTask, std::min(scenarios.size(), (chunk + 1) * scenariosPerTask));
+    });
+}
+
+RefuelResult RefuelAnalysis::evaluate(const RefuelScenario& scenario) {
+    std::vector<RefuelResult> results;
+    evaluate({scenario}, results);
+    return results[0];
+}
+
+size_t RefuelAnalysis::getStagesEvaluated() const {
+    return stagesEvaluated;
+}
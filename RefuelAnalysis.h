@@ -0,0 +1,108 @@
+//
+// Created by user on 6/26/23.
+//
+
+#include <vector>
+#include <atomic>
+#include <mpfr.h>
+#include "SpaceShipWrapper.h"
+#include "WorkStealingPool.h"
+
+#ifndef IRA_REFUELANALYSIS_H
+#define IRA_REFUELANALYSIS_H
+
+/**
+ * @brief Fuel added to one stage at a depot.
+ */
+struct Refuel {
+    size_t depot;                   /**< Stages burned before the depot; the refuel happens before stage depot burns. */
+    size_t stage;                   /**< Stage topped up. It has to be unburned, so at least depot. */
+    long double fuelMass;           /**< Fuel added to the stage. */
+};
+
+/**
+ * @brief One mission plan: every refuel, at one depot or several.
+ */
+struct RefuelScenario {
+    std::vector<Refuel> refuels;
+};
+
+/**
+ * @brief Delta-V of a ship flying a RefuelScenario.
+ */
+struct RefuelResult {
+    long double deltaV = 0;                     /**< Total delta-V with every refuel. */
+    std::vector<long double> deltaVBefore,      /**< For each refuel, delta-V of the stages burned before its depot. */
+    deltaVAfter;                                /**< For each refuel, delta-V of the stages burned after its depot. */
+};
+
+/**
+ * @brief Evaluates refueling scenarios against one ship, which is launched with its own fuel masses.
+ * @details Fuel added at a depot before stage k is carried by stages [k, stage) as extra mass and burned by the
+ *          topped up stage. Stages below the lowest depot and above the highest topped up stage burn exactly as on the
+ *          ship, so their delta-V is taken from the ship's cached stages through prefix and suffix sums, and only the
+ *          stages in between are evaluated, starting from the cached remaining masses. A scenario that refuels near
+ *          the top of a long ship costs a handful of stages, not a rebuild and a full genDeltaV.
+ *
+ *          Every value is computed in MPFR at the ship's precision. Sums are grouped differently than the ship's own,
+ *          so a scenario with no fuel added can differ from the ship's delta-V in the last bits.
+ * @note Tank capacity is not modelled. The ship and its engines must not be edited during evaluate.
+ */
+class RefuelAnalysis {
+public:
+    /**
+     * @brief Sets up an analysis of a ship.
+     * @param ship Ship launched with its current fuel masses. Must outlive the analysis.
+     */
+    explicit RefuelAnalysis(SpaceShipWrapper* ship);
+    ~RefuelAnalysis();
+
+    RefuelAnalysis(const RefuelAnalysis& other) = delete;
+    RefuelAnalysis& operator=(const RefuelAnalysis& other) = delete;
+
+    /**
+     * @brief Evaluates many scenarios in one pass over the ship.
+     * @param scenarios Scenarios to evaluate.
+     * @param results Resized to one result per scenario and filled in.
+     * @param pool Threads to split the scenarios over, or nullptr to evaluate on the calling thread.
+     */
+    void evaluate(const std::vector<RefuelScenario>& scenarios, std::vector<RefuelResult>& results,
+                  WorkStealingPool* pool = nullptr);
+
+    /**
+     * @brief Evaluates one scenario.
+     * @param scenario Scenario to evaluate.
+     * @return Delta-V of the scenario.
+     */
+    RefuelResult evaluate(const RefuelScenario& scenario);
+
+    /**
+     * @brief Returns how many stages evaluate has recomputed since construction, across every scenario.
+     * @return Number of stages evaluated.
+     */
+    size_t getStagesEvaluated() const;
+
+private:
+    SpaceShipWrapper* ship;
+    std::vector<__mpfr_struct> prefixDeltaVs;   /**< [i] is the delta-V of stages [0, i) as launched. */
+    std::vector<__mpfr_struct> suffixDeltaVs;   /**< [i] is the delta-V of stages [i, stageCount) as launched. */
+    size_t sumsRevision = 0;                    /**< Ship revision the sums were taken at. */
+    bool sumsValid = false;
+    std::atomic<size_t> stagesEvaluated;
+
+    /**
+     * @brief Brings the ship up to date, and the prefix and suffix sums if the ship changed since they were taken.
+     * @return The ship's stages.
+     */
+    const std::vector<Stage*>& refresh();
+
+    /**
+     * @brief Evaluates one scenario against up to date sums.
+     * @return Number of stages evaluated.
+     */
+    size_t evaluateScenario(const std::vector<Stage*>& stages, const RefuelScenario& scenario,
+                            RefuelResult& result) const;
+};
+
+
+#endif //IRA_REFUELANALYSIS_H
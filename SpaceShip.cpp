@@ -1,69 +1,739 @@
 #include "SpaceShip.h"
 #include "Stage.h"
+#include "MpfrScratch.h"
+#include "NumericBackend.h"
+#include "StagingPath.h"
 #include "cstdio"
+#include "iostream"
+#include <cmath>
+#include <cfloat>
+#include <atomic>
+#include <algorithm>
 #include <mpfr.h>
 
 
 /**
- * @brief Generates the delta-V for the spaceship or a specific stage.
- * @param inpStage Pointer to the input stage (optional).
+ * @brief Generates the delta-V for the stages that are out of date.
  *
- * If inpStage is specified, it calculates the delta-V only for stages before the new stage.
- * Otherwise, it calculates the delta-V for all stages.
+ * Stage k only depends on stages k and up, so a change to stage k only has to recalculate stages [0, k].
  */
 
-SpaceShip::SpaceShip() {
-    mpfr_init(mass);
-    mpfr_init(deltaV);
-    mpfr_set_zero(mass, 0);
-    mpfr_set_zero(deltaV, 0);
+template <typename Backend>
+BasicSpaceShip<Backend>::BasicSpaceShip(const Backend& backend) : backend(backend), arena(backend) {
+    backend.init(mass);
+    backend.init(deltaV);
 }
 
+template <typename Backend>
+BasicSpaceShip<Backend>::~BasicSpaceShip() {
+    Backend::clear(mass);
+    Backend::clear(deltaV);
+    for (auto &sum : blockSums) {
+        Backend::clear(sum);
+    }
+    // stages are destroyed and freed with the arena.
+}
+
+SpaceShip::SpaceShip() : SpaceShip(mpfr_get_default_prec()) {}
+
+SpaceShip::SpaceShip(mpfr_prec_t precision, EngineUsers* engineUsers)
+        : BasicSpaceShip(MpfrBackend(precision)), precision(precision), engineUsers(engineUsers) {}
+
 SpaceShip::~SpaceShip() {
-    mpfr_clear(mass);
-    mpfr_clear(deltaV);
-    for (auto & stage : stages) {
-        delete(stage);
+    if (engineUsers != nullptr) {
+        engineUsers->detachShip(this, stages);
     }
 }
 
-void SpaceShip::genDeltaV () {       // for addStage, this should implement only calcs on stages before new
+template <typename Backend>
+void BasicSpaceShip<Backend>::genDeltaV () {
+    if (dirtyStages == 0) {
+        return;
+    }
+
+    genRemainingMass();
+    forEachBlock(dirtyStages, [&](size_t, size_t begin, size_t end) {                  // Stages are independent
+        typename Backend::Scratch rest(backend);                                        // once remainingMass is
+        for (size_t i = end; i-- > begin;) {                                            // known.
+            genStageDeltaV(i, rest);
+        }
+    });
+    sumDeltaV();
+}
 
-    mpfr_t denominator, remainingMass;
-    mpfr_init(denominator);
-    mpfr_init(remainingMass);
-    mpfr_set(remainingMass, mass, MPFR_RNDN);
-    mpfr_set_zero(deltaV, 0);                                                           // deltaV = 0
-    for (auto &stage: stages) {                                                         // for each stage:
-        mpfr_set(stage->deltaV, remainingMass, MPFR_RNDN);                                  // a = stage->remainingMass
-        mpfr_sub(denominator, remainingMass, stage->fuelMass, MPFR_RNDN);                   // b = a - stage->fuelMass
-        mpfr_div(stage->deltaV, stage->deltaV, denominator, MPFR_RNDN);                     // c = a / b
-        mpfr_log(stage->deltaV, stage->deltaV, MPFR_RNDN);                                  // d = ln(c)p
-        mpfr_mul(stage->deltaV, stage->deltaV, stage->engine->exhaustVelocity, MPFR_RNDN);  // stage->deltaV = d * exhaustVelocity
+void SpaceShip::genDeltaV () {
+    if (dirtyStages == 0) {
+        return;
+    }
 
-        mpfr_add(deltaV, deltaV, stage->deltaV, MPFR_RNDN);                                 // deltaV += stage->deltaV
-        mpfr_sub(remainingMass, remainingMass, stage->totalMass, MPFR_RNDN);                // remainingMass -= stage->totalMass
+    genRemainingMass();
+    if (mode == EvaluationMode::certified) {                                            // Precision is chosen for
+        if (escalateBounds(absoluteTolerance, 64, bounds, true)) {                      // the whole ship, so every
+            dirtyStages = 0;                                                            // stage is redone.
+            return;
+        }
+        dirtyStages = stages.size();                                                    // Not boundable (a negative
+    }                                                                                   // input), evaluate it exactly.
+    std::atomic<size_t> fallbacks(0);
+    forEachBlock(dirtyStages, [&](size_t, size_t begin, size_t end) {                  // Stages are independent
+        MpfrBackend::Scratch rest(backend);                                             // once remainingMass is
+        size_t blockFallbacks = 0;                                                      // known.
+        for (size_t i = end; i-- > begin;) {                                            // for each stale stage:
+            if (mode == EvaluationMode::fast && genStageDeltaVFast(i)) {
+                continue;
+            }
+            if (mode == EvaluationMode::fast) {
+                blockFallbacks++;
+            }
+            genStageDeltaV(i, rest);
+        }
+        fallbacks.fetch_add(blockFallbacks, std::memory_order_relaxed);
+    });
+    fallbackStages += fallbacks.load(std::memory_order_relaxed);
+    sumDeltaV();
+}
+
+template <typename Backend>
+void BasicSpaceShip<Backend>::sumDeltaV () {
+    const size_t blocks = (stages.size() + stageBlockSize - 1) / stageBlockSize;      // deltaV = sum(stage->deltaV)
+    while (blockSums.size() + 1 < blocks && stagePool != nullptr                        // Block 0 sums into deltaV,
+           && stages.size() >= parallelMinStages) {
+        blockSums.emplace_back();                                                       // the rest into blockSums.
+        backend.init(blockSums.back());
+    }
+    auto sumStages = [&](auto& sum, size_t begin, size_t end) {
+        backend.set(sum, 0);
+        for (size_t i = begin; i < end; i++) {
+            backend.add(sum, sum, stages[i]->deltaV);
+        }
+    };
+    const size_t sums = forEachBlock(stages.size(), [&](size_t block, size_t begin, size_t end) {
+        if (block == 0) {
+            sumStages(deltaV, begin, end);
+        } else {
+            sumStages(blockSums[block - 1], begin, end);
+        }
+    });
+    for (size_t block = 1; block < sums; block++) {
+        backend.add(deltaV, deltaV, blockSums[block - 1]);
+    }
+    dirtyStages = 0;
+}
+
+template <typename Backend>
+size_t BasicSpaceShip<Backend>::forEachBlock (size_t count, const std::function<void(size_t, size_t, size_t)>& body) {
+    if (stagePool == nullptr || count < parallelMinStages || count <= stageBlockSize) {
+        if (count != 0) {
+            body(0, 0, count);
+        }
+        return 1;
+    }
+    const size_t blocks = (count + stageBlockSize - 1) / stageBlockSize;
+    blockOrder.resize(blocks);
+    for (size_t block = 0; block < blocks; block++) {
+        blockOrder[block] = block;
     }
-    mpfr_clear(denominator);
-    mpfr_clear(remainingMass);
+    stagePool->run(blockOrder, [&](size_t block) {
+        const size_t begin = block * stageBlockSize;
+        body(block, begin, std::min(count, begin + stageBlockSize));
+    });
+    return blocks;
+}
+
+template <typename Backend>
+void BasicSpaceShip<Backend>::genStageDeltaV (size_t stageIdx, const typename Backend::Scratch& rest) {
+    stage_type* stage = stages[stageIdx];
+    backend.add(rest, stage->dryMass, stage->engine->mass);                            // rest = dry + engine
+    if (stageIdx + 1 < stages.size()) {                                                 //     + next remainingMass
+        backend.add(rest, rest, stages[stageIdx + 1]->remainingMass);
+    }
+    rocketDeltaV(backend, stage->deltaV, stage->fuelMass, rest, stage->engine->exhaustVelocity);
 }
 
 /**
-  * @brief Returns the vector of stages.
+ * @brief Converts to long double by truncating to the most significant limb, which is several times cheaper than
+ *        mpfr_get_ld. The result is within 2 units of long double roundoff.
+ * @param value MPFR value.
+ * @param result Converted value.
+ * @return false if the value is NaN, infinite, or out of the normal long double range.
+ */
+static bool toLongDouble (const mpfr_t value, long double& result) {
+    if (!mpfr_regular_p(value)) {
+        result = 0;
+        return mpfr_zero_p(value);
+    }
+    const mpfr_exp_t exponent = mpfr_get_exp(value);                                    // value in [2^(e-1), 2^e)
+    if (exponent > LDBL_MAX_EXP || exponent < LDBL_MIN_EXP) {
+        return false;
+    }
+    const mp_limb_t* significand = (const mp_limb_t*) mpfr_custom_get_significand(value);
+    const mp_limb_t top = significand[(mpfr_get_prec(value) - 1) / GMP_NUMB_BITS];
+    result = std::ldexp((long double) top, exponent - GMP_NUMB_BITS);
+    if (mpfr_sgn(value) < 0) {
+        result = -result;
+    }
+    return true;
+}
+
+bool SpaceShip::genStageDeltaVFast (size_t stageIdx) {
+    // Four conversions (2 units each), two additions of positive numbers and a division leave ratio within 7 units
+    // of roundoff. log1p scales that by its condition number ratio / ((1 + ratio) * log1p(ratio)), which is at most
+    // 1 for ratio >= 0. libm's long double log1p is documented within a few ulp, so 10 units cover it, the exhaust
+    // velocity conversion and the final product.
+    const long double unit = LDBL_EPSILON / 2;
+    if ((7 + 10) * unit > relativeTolerance) {
+        return false;
+    }
+
+    Stage* stage = stages[stageIdx];
+    long double fuel, dry, engineMass, next = 0, exhaustVelocity;
+    if (!toLongDouble(stage->fuelMass, fuel) || !toLongDouble(stage->dryMass, dry)
+        || !toLongDouble(stage->engine->mass, engineMass)
+        || !toLongDouble(stage->engine->exhaustVelocity, exhaustVelocity)
+        || (stageIdx + 1 < stages.size() && !toLongDouble(stages[stageIdx + 1]->remainingMass, next))) {
+        return false;
+    }
+    if (fuel < 0 || dry < 0 || engineMass < 0 || next < 0) {                            // The bound assumes no
+        return false;                                                                   // cancellation.
+    }
+
+    const long double rest = next + dry + engineMass;                                   // mass after the burn
+    const long double ratio = fuel / rest;
+    if (fuel != 0 && !std::isnormal(ratio)) {                                          // Includes rest == 0
+        return false;
+    }
+    long double result;
+    rocketDeltaV(LongDoubleBackend(), result, fuel, rest, exhaustVelocity);
+    if (!std::isfinite(result)) {
+        return false;
+    }
+
+    mpfr_set_ld(stage->deltaV, result, MPFR_RNDN);
+    return true;
+}
+
+bool SpaceShip::boundDeltaV (mpfr_prec_t workingPrecision, long double tolerance, DeltaVBounds& result,
+                             bool storeMidpoints) {
+    MpfrScratch nextLow(workingPrecision), nextHigh(workingPrecision),                  // remaining mass of the
+                restLow(workingPrecision), restHigh(workingPrecision),                  // next stage, and of this
+                fuelLow(workingPrecision), fuelHigh(workingPrecision),                  // stage after its burn
+                low(workingPrecision), high(workingPrecision),
+                input(workingPrecision),
+                totalLow(workingPrecision), totalHigh(workingPrecision);
+    mpfr_set_zero(nextLow, 0);
+    mpfr_set_zero(nextHigh, 0);
+    mpfr_set_zero(totalLow, 0);
+    mpfr_set_zero(totalHigh, 0);
+    result.precision = workingPrecision;
+    result.stageLower.resize(stages.size());
+    result.stageUpper.resize(stages.size());
+
+    for (size_t i = stages.size(); i-- > 0;) {                                          // top down:
+        Stage* stage = stages[i];
+        const mpfr_srcptr values[] = {stage->dryMass, stage->fuelMass, stage->engine->mass,
+                                      stage->engine->exhaustVelocity};
+        for (auto &value : values) {
+            if (mpfr_nan_p(value) || mpfr_sgn(value) < 0) {
+                return false;
+            }
+        }
+
+        // rest = dryMass + engine->mass + next
+        mpfr_set(restLow, stage->dryMass, MPFR_RNDD);
+        mpfr_add(restLow, restLow, nextLow, MPFR_RNDD);
+        mpfr_set(input, stage->engine->mass, MPFR_RNDD);
+        mpfr_add(restLow, restLow, input, MPFR_RNDD);
+        mpfr_set(restHigh, stage->dryMass, MPFR_RNDU);
+        mpfr_add(restHigh, restHigh, nextHigh, MPFR_RNDU);
+        mpfr_set(input, stage->engine->mass, MPFR_RNDU);
+        mpfr_add(restHigh, restHigh, input, MPFR_RNDU);
+        mpfr_set(fuelLow, stage->fuelMass, MPFR_RNDD);
+        mpfr_set(fuelHigh, stage->fuelMass, MPFR_RNDU);
+
+        // deltaV = exhaustVelocity * log1p(fuel / rest), increasing in fuel and decreasing in rest
+        mpfr_div(low, fuelLow, restHigh, MPFR_RNDD);
+        mpfr_log1p(low, low, MPFR_RNDD);
+        mpfr_set(input, stage->engine->exhaustVelocity, MPFR_RNDD);
+        mpfr_mul(low, low, input, MPFR_RNDD);
+        mpfr_div(high, fuelHigh, restLow, MPFR_RNDU);
+        mpfr_log1p(high, high, MPFR_RNDU);
+        mpfr_set(input, stage->engine->exhaustVelocity, MPFR_RNDU);
+        mpfr_mul(high, high, input, MPFR_RNDU);
+
+        mpfr_add(totalLow, totalLow, low, MPFR_RNDD);
+        mpfr_add(totalHigh, totalHigh, high, MPFR_RNDU);
+        result.stageLower[i] = mpfr_get_ld(low, MPFR_RNDD);
+        result.stageUpper[i] = mpfr_get_ld(high, MPFR_RNDU);
+        if (storeMidpoints) {
+            mpfr_add(stage->deltaV, low, high, MPFR_RNDN);
+            mpfr_div_2ui(stage->deltaV, stage->deltaV, 1, MPFR_RNDN);
+        }
+
+        mpfr_add(nextLow, restLow, fuelLow, MPFR_RNDD);                                     // next = rest + fuel
+        mpfr_add(nextHigh, restHigh, fuelHigh, MPFR_RNDU);
+    }
+
+    result.lower = mpfr_get_ld(totalLow, MPFR_RNDD);
+    result.upper = mpfr_get_ld(totalHigh, MPFR_RNDU);
+    mpfr_sub(low, totalHigh, totalLow, MPFR_RNDU);
+    result.converged = mpfr_cmp_ld(low, tolerance) <= 0;
+    if (storeMidpoints) {
+        mpfr_add(deltaV, totalLow, totalHigh, MPFR_RNDN);
+        mpfr_div_2ui(deltaV, deltaV, 1, MPFR_RNDN);
+    }
+    return true;
+}
+
+bool SpaceShip::escalateBounds (long double tolerance, mpfr_prec_t startPrecision, DeltaVBounds& result,
+                                bool storeMidpoints) {
+    const mpfr_prec_t maxPrecision = startPrecision > precision ? startPrecision : precision;
+    for (mpfr_prec_t workingPrecision = startPrecision; ; workingPrecision *= 2) {
+        if (workingPrecision > maxPrecision) {
+            workingPrecision = maxPrecision;
+        }
+        if (!boundDeltaV(workingPrecision, tolerance, result, storeMidpoints)) {
+            result.converged = false;
+            return false;
+        }
+        if (result.converged || workingPrecision == maxPrecision) {
+            return true;
+        }
+    }
+}
+
+DeltaVBounds SpaceShip::certifyDeltaV (long double tolerance, mpfr_prec_t startPrecision) {
+    DeltaVBounds result;
+    escalateBounds(tolerance, startPrecision, result, false);
+    return result;
+}
+
+const DeltaVBounds& SpaceShip::getDeltaVBounds () {
+    genDeltaV();
+    return bounds;
+}
+
+template <typename Backend>
+void BasicSpaceShip<Backend>::genRemainingMass () {
+    const size_t count = dirtyMasses;
+    const size_t blocks = forEachBlock(count, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = end; i-- > begin;) {                                                // top down:
+            stage_type* stage = stages[i];
+            if (i + 1 < end || (i + 1 == count && i + 1 < stages.size())) {                 // remainingMass = stage->totalMass
+                backend.add(stage->remainingMass, stages[i + 1]->remainingMass,             //     + stages[i + 1]->remainingMass
+                            stage->totalMass);
+            } else {                                                                        // Top of a block below the
+                backend.copy(stage->remainingMass, stage->totalMass);                      // top one: a local sum for
+            }                                                                               // now.
+        }
+    });
+    if (blocks > 1) {
+        for (size_t block = blocks - 1; block-- > 0;) {                                     // Carry each block's total
+            const size_t begin = block * stageBlockSize, next = begin + stageBlockSize;    // down into the first stage
+            backend.add(stages[begin]->remainingMass, stages[begin]->remainingMass,        // of the block below,
+                        stages[next]->remainingMass);
+        }
+        forEachBlock(count, [&](size_t, size_t begin, size_t end) {                        // then into the rest of it.
+            if (end == count) {
+                return;
+            }
+            for (size_t i = begin + 1; i < end; i++) {
+                backend.add(stages[i]->remainingMass, stages[i]->remainingMass, stages[end]->remainingMass);
+            }
+        });
+    }
+    dirtyMasses = 0;
+}
+
+template <typename Backend>
+void BasicSpaceShip<Backend>::markDirty (size_t stageIdx, bool massChanged) {
+    revision++;
+    if (stageIdx + 1 > dirtyStages) {
+        dirtyStages = stageIdx + 1;
+    }
+    if (massChanged && stageIdx + 1 > dirtyMasses) {
+        dirtyMasses = stageIdx + 1;
+    }
+}
+
+template <typename Backend>
+void BasicSpaceShip<Backend>::genTotalMass (stage_type* stage) {
+    // mass += (dryMass + fuelMass + engine->mass) - stage->totalMass
+    backend.sub(mass, mass, stage->totalMass);
+    backend.add(stage->totalMass, stage->dryMass, stage->fuelMass);
+    backend.add(stage->totalMass, stage->totalMass, stage->engine->mass);
+    backend.add(mass, mass, stage->totalMass);
+    markDirty(stage->index);
+}
+
+template <typename Backend>
+void BasicSpaceShip<Backend>::engineMassChanged (const std::vector<stage_type*>& users) {
+    for (auto &stage : users) {
+        genTotalMass(stage);
+    }
+}
+
+template <typename Backend>
+void BasicSpaceShip<Backend>::engineExhaustVelocityChanged (const std::vector<stage_type*>& users) {
+    for (auto &stage : users) {
+        markDirty(stage->index, false);
+    }
+}
+
+/**
+  * @brief Returns the vector of stages, with their delta-V up to date.
   * @return Vector of stages.
   */
 std::vector<Stage*>* SpaceShip::getStages () {
+    genDeltaV();
     return &stages;
 }
 
+mpfr_prec_t SpaceShip::getPrecision () const {
+    return precision;
+}
+
+void SpaceShip::setEvaluationMode (EvaluationMode newMode, long double relativeTolerance,
+                                   long double absoluteTolerance) {
+    mode = newMode;
+    this->relativeTolerance = relativeTolerance;
+    this->absoluteTolerance = absoluteTolerance;
+    if (!stages.empty()) {                                                              // Cached values were made
+        markDirty(stages.size() - 1, false);                                            // under the old mode.
+    }
+}
+
+template <typename Backend>
+const Backend& BasicSpaceShip<Backend>::getBackend () const {
+    return backend;
+}
+
+template <typename Backend>
+void BasicSpaceShip<Backend>::setStagePool (WorkStealingPool* pool, size_t minStages) {
+    stagePool = pool;
+    parallelMinStages = minStages;
+}
+
+size_t SpaceShip::getFallbackStages () const {
+    return fallbackStages;
+}
+
+template <typename Backend>
+size_t BasicSpaceShip<Backend>::getRevision () const {
+    return revision;
+}
+
+template <typename Backend>
+void BasicSpaceShip<Backend>::reserveStages (size_t count) {
+    arena.reserve(count);
+    stages.reserve(stages.size() + count);
+}
+
 void SpaceShip::getRemainingMass (mpfr_t result, const Stage* inputStage) {
-    mpfr_set(result, mass, MPFR_RNDN);
-    for (auto & stage : stages) {
-        if (stage == inputStage) {
-            return;
+    genRemainingMass();
+    mpfr_set(result, inputStage->remainingMass, MPFR_RNDN);
+}
+
+void SpaceShip::getDeltaVGradient (DeltaVGradient& gradient) {
+    genDeltaV();
+    const size_t stageCount = stages.size();
+    gradient.dryMass.resize(stageCount);
+    gradient.fuelMass.resize(stageCount);
+    gradient.engineMass.resize(stageCount);
+    gradient.exhaustVelocity.resize(stageCount);
+
+    MpfrScratch below(precision), rest(precision), perFuel(precision), perRest(precision), perVelocity(precision);
+    mpfr_set_zero(below, 0);                                                            // sum of d dv / d rest of
+    for (size_t i = 0; i < stageCount; i++) {                                           // the stages before i
+        const Stage* stage = stages[i];
+        mpfr_srcptr exhaustVelocity = stage->engine->exhaustVelocity;
+        mpfr_sub(rest, stage->remainingMass, stage->fuelMass, MPFR_RNDN);
+        mpfr_div(perFuel, exhaustVelocity, stage->remainingMass, MPFR_RNDN);           // ve / remaining
+        mpfr_div(perRest, stage->fuelMass, rest, MPFR_RNDN);
+        mpfr_mul(perRest, perRest, perFuel, MPFR_RNDN);
+        mpfr_neg(perRest, perRest, MPFR_RNDN);                                          // -ve * fuel / (rest * rem)
+        if (mode == EvaluationMode::exact && !mpfr_zero_p(exhaustVelocity)) {
+            mpfr_div(perVelocity, stage->deltaV, exhaustVelocity, MPFR_RNDN);
+        } else {                                                                        // Cached delta-V is only
+            mpfr_div(perVelocity, stage->fuelMass, rest, MPFR_RNDN);                    // as good as the mode's
+            mpfr_log1p(perVelocity, perVelocity, MPFR_RNDN);                            // tolerance.
         }
-        mpfr_sub(result, result, stage->totalMass, MPFR_RNDN);
+
+        mpfr_add(perFuel, perFuel, below, MPFR_RNDN);
+        gradient.fuelMass[i] = mpfr_get_ld(perFuel, MPFR_RNDN);
+        gradient.exhaustVelocity[i] = mpfr_get_ld(perVelocity, MPFR_RNDN);
+        mpfr_add(below, below, perRest, MPFR_RNDN);                                     // Now includes stage i
+        gradient.dryMass[i] = mpfr_get_ld(below, MPFR_RNDN);
+        gradient.engineMass[i] = gradient.dryMass[i];
     }
+    gradient.deltaV = mpfr_get_ld(deltaV, MPFR_RNDN);
+}
+
+long double SpaceShip::solveStageFuelMass (size_t stageIdx, long double deltaV) {
+    genRemainingMass();
+    const Stage* stage = stages[stageIdx];
+    MpfrScratch rest(precision), ratio(precision);
+    mpfr_sub(rest, stage->remainingMass, stage->fuelMass, MPFR_RNDN);
+    mpfr_set_ld(ratio, deltaV, MPFR_RNDN);
+    mpfr_div(ratio, ratio, stage->engine->exhaustVelocity, MPFR_RNDN);
+    mpfr_expm1(ratio, ratio, MPFR_RNDN);                                                // fuel / rest
+    mpfr_mul(ratio, ratio, rest, MPFR_RNDN);
+    return mpfr_get_ld(ratio, MPFR_RNDN);
+}
+
+long double SpaceShip::solveStageDryMass (size_t stageIdx, long double deltaV) {
+    genRemainingMass();
+    const Stage* stage = stages[stageIdx];
+    MpfrScratch rest(precision), above(precision);
+    mpfr_set_ld(rest, deltaV, MPFR_RNDN);
+    mpfr_div(rest, rest, stage->engine->exhaustVelocity, MPFR_RNDN);
+    mpfr_expm1(rest, rest, MPFR_RNDN);
+    mpfr_div(rest, stage->fuelMass, rest, MPFR_RNDN);                                   // rest = fuel / expm1(...)
+    mpfr_sub(above, stage->remainingMass, stage->totalMass, MPFR_RNDN);
+    mpfr_sub(rest, rest, above, MPFR_RNDN);
+    mpfr_sub(rest, rest, stage->engine->mass, MPFR_RNDN);
+    return mpfr_get_ld(rest, MPFR_RNDN);
+}
+
+void SpaceShip::solveStageFuelMasses (const std::vector<long double>& stageDeltaVs,
+                                      std::vector<long double>& fuelMasses) {
+    fuelMasses.resize(stages.size());
+    MpfrScratch above(precision), rest(precision), fuel(precision);
+    mpfr_set_zero(above, 0);
+    for (size_t i = stages.size(); i-- > 0;) {                                         // top down
+        const Stage* stage = stages[i];
+        mpfr_add(rest, above, stage->dryMass, MPFR_RNDN);
+        mpfr_add(rest, rest, stage->engine->mass, MPFR_RNDN);
+        mpfr_set_ld(fuel, stageDeltaVs[i], MPFR_RNDN);
+        mpfr_div(fuel, fuel, stage->engine->exhaustVelocity, MPFR_RNDN);
+        mpfr_expm1(fuel, fuel, MPFR_RNDN);
+        mpfr_mul(fuel, fuel, rest, MPFR_RNDN);
+        fuelMasses[i] = mpfr_get_ld(fuel, MPFR_RNDN);
+        mpfr_add(above, rest, fuel, MPFR_RNDN);
+    }
+}
+
+size_t SpaceShip::solveFuelMasses (size_t stageIdx, const std::vector<long double>& totalDeltaVs,
+                                   std::vector<long double>& fuelMasses) {
+    genDeltaV();
+    MpfrScratch sum(precision), rest(precision);
+    mpfr_set_zero(sum, 0);
+    for (size_t i = stageIdx + 1; i < stages.size(); i++) {
+        mpfr_add(sum, sum, stages[i]->deltaV, MPFR_RNDN);
+    }
+    const long double above = mpfr_get_ld(sum, MPFR_RNDN);                             // Fixed whatever the fuel
+
+    // Stages [0, stageIdx] in long double. rests[i] is the stage's rest mass with the current fuel of stageIdx.
+    std::vector<long double> rests(stageIdx + 1), fuels(stageIdx + 1), velocities(stageIdx + 1);
+    long double below = 0;
+    for (size_t i = 0; i <= stageIdx; i++) {
+        mpfr_sub(rest, stages[i]->remainingMass, stages[i]->fuelMass, MPFR_RNDN);
+        rests[i] = mpfr_get_ld(rest, MPFR_RNDN);
+        fuels[i] = mpfr_get_ld(stages[i]->fuelMass, MPFR_RNDN);
+        velocities[i] = mpfr_get_ld(stages[i]->engine->exhaustVelocity, MPFR_RNDN);
+        if (i < stageIdx) {
+            below += mpfr_get_ld(stages[i]->deltaV, MPFR_RNDN);
+        }
+    }
+    const long double currentFuel = fuels[stageIdx], stageRest = rests[stageIdx];
+
+    // Total delta-V with the stage holding fuel, less the target, and its derivative by fuel.
+    auto excess = [&](long double fuel, long double target, long double& slope) {
+        const long double added = fuel - currentFuel;
+        long double total = above + velocities[stageIdx] * log1pl(fuel / stageRest);
+        slope = velocities[stageIdx] / (stageRest + fuel);
+        for (size_t i = 0; i < stageIdx; i++) {
+            const long double stageRestNow = rests[i] + added;
+            total += velocities[i] * log1pl(fuels[i] / stageRestNow);
+            slope -= velocities[i] * fuels[i] / (stageRestNow * (stageRestNow + fuels[i]));
+        }
+        return total - target;
+    };
+
+    fuelMasses.resize(totalDeltaVs.size());
+    size_t unreachable = 0;
+    for (size_t j = 0; j < totalDeltaVs.size(); j++) {
+        const long double target = totalDeltaVs[j];
+        long double slope;
+        if (excess(0, target, slope) >= 0) {
+            fuelMasses[j] = 0;
+            continue;
+        }
+        // Closed form for the stage alone, as if the stages before it kept their current delta-V.
+        long double guess = stageRest * expm1l((target - above - below) / velocities[stageIdx]);
+        long double low = 0, high = std::max(std::max(guess, currentFuel), stageRest);
+        while (std::isfinite(high) && excess(high, target, slope) < 0) {
+            low = high;
+            high *= 2;
+        }
+        if (!std::isfinite(high)) {
+            fuelMasses[j] = NAN;
+            unreachable++;
+            continue;
+        }
+
+        long double fuel = guess > low && guess < high ? guess : (low + high) / 2;
+        for (int iteration = 0; iteration < 200; iteration++) {                        // Newton, kept in [low, high]
+            const long double value = excess(fuel, target, slope);
+            if (value < 0) {
+                low = fuel;
+            } else {
+                high = fuel;
+            }
+            long double next = fuel - value / slope;
+            if (!(next > low && next < high)) {
+                next = (low + high) / 2;
+            }
+            const bool converged = fabsl(next - fuel) <= 4 * LDBL_EPSILON * next;
+            fuel = next;
+            if (converged || high - low <= LDBL_EPSILON * high) {
+                break;
+            }
+        }
+        fuelMasses[j] = fuel;
+    }
+    return unreachable;
+}
+
+int SpaceShip::optimizeStaging (const std::vector<StageStructure>& structures, StagingGoal goal,
+                                long double target) {
+    genDeltaV();
+    const size_t stageCount = structures.size();
+    const bool forMass = goal == StagingGoal::minimizeMass;
+    MpfrScratch payload(precision), above(precision), exactTarget(precision);
+    mpfr_set_zero(payload, 0);
+    mpfr_set_zero(above, 0);
+    if (stageCount < stages.size()) {
+        mpfr_set(payload, stages[stageCount]->remainingMass, MPFR_RNDN);
+    }
+    for (size_t i = stageCount; i < stages.size(); i++) {                              // The payload's own delta-V
+        mpfr_add(above, above, stages[i]->deltaV, MPFR_RNDN);
+    }
+    mpfr_set_ld(exactTarget, target, MPFR_RNDN);
+    if (forMass) {
+        mpfr_sub(exactTarget, exactTarget, above, MPFR_RNDN);
+        if (mpfr_sgn(exactTarget) <= 0) {
+            std::cerr << "[SpaceShip::optimizeStaging] The payload stages already reach " << target << " m/s."
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    // Double first: bracket the top stage's mass and run Newton inside the bracket.
+    const DoubleBackend fast;
+    StagingPath<DoubleBackend> path(fast, stageCount);
+    for (size_t i = 0; i < stageCount; i++) {
+        path.velocities[i] = mpfr_get_d(stages[i]->engine->exhaustVelocity, MPFR_RNDN);
+        path.fractions[i] = (double) structures[i].tankFraction;
+        path.fixedMasses[i] = (double) structures[i].fixedDryMass + mpfr_get_d(stages[i]->engine->mass, MPFR_RNDN);
+    }
+    path.payload = mpfr_get_d(payload, MPFR_RNDN);
+    const double goalValue = mpfr_get_d(exactTarget, MPFR_RNDN);
+    auto excess = [&](double top, double& slope) {
+        path.march(top, forMass);
+        slope = forMass ? path.deltaVSlope : path.slopes[0];
+        for (size_t i = stageCount; i-- > 0;) {                     // A top stage too light leaves a stage below it
+            if (path.fuels[i] < 0) {                                // with negative fuel, and one too heavy
+                return -HUGE_VAL;                                   // overflows before the bottom.
+            }
+            if (!std::isfinite(path.fuels[i])) {
+                return HUGE_VAL;
+            }
+        }
+        if (forMass) {
+            return path.deltaV - goalValue;
+        }
+        slope /= path.masses[0];                                    // Gross mass grows about exponentially with
+        return std::log(path.masses[0] / goalValue);                // the top stage under a tall stack
+    };
+
+    double slope;
+    double low = path.payload + path.fixedMasses[stageCount - 1];                       // Top stage with no fuel
+    if (excess(low, slope) >= 0) {
+        std::cerr << "[SpaceShip::optimizeStaging] " << (forMass ? "Delta-V" : "Gross mass") << " is too low to stage "
+                  << stageCount << " stages under the payload." << std::endl;
+        return 1;
+    }
+    double high = 2 * low;
+    while (std::isfinite(high) && excess(high, slope) < 0) {
+        low = high;
+        high *= 2;
+    }
+    if (!std::isfinite(high)) {
+        std::cerr << "[SpaceShip::optimizeStaging] No staging reaches " << target << (forMass ? " m/s." : ".")
+                  << std::endl;
+        return 1;
+    }
+    double top = (low + high) / 2;
+    for (int iteration = 0; iteration < 200; iteration++) {                            // Newton, kept in [low, high]
+        const double value = excess(top, slope);
+        if (value >= 0) {
+            high = top;
+        } else {
+            low = top;
+        }
+        double next = top - value / slope;
+        if (!(next > low && next < high)) {
+            next = (low + high) / 2;
+        }
+        const bool converged = std::fabs(next - top) <= 1e-13 * next;                  // Enough to start MPFR
+        top = next;
+        if (converged || high - low <= DBL_EPSILON * high) {
+            break;
+        }
+    }
+
+    // Then Newton at the ship's precision, which doubles the correct bits with every step.
+    const MpfrBackend backend(precision);
+    StagingPath<MpfrBackend> exact(backend, stageCount);
+    for (size_t i = 0; i < stageCount; i++) {
+        mpfr_set(&exact.velocities[i], stages[i]->engine->exhaustVelocity, MPFR_RNDN);
+        mpfr_set_ld(&exact.fractions[i], structures[i].tankFraction, MPFR_RNDN);
+        mpfr_set_ld(&exact.fixedMasses[i], structures[i].fixedDryMass, MPFR_RNDN);
+        mpfr_add(&exact.fixedMasses[i], &exact.fixedMasses[i], stages[i]->engine->mass, MPFR_RNDN);
+    }
+    mpfr_set(&exact.payload, payload, MPFR_RNDN);
+    MpfrScratch exactTop(precision), step(precision), halfStep(precision);
+    mpfr_set_d(exactTop, top, MPFR_RNDN);
+    mpfr_set_inf(halfStep, 1);
+    for (int iteration = 0; iteration < 64; iteration++) {
+        exact.march(*exactTop, forMass);
+        mpfr_sub(step, forMass ? &exact.deltaV : &exact.masses[0], exactTarget, MPFR_RNDN);
+        mpfr_div(step, step, forMass ? &exact.deltaVSlope : &exact.slopes[0], MPFR_RNDN);
+        // Roundoff grows down a long stack, so the last steps can stall short of the precision: stop once a step
+        // no longer halves the one before it.
+        if (!mpfr_number_p(step) || mpfr_cmpabs(step, halfStep) > 0) {
+            break;
+        }
+        mpfr_sub(exactTop, exactTop, step, MPFR_RNDN);
+        if (mpfr_zero_p(step) || mpfr_get_exp(step) < mpfr_get_exp(exactTop) - precision + 4) {
+            break;
+        }
+        mpfr_mul_2si(halfStep, step, -1, MPFR_RNDN);
+    }
+    exact.march(*exactTop, forMass);
+    mpfr_sub(step, forMass ? &exact.deltaV : &exact.masses[0], exactTarget, MPFR_RNDN);
+    mpfr_div(step, step, exactTarget, MPFR_RNDN);
+    if (!mpfr_number_p(step) || (!mpfr_zero_p(step) && mpfr_get_exp(step) > -precision / 2)) {
+        std::cerr << "[SpaceShip::optimizeStaging] Staging " << stageCount << " stages is too ill-conditioned to "
+                  << "solve at " << precision << " bits." << std::endl;
+        return 1;
+    }
+
+    for (size_t i = 0; i < stageCount; i++) {
+        if (!mpfr_number_p(&exact.fuels[i]) || mpfr_sgn(&exact.fuels[i]) < 0) {
+            std::cerr << "[SpaceShip::optimizeStaging] The optimum leaves stage " << i << " without fuel; drop it."
+                      << std::endl;
+            return 1;
+        }
+    }
+    MpfrScratch dryMass(precision);
+    for (size_t i = 0; i < stageCount; i++) {
+        mpfr_set_ld(dryMass, structures[i].fixedDryMass, MPFR_RNDN);                  // fixed + s * f
+        mpfr_fma(dryMass, &exact.fractions[i], &exact.fuels[i], dryMass, MPFR_RNDN);
+        setStageDryMass(stages[i], dryMass);
+        setStageFuelMass(stages[i], &exact.fuels[i]);
+    }
+    return 0;
 }
 
 /*    void getRemainingMass (mpfr_t result, const int inputStageIndex) {
@@ -96,17 +766,27 @@ void SpaceShip::getRemainingMass (mpfr_t result, const Stage* inputStage) {
     genDeltaV();
 }*/
 
-void SpaceShip::setStageEngine(Stage* stage, const Engine* newEngine) {
+template <typename Backend>
+void BasicSpaceShip<Backend>::setStageEngine(stage_type* stage, const engine_type* newEngine) {
     // mass += newEngine->mass - stage->engine->mass
-    mpfr_sub(mass, mass, stage->engine->mass, MPFR_RNDN);
-    mpfr_add(mass, mass, newEngine->mass,     MPFR_RNDN);
+    backend.sub(mass, mass, stage->engine->mass);
+    backend.add(mass, mass, newEngine->mass);
 
     // stage->totalMass += newEngine->mass - stage->engine->mass
-    mpfr_sub(stage->totalMass, stage->totalMass, stage->engine->mass, MPFR_RNDN);
-    mpfr_add(stage->totalMass, stage->totalMass, newEngine->mass,     MPFR_RNDN);
+    backend.sub(stage->totalMass, stage->totalMass, stage->engine->mass);
+    backend.add(stage->totalMass, stage->totalMass, newEngine->mass);
 
     stage->engine = newEngine;
-    genDeltaV();
+    markDirty(stage->index);
+}
+
+void SpaceShip::setStageEngine(Stage* stage, const Engine* newEngine) {
+    EngineUsers::IndexGuard guard(engineUsers);                                         // newEngine can't be edited
+    if (engineUsers != nullptr) {                                                       // before the stage is its user.
+        engineUsers->detach(stage->engine, this, stage);
+        engineUsers->attach(newEngine, this, stage);
+    }
+    BasicSpaceShip::setStageEngine(stage, newEngine);
 }
 
 
@@ -143,27 +823,47 @@ void SpaceShip::setStageEngine(Stage* stage, const Engine* newEngine) {
 }*/
 
 
-void SpaceShip::addStage(mpfr_t dryMass, mpfr_t fuelMass, const Engine* engine, const int index) {
+template <typename Backend>
+void BasicSpaceShip<Backend>::addStage(const_reference dryMass, const_reference fuelMass, const engine_type* engine,
+                                       const int index) {
 
-    Stage* stage;
+    stage_type* stage;
     if (index != -1) {
-        stages.insert(stages.begin() + index, new Stage());
+        stages.insert(stages.begin() + index, arena.allocate());
         stage = stages[index];
+        for (size_t i = index + 1; i < stages.size(); i++) {                // Stages after the new one only shift
+            stages[i]->index = i;                                           // position, their cached values are
+        }                                                                   // still valid.
+        if ((size_t) index < dirtyStages) {                                 // Stale stages after it shift up too
+            dirtyStages++;
+        }
+        if ((size_t) index < dirtyMasses) {
+            dirtyMasses++;
+        }
     } else {
-        stages.push_back(new Stage());
+        stages.push_back(arena.allocate());
         stage = stages.back();
         //std::cerr << "Warning: index not specified for addStage, appending to end of stages\n";
     }
     stage->engine = engine;
+    stage->index = index != -1 ? index : stages.size() - 1;
 
-    mpfr_set(stage->dryMass, dryMass, MPFR_RNDN);
-    mpfr_set(stage->fuelMass, fuelMass, MPFR_RNDN);
+    backend.copy(stage->dryMass, dryMass);
+    backend.copy(stage->fuelMass, fuelMass);
 
-    mpfr_add(stage->totalMass, stage->dryMass, stage->fuelMass, MPFR_RNDN);
-    mpfr_add(stage->totalMass, stage->totalMass, stage->engine->mass, MPFR_RNDN);
+    backend.add(stage->totalMass, stage->dryMass, stage->fuelMass);
+    backend.add(stage->totalMass, stage->totalMass, stage->engine->mass);
 
-    mpfr_add(mass, mass, stage->totalMass, MPFR_RNDN);
-    genDeltaV();
+    backend.add(mass, mass, stage->totalMass);
+    markDirty(stage->index);
+}
+
+void SpaceShip::addStage(mpfr_t dryMass, mpfr_t fuelMass, const Engine* engine, const int index) {
+    EngineUsers::IndexGuard guard(engineUsers);                                         // engine can't be edited
+    BasicSpaceShip::addStage(dryMass, fuelMass, engine, index);
+    if (engineUsers != nullptr) {                                                       // before the stage is its user.
+        engineUsers->attach(engine, this, stages[index != -1 ? index : stages.size() - 1]);
+    }
 }
 
 /**
@@ -171,18 +871,19 @@ void SpaceShip::addStage(mpfr_t dryMass, mpfr_t fuelMass, const Engine* engine,
 * @param stage Pointer to the stage.
 * @param newMass The new dry mass.
 */
-void SpaceShip::setStageDryMass(Stage* stage, const mpfr_t newMass) {
+template <typename Backend>
+void BasicSpaceShip<Backend>::setStageDryMass(stage_type* stage, const_reference newMass) {
     // mass += newMass - stage->dryMass;
-    mpfr_sub(mass, mass, stage->dryMass, MPFR_RNDN);
-    mpfr_add(mass, mass, newMass,        MPFR_RNDN);
+    backend.sub(mass, mass, stage->dryMass);
+    backend.add(mass, mass, newMass);
 
     // totalMass += newMass - stage->dryMass;
-    mpfr_sub(stage->totalMass, stage->totalMass, stage->dryMass, MPFR_RNDN);
-    mpfr_add(stage->totalMass, stage->totalMass, newMass,        MPFR_RNDN);
+    backend.sub(stage->totalMass, stage->totalMass, stage->dryMass);
+    backend.add(stage->totalMass, stage->totalMass, newMass);
 
     // stage->dryMass = newMass;
-    mpfr_set(stage->dryMass, newMass, MPFR_RNDN);
-    genDeltaV();
+    backend.copy(stage->dryMass, newMass);
+    markDirty(stage->index);
 }
 
 /**
@@ -190,14 +891,23 @@ void SpaceShip::setStageDryMass(Stage* stage, const mpfr_t newMass) {
  * @param stage Pointer to the stage.
  * @param newMass The new fuel mass.
  */
-void SpaceShip::setStageFuelMass(Stage* stage, const mpfr_t newMass) {
-    mpfr_sub(mass, mass, stage->fuelMass, MPFR_RNDN);
-    mpfr_sub(stage->totalMass, stage->totalMass, stage->fuelMass, MPFR_RNDN);
+template <typename Backend>
+void BasicSpaceShip<Backend>::setStageFuelMass(stage_type* stage, const_reference newMass) {
+    backend.sub(mass, mass, stage->fuelMass);
+    backend.sub(stage->totalMass, stage->totalMass, stage->fuelMass);
 
-    mpfr_add(mass, mass, newMass, MPFR_RNDN);
-    mpfr_add(stage->totalMass, stage->totalMass, newMass, MPFR_RNDN);
+    backend.add(mass, mass, newMass);
+    backend.add(stage->totalMass, stage->totalMass, newMass);
 
-    mpfr_set(stage->fuelMass, newMass, MPFR_RNDN); // stage->dryMass = newMass;
-    genDeltaV();
+    backend.copy(stage->fuelMass, newMass); // stage->dryMass = newMass;
+    markDirty(stage->index);
 }
 
+template class BasicSpaceShip<DoubleBackend>;
+template class BasicSpaceShip<LongDoubleBackend>;
+template class BasicSpaceShip<DoubleDoubleBackend>;
+template class BasicSpaceShip<MpfrBackend>;
+#ifdef IRA_FLOAT128
+template class BasicSpaceShip<Float128Backend>;
+#endif
+
@@ -4,46 +4,437 @@
 #include <vector>
 #include "Stage.h"
 #include "Engine.h"
+#include "StageArena.h"
+#include "EngineUsers.h"
+#include "WorkStealingPool.h"
+#include <functional>
+#include <mutex>
 
 #ifndef SRC_SPACESHIP_H
 #define SRC_SPACESHIP_H
 
+/**
+ * @brief How a ship generates its delta-V.
+ */
+enum class EvaluationMode {
+    exact,      /**< Every stage in MPFR at the ship's precision. */
+    fast,       /**< Stages in long double, redone in MPFR only when the error bound misses the tolerance. */
+    certified   /**< Interval arithmetic at the lowest precision whose total delta-V interval is within the tolerance. */
+};
+
+/**
+ * @brief Guaranteed bounds on a ship's delta-V, from directed rounding.
+ */
+struct DeltaVBounds {
+    long double lower = 0,                      /**< Lower bound of the total delta-V, rounded down. */
+    upper = 0;                                  /**< Upper bound of the total delta-V, rounded up. */
+    mpfr_prec_t precision = 0;                  /**< Working precision of the last pass, in bits. */
+    bool converged = false;                     /**< Whether upper - lower met the tolerance. */
+    std::vector<long double> stageLower,        /**< Bounds of each stage's delta-V, in burn order. */
+    stageUpper;
+};
+
+/**
+ * @brief Partial derivatives of a ship's total delta-V by the values of each stage, in burn order.
+ */
+struct DeltaVGradient {
+    long double deltaV = 0;                     /**< Total delta-V the gradient was taken at. */
+    std::vector<long double> dryMass,           /**< d deltaV / d dry mass of each stage. */
+    fuelMass,                                   /**< d deltaV / d fuel mass of each stage. */
+    engineMass,                                 /**< d deltaV / d engine mass of each stage. An engine shared by
+                                                     several stages moves all of them: sum their entries. */
+    exhaustVelocity;                            /**< d deltaV / d exhaust velocity of each stage. */
+};
+
+/**
+ * @brief How the dry mass of a stage scales with its fuel, for optimal staging: dry mass is
+ *        fixedDryMass + tankFraction * fuel, and the engine comes on top.
+ */
+struct StageStructure {
+    long double fixedDryMass = 0;               /**< Dry mass that doesn't grow with the tanks. */
+    long double tankFraction = 0;               /**< Dry mass added per unit of fuel: tanks and structure. Has to be
+                                                     positive. */
+};
+
+/**
+ * @brief What optimal staging holds fixed and what it optimizes.
+ */
+enum class StagingGoal {
+    maximizeDeltaV,     /**< Most delta-V for a gross mass. */
+    minimizeMass        /**< Least gross mass for a delta-V. */
+};
+
+/**
+ * @brief The ship model, templated on a numeric backend: stages, cached masses and delta-V, and the lazy dirty ranges
+ *        that keep them up to date.
+ * @details Each stage's delta-V is dv = ve * log1p(fuel / rest), where rest = dry + engine + remaining mass of the next
+ *          stage. Every term is positive, so nothing cancels, whatever the backend's precision. This replaced the
+ *          original ve * ln(remaining / (remaining - fuel)) on purpose: at MPFR precisions the two agree to a few
+ *          units in the last place, and in long double and below the old form lost every correct digit of stages
+ *          whose fuel is small next to their rest mass.
+ *
+ *          SpaceShip is the MPFR instantiation, with the engine index, evaluation modes and solvers on top; BasicShip
+ *          exposes the others. The supported backends are instantiated in SpaceShip.cpp.
+ * @tparam Backend A numeric backend from NumericBackend.h.
+ */
+template <typename Backend>
+class BasicSpaceShip {
+public:
+    typedef typename Backend::storage_type storage_type;
+    typedef typename Backend::const_reference const_reference;
+    typedef BasicStage<Backend> stage_type;
+    typedef BasicEngine<Backend> engine_type;
+
+    /**
+     * @brief Constructs an empty ship.
+     * @param backend Numeric backend, which holds the precision for MPFR.
+     */
+    explicit BasicSpaceShip(const Backend& backend);
+    ~BasicSpaceShip();
+
+    BasicSpaceShip(const BasicSpaceShip& other) = delete;
+    BasicSpaceShip& operator=(const BasicSpaceShip& other) = delete;
+
+    /**
+     * @brief Returns the backend the ship's values are held by.
+     * @return Numeric backend.
+     */
+    const Backend& getBackend () const;
+
+    /**
+     * @brief Reserves storage so the next count stages are stored contiguously.
+     * @param count Number of stages that will be added.
+     */
+    void reserveStages (size_t count);
+
+    /**
+     * @brief Lets delta-V of long ships be generated on several threads.
+     * @details With a pool, a ship with at least minStages stale stages splits the remaining mass suffix scan, the
+     *          per-stage delta-V and the final sum into blocks run on the pool. The scan and the sum then round in a
+     *          different order than the serial loops, so results can differ from them in the last bits. They do not
+     *          depend on the number of threads. EvaluationMode::certified always runs serially.
+     * @note The pool is shared between ships safely but must not be the one running this ship's own evaluation.
+     * @param pool Pool to run on, or nullptr to always evaluate on the calling thread.
+     * @param minStages Fewest stale stages to split.
+     */
+    void setStagePool (WorkStealingPool* pool, size_t minStages = 1024);
+
+    /**
+     * @brief Returns a counter that changes whenever a stage or engine of the ship does, so derived values can be
+     *        cached against it.
+     * @return Revision of the ship.
+     */
+    size_t getRevision () const;
+
+    /**
+     * @brief Adds a stage to the spaceship.
+     * @param dryMass The dry mass of the stage.
+     * @param fuelMass The fuel mass of the stage.
+     * @param engine The engine used in the stage.
+     * @param index The index at which to insert the stage (optional).
+     */
+    void addStage (const_reference dryMass, const_reference fuelMass, const engine_type* engine, int index = -1);
+
+    /**
+     * @brief Sets the dry mass of a stage.
+     * @param stage Pointer to the stage.
+     * @param newMass The new dry mass.
+     */
+    void setStageDryMass (stage_type* stage, const_reference newMass);
+
+    /**
+     * @brief Sets the fuel mass of a stage.
+     * @param stage Pointer to the stage.
+     * @param newMass The new fuel mass.
+     */
+    void setStageFuelMass (stage_type* stage, const_reference newMass);
+
+    /**
+     * @brief Sets the engine of a stage.
+     * @param stage Pointer to the stage.
+     * @param newEngine The new engine.
+     */
+    void setStageEngine (stage_type* stage, const engine_type* newEngine);
+
+protected:
+    Backend backend;             /**< Numeric backend, holds the precision for MPFR. */
+    BasicStageArena<Backend> arena;              /**< Storage for the stages and their values. */
+    std::vector<stage_type*> stages;             /**< Vector of stages, in burn order. Points into arena. */
+    storage_type mass,           /**< Total mass of the spaceship. */
+    deltaV;                      /**< Total delta-V of the spaceship. */
+    size_t dirtyStages = 0;      /**< Stages [0, dirtyStages) have a stale deltaV. */
+    size_t dirtyMasses = 0;      /**< Stages [0, dirtyMasses) have a stale remainingMass. */
+    size_t revision = 0;         /**< Bumped by every change that makes a stage stale. */
+    WorkStealingPool* stagePool = nullptr;       /**< Threads for evaluating long ships, if any. */
+    size_t parallelMinStages = 1024;             /**< Fewest stale stages worth splitting across stagePool. */
+    std::vector<typename Backend::value_type> blockSums;  /**< Partial delta-V sums of each block but the first. */
+    std::vector<size_t> blockOrder;              /**< Block indices handed to stagePool. */
+
+    static const size_t stageBlockSize = 256;    /**< Stages per block. Fixed, so results don't depend on the
+                                                      number of threads. */
+
+    /**
+     * @brief Splits [0, count) into blocks of stageBlockSize and runs body on each, in parallel on stagePool when
+     *        count reaches parallelMinStages. Otherwise the whole range is one block, run on the calling thread.
+     * @param count Number of stages to cover.
+     * @param body Called with the block's index and its stages [begin, end).
+     * @return Number of blocks.
+     */
+    size_t forEachBlock (size_t count, const std::function<void(size_t block, size_t begin, size_t end)>& body);
+
+    /**
+     * @brief Generates the delta-V for the stages that are out of date, each with genStageDeltaV.
+     *
+     * A stage's delta-V only depends on itself and the stages after it, so only stages [0, dirtyStages) are
+     * recalculated. The stages after that keep their cached remainingMass and deltaV.
+     * Mutators never call this; derived values are generated lazily by whatever reads them.
+     */
+    void genDeltaV ();
+
+    /**
+     * @brief Brings the cached remaining masses up to date, without generating any delta-V.
+     *
+     * remainingMass is a suffix sum of totalMass, so this is one addition per stale stage. Long ships on a stagePool
+     * are scanned in blocks: each block sums its own suffix in parallel, the first stage of each block is carried
+     * down serially, and the carry is added to the rest of each block in parallel.
+     */
+    void genRemainingMass ();
+
+    /**
+     * @brief Generates the delta-V of one stage from the cached remaining mass of the next.
+     * @param stageIdx Index of the stage.
+     * @param rest Scratch value for the stage's rest mass.
+     */
+    void genStageDeltaV (size_t stageIdx, const typename Backend::Scratch& rest);
+
+    /**
+     * @brief Sums the stages' delta-V into the ship's, in blocks on stagePool for long ships, and marks every stage
+     *        up to date.
+     */
+    void sumDeltaV ();
+
+    /**
+     * @brief Marks a stage and every stage before it as out of date.
+     * @param stageIdx Index of the changed stage.
+     * @param massChanged False if only the stage's exhaust velocity changed, which leaves every remaining mass valid.
+     */
+    void markDirty (size_t stageIdx, bool massChanged = true);
+
+    /**
+     * @brief Recomputes a stage's total mass from its parts, after its engine's mass changed in place.
+     * @param stage Stage of this ship.
+     */
+    void genTotalMass (stage_type* stage);
+
+    /**
+     * @brief Updates the given stages after the mass of their engine changed in place.
+     * @param users Stages of this ship using the engine.
+     */
+    void engineMassChanged (const std::vector<stage_type*>& users);
+
+    /**
+     * @brief Marks the given stages out of date after the exhaust velocity of their engine changed in place.
+     * @param users Stages of this ship using the engine.
+     */
+    void engineExhaustVelocityChanged (const std::vector<stage_type*>& users);
+};
+
 /**
  * @brief Spaceship class with full functionality.
  *
  * This class provides getters and setters for accessing and modifying the spaceship's attributes.
  * Directly setting variables will produce inaccurate measurements, so they are protected.
  */
-class SpaceShip {
+class SpaceShip : public BasicSpaceShip<MpfrBackend> {
     friend class SpaceShipHandler;
+    friend class EngineUsers;
 
 protected:
-    std::vector<Stage*> stages;  /**< Vector of stages. */
-    mpfr_t mass,                 /**< Total mass of the spaceship. */
-    deltaV;                      /**< Total delta-V of the spaceship. */
+    mpfr_prec_t precision;       /**< MPFR precision of every value owned by this ship. */
+    EngineUsers* engineUsers;    /**< Reverse engine index to keep up to date, if any. */
+    mutable std::recursive_mutex operations; /**< Held by ship operations and by edits of engines the ship uses,
+                                                  see EngineUsers. */
+    EvaluationMode mode = EvaluationMode::exact; /**< How genDeltaV evaluates the stages. */
+    long double relativeTolerance = 1e-15;       /**< fast: relative error allowed per stage. */
+    long double absoluteTolerance = 1e-9;        /**< certified: width allowed for the total delta-V interval,
+                                                      in m/s. */
+    DeltaVBounds bounds;                         /**< Bounds from the last certified evaluation. */
+    size_t fallbackStages = 0;   /**< Stages the fast path had to redo in MPFR, for diagnostics. */
 
     /**
-     * @brief Generates the delta-V for the spaceship or a specific stage.
-     * @param inpStage Pointer to the input stage (optional).
-     *
-     * If inpStage is specified, it calculates the delta-V only for stages before the new stage.
-     * Otherwise, it calculates the delta-V for all stages.
+     * @brief Generates the delta-V for the stages that are out of date, in the ship's EvaluationMode.
+     * @details Hides BasicSpaceShip::genDeltaV, which is the EvaluationMode::exact path.
      */
     void genDeltaV ();
 
+    /**
+     * @brief Generates the delta-V of one stage in long double.
+     *
+     * Uses the same formula as genStageDeltaV in long double. Every term is positive, so the relative error stays a
+     * small multiple of the long double epsilon.
+     * @param stageIdx Index of the stage.
+     * @return false if the stage's values don't fit in a long double or the error bound exceeds tolerance; the
+     *         stage's deltaV is left untouched in that case.
+     */
+    bool genStageDeltaVFast (size_t stageIdx);
+
+    /**
+     * @brief Bounds every stage's delta-V, and the total, with interval arithmetic at one working precision.
+     *
+     * Inputs are rounded outwards to the working precision and every operation rounds down for the lower bound and
+     * up for the upper one. Masses and exhaust velocities have to be non-negative, which keeps every operation
+     * monotone.
+     * @param workingPrecision Precision of the interval arithmetic, in bits.
+     * @param tolerance Width the total's interval has to get under to count as converged.
+     * @param result Bounds, filled in.
+     * @param storeMidpoints Whether to store the midpoint of each interval as the stage's and the ship's deltaV.
+     * @return false if an input is negative or NaN.
+     */
+    bool boundDeltaV (mpfr_prec_t workingPrecision, long double tolerance, DeltaVBounds& result,
+                      bool storeMidpoints);
+
+    /**
+     * @brief Runs boundDeltaV from startPrecision, doubling the precision until it converges or reaches the ship's
+     *        precision.
+     * @return false if the ship can't be bounded, see boundDeltaV.
+     */
+    bool escalateBounds (long double tolerance, mpfr_prec_t startPrecision, DeltaVBounds& result,
+                         bool storeMidpoints);
+
 public:
     SpaceShip();
 
+    /**
+     * @brief Constructs a spaceship whose values have the given precision.
+     * @param precision MPFR precision in bits.
+     * @param engineUsers Reverse engine index the ship registers its stages in (optional).
+     */
+    explicit SpaceShip(mpfr_prec_t precision, EngineUsers* engineUsers = nullptr);
+
     ~SpaceShip();
 
     /**
-      * @brief Returns the vector of stages.
+      * @brief Returns the vector of stages, with their delta-V up to date.
       * @return Vector of stages.
       */
     std::vector<Stage*>* getStages ();
 
+    /**
+     * @brief Returns the MPFR precision of the ship.
+     * @return Precision in bits.
+     */
+    mpfr_prec_t getPrecision () const;
+
+    /**
+     * @brief Sets how delta-V is generated. Every stage is regenerated on the next read.
+     * @param newMode EvaluationMode::exact, EvaluationMode::fast or EvaluationMode::certified.
+     * @param relativeTolerance fast: relative error bound a stage has to meet, otherwise it is redone in MPFR.
+     * @param absoluteTolerance certified: width the total delta-V interval has to get under, in m/s.
+     */
+    void setEvaluationMode (EvaluationMode newMode, long double relativeTolerance = 1e-15,
+                            long double absoluteTolerance = 1e-9);
+
+    /**
+     * @brief Computes guaranteed bounds on the delta-V, doubling the working precision from startPrecision until
+     *        the total's interval is narrower than tolerance or the ship's own precision is reached.
+     * @note Leaves the cached delta-V alone; EvaluationMode::certified is the mode that stores the result.
+     * @param tolerance Width the total delta-V interval has to get under, in m/s.
+     * @param startPrecision First working precision, in bits.
+     * @return Bounds from the last pass, with the precision it used. converged is false, and the bounds are not set,
+     *         if a mass or exhaust velocity is negative.
+     */
+    DeltaVBounds certifyDeltaV (long double tolerance, mpfr_prec_t startPrecision = 64);
+
+    /**
+     * @brief Returns the bounds from the last evaluation in EvaluationMode::certified.
+     * @return Bounds, with the precision they needed.
+     */
+    const DeltaVBounds& getDeltaVBounds ();
+
+    /**
+     * @brief Returns the number of stages the fast path has redone in MPFR since the ship was created.
+     * @return Number of fallbacks.
+     */
+    size_t getFallbackStages () const;
+
+    /**
+     * @brief Computes the gradient of the total delta-V by every stage's masses and exhaust velocity, in one
+     *        reverse pass from the bottom stage up at the ship's precision.
+     * @details With rest = remaining mass - fuel, stage i contributes dv = ve * log1p(fuel / rest), so
+     *          d dv / d fuel = ve / remaining, d dv / d rest = -ve * fuel / (rest * remaining) and
+     *          d dv / d ve = log1p(fuel / rest) = dv / ve. A stage's masses are part of the rest of every stage
+     *          before it, so each mass partial also picks up the running sum of d dv / d rest of the stages below.
+     *          Uses the cached remaining masses and, in EvaluationMode::exact, the cached stage delta-Vs.
+     * @param gradient Filled in, one entry per stage.
+     */
+    void getDeltaVGradient (DeltaVGradient& gradient);
+
+    /**
+     * @brief Gets the mass of a stage and every stage after it.
+     * @param result Initialized mpfr_t to store the mass in.
+     * @param inputStage Pointer to the stage.
+     */
     void getRemainingMass (mpfr_t result, const Stage* inputStage);
 
+    /**
+     * @brief Inverts the rocket equation for one stage: the fuel mass that gives it a delta-V, every other stage
+     *        unchanged. A stage's rest mass doesn't depend on its own fuel, so this is closed form,
+     *        fuel = rest * expm1(deltaV / ve), computed at the ship's precision.
+     * @param stageIdx Index of the stage.
+     * @param deltaV Delta-V the stage should have.
+     * @return Fuel mass; infinite or NaN if the stage's exhaust velocity is 0.
+     */
+    long double solveStageFuelMass (size_t stageIdx, long double deltaV);
+
+    /**
+     * @brief Inverts the rocket equation for the dry mass budget of one stage: the dry mass that gives it a delta-V
+     *        with its current fuel, rest = fuel / expm1(deltaV / ve), less the engine and the stages after it.
+     * @param stageIdx Index of the stage.
+     * @param deltaV Delta-V the stage should have.
+     * @return Dry mass; negative if the stage falls short of deltaV even with no dry mass.
+     */
+    long double solveStageDryMass (size_t stageIdx, long double deltaV);
+
+    /**
+     * @brief Fuel mass of every stage for a delta-V per stage. Stages are solved from the top down, so each one
+     *        carries the fuel just solved for above it.
+     * @param stageDeltaVs Delta-V of each stage, in burn order.
+     * @param fuelMasses Resized to the number of stages and filled in.
+     */
+    void solveStageFuelMasses (const std::vector<long double>& stageDeltaVs, std::vector<long double>& fuelMasses);
+
+    /**
+     * @brief Fuel mass of one stage that gives the ship a total delta-V, for many totals.
+     * @details Stages after stageIdx are unaffected and summed once. Adding fuel to the stage also weighs down every
+     *          stage before it, so each total is found with a bracketed Newton iteration in long double over the
+     *          stages up to stageIdx, starting from the closed form that ignores the extra weight. Every iteration
+     *          is one pass of log1p over those stages, from cached rest masses; no stage is written.
+     * @param stageIdx Index of the stage whose fuel varies.
+     * @param totalDeltaVs Total delta-Vs to reach.
+     * @param fuelMasses Resized and filled in with the fuel mass that reaches each total, 0 if the ship
+     *        already reaches it with none, and NaN if it can't be reached.
+     * @return Number of totals that can't be reached.
+     */
+    size_t solveFuelMasses (size_t stageIdx, const std::vector<long double>& totalDeltaVs,
+                            std::vector<long double>& fuelMasses);
+
+    /**
+     * @brief Splits fuel over the first stages so that the ship gets the most delta-V for its gross mass, or the
+     *        least gross mass for its delta-V, and writes the split into the stages with one recompute.
+     * @details Stages from structures.size() up are the payload and keep their values; each optimized stage keeps
+     *          its engine and gets fuel f and dry mass fixedDryMass + tankFraction * f. The classical Lagrange
+     *          conditions give every stage below the top one from the top stage's mass (see StagingPath), so the
+     *          solve is a Newton iteration on a single value: bracketed in double first, then a few steps at the
+     *          ship's precision from the double solution.
+     * @param structures Structure of each optimized stage, in burn order.
+     * @param goal What target is.
+     * @param target Gross mass of the ship for StagingGoal::maximizeDeltaV, total delta-V of the ship for
+     *        StagingGoal::minimizeMass.
+     * @return 0 if successful, 1 if the target can't be met, the optimum leaves a stage without fuel or the stack is
+     *         too ill-conditioned for the ship's precision. Nothing is written on failure.
+     */
+    int optimizeStaging (const std::vector<StageStructure>& structures, StagingGoal goal, long double target);
+
     /**
      * @brief Sets the engine of a stage.
      * @param stage Pointer to the stage.
@@ -57,24 +448,16 @@ public:
      * @param fuelMass The fuel mass of the stage.
      * @param engine The engine used in the stage.
      * @param index The index at which to insert the stage (optional).
+     * @details Hides BasicSpaceShip::addStage to register the stage in the engine index.
      */
 
     void addStage(mpfr_t dryMass, mpfr_t fuelMass, const Engine* engine, const int index = -1);
 
     /**
-     * @brief Sets the dry mass of a stage.
-     * @param stage Pointer to the stage.
-     * @param newMass The new dry mass.
-     */
-    void setStageDryMass(Stage* stage, const mpfr_t newMass);
-
-    /**
-     * @brief Sets the fuel mass of a stage.
+     * @brief Sets the engine of a stage and moves the stage to the new engine in the engine index.
      * @param stage Pointer to the stage.
-     * @param newMass The new fuel mass.
+     * @param newEngine The new engine.
      */
-    void setStageFuelMass(Stage* stage, const mpfr_t newMass);
-
     void setStageEngine(Stage* stage, const Engine* newEngine);
 
 };
@@ -11,105 +11,300 @@
 #include <cmath>
 #include <cstring>
 #include <unordered_map>
+#include <mutex>
+#include <stdexcept>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <algorithm>
 #include "iostream"
 #include "SpaceShipWrapper.h"
+#include "MpfrScratch.h"
+#include "EngineUsers.h"
+#include "EngineTable.h"
+#include "WorkStealingPool.h"
 
 #ifndef IRA_SPACESHIPHANDLER_H
 #define IRA_SPACESHIPHANDLER_H
 
+/**
+ * @brief What SpaceShipHandler::evaluateAll did, and how fast.
+ */
+struct EvaluationStats {
+    size_t ships = 0;                           /**< Ships that had stale stages and were evaluated. */
+    size_t stages = 0;                          /**< Stale stages regenerated across those ships. */
+    unsigned threads = 0;                       /**< Threads that evaluated, including the caller. */
+    size_t steals = 0;                          /**< Ships a thread took from another's queue. */
+    double seconds = 0;                         /**< Wall time of the evaluation. */
+    double shipsPerSecond = 0;
+    double stagesPerSecond = 0;
+};
+
 /**
  * @brief A largely stable class that abstracts SpaceShip class
  * @details Intended as a long term interface for the space ship class.
  *          This class won't change unless a new major version comes out (excluding 0.X.X).
+ *
+ *          Thread safety: engines can be created, looked up and edited, and ships added, from any number of threads
+ *          at once. Each ship may only be used by one thread at a time, but different ships can be used in parallel.
+ *          Each ship has its own lock, so operations on different ships never wait for each other. Editing an engine
+ *          (setEngineDryMass, setEngineExhaustVelocity) waits for the operations in progress on the ships using it,
+ *          and only those, so a ship never sees an engine half edited. An Engine* from getEngine may be read outside
+ *          a ship operation only while no thread edits it. Engines must not be edited from inside a ship operation;
+ *          see EngineUsers for the lock order. MPFR's caches are per thread when MPFR is built thread safe,
+ *          which the constructor checks.
  */
 class SpaceShipHandler {
 protected:
     // Hash map will not be implemented for SpaceShipWrapper. This vector is for keeping internal tabs on the ships
     // created (mainly for memory management but also other internal functions).
     std::vector<SpaceShipWrapper*> shipList;                         /**< Pointer list to the ships. */
+    std::mutex shipListMutex;                                        /**< Guards shipList. */
 
     // It is the handler's job to keep track of engines, all other references to engines are (or at least should be)
     // immutable.
-    // Hash map for the engines. When accessing engines, it should be done by its name. A name will not repeat and is
-    // required for the engine.
-    std::unordered_map<std::string, Engine*> engineList;             /**< Hash map for engine list by name. */
+    // Engines are stored densely and addressed by EngineId. Lookups by id take no lock. Hot paths should use ids.
+    EngineTable engines;                                             /**< Engines, indexed by EngineId. */
+
+    // Names are only for import and export. A name will not repeat and is required for the engine. The map is split
+    // into shards by hash so threads creating or looking up different names rarely wait on each other.
+    struct NameShard {
+        std::mutex mutex;
+        std::unordered_map<std::string, EngineId> ids;
+    };
+    static const size_t nameShardCount = 16;
+    NameShard nameShards[nameShardCount];                            /**< Engine ids by name, sharded by hash. */
+
+    // Every value created through this handler uses this precision. The global mpfr default precision is left alone,
+    // so handlers with different precisions can be used side by side.
+    mpfr_prec_t precision;                                           /**< MPFR precision of ships and engines. */
+
+    // Ships created by this handler register which engine each of their stages uses, so that editing an engine only
+    // touches the ships and stages that actually use it.
+    EngineUsers engineUsers;                                         /**< Reverse index from engine to stages. */
+
+    // Started by the first evaluateAll and kept, so its threads' MPFR scratch stays warm across calls.
+    std::unique_ptr<WorkStealingPool> pool;                          /**< Workers for evaluateAll. */
+    std::mutex poolMutex;                                            /**< One evaluateAll at a time. */
 
 public:
     /**
      * @brief Construct a new Space Ship Handler object.
-     * @param precision Sets "global" mpfr precision, not just for this handler.
-     * @note There shouldn't be more than one of these at a time.
+     * @param precision MPFR precision, in bits, of every ship and engine created by this handler.
+     */
+    SpaceShipHandler(long precision) : precision(precision) {
+        if (!mpfr_buildopt_tls_p()) {
+            std::cerr << "[SpaceShipHandler] MPFR was built without thread local storage; only use it from one "
+                         "thread." << std::endl;
+        }
+    }
+    /**
+     * @brief Deletes the ships and engines. No other thread may be using the handler.
      */
-    SpaceShipHandler(long precision) {
-        mpfr_set_default_prec(precision);                                   // Consider changing this so that other mpfr
-    }                                                                       // actions don't override this.
     ~SpaceShipHandler() {
+        pool.reset();                                                       // Workers first, they may hold caches
         for (auto &ship : shipList) {
             delete ship;
         }
-        for (auto &enginePair : engineList) {
-            delete enginePair.second;
-        }
-        mpfr_free_cache();
+        // Only this thread's caches: other threads' are theirs to free, and may still be in use by other handlers.
+        mpfr_free_cache2(MPFR_FREE_LOCAL_CACHE);
 
     }
 
     // ========== CREATORS ==========
     SpaceShipWrapper* addShip() {
-        auto newShip = new SpaceShipWrapper();
+        auto newShip = new SpaceShipWrapper(precision, &engineUsers, &engines);
+        std::lock_guard<std::mutex> lock(shipListMutex);
         shipList.push_back(newShip);
         return newShip;
     }
 
+    /**
+     * @brief Deletes a ship created by this handler.
+     * @note No other thread may be using the ship.
+     * @param ship The ship.
+     * @return 0 if successful, 1 if the ship is not this handler's.
+     */
+    int removeShip(SpaceShipWrapper* ship) {
+        {
+            std::lock_guard<std::mutex> lock(shipListMutex);
+            auto found = std::find(shipList.begin(), shipList.end(), ship);
+            if (found == shipList.end()) {
+                std::cerr << "[SpaceShipHandler::removeShip] The ship is not from this handler." << std::endl;
+                return 1;
+            }
+            shipList.erase(found);
+        }
+        delete ship;                                                        // Detaches its stages from the engines
+        return 0;
+    }
+
+    /**
+     * @brief Creates an engine.
+     * @param name Unique name of the engine.
+     * @param mass Mass of the engine.
+     * @param exhaustVelocity Exhaust velocity of the engine.
+     * @return 0 if successful, 1 if the name is taken.
+     */
     int createEngine(std::string name, const long double mass, const long double exhaustVelocity) {
+        return createEngineId(std::move(name), mass, exhaustVelocity) == invalidEngineId ? 1 : 0;
+    }
+
+    /**
+     * @brief Creates an engine and returns its id, for callers that address engines by id.
+     * @param name Unique name of the engine.
+     * @param mass Mass of the engine.
+     * @param exhaustVelocity Exhaust velocity of the engine.
+     * @return Id of the new engine, or invalidEngineId if the name is taken.
+     */
+    EngineId createEngineId(std::string name, const long double mass, const long double exhaustVelocity) {
         // There cannot be conflicts for multiple reasons. One, it makes it impossible to find the engine. Two,
         // It generates a memory leak. Three, it should prompt the user on the fact that it already exists.
-        if (engineList.find(name) != engineList.end()) {
-            std::cerr << "[SpaceShipHandler::createEngine] Engine " << name << " already exists." << std::endl;
-            return 1;
+        NameShard& shard = nameShard(name);
+        std::lock_guard<std::mutex> lock(shard.mutex);                      // Held until the id is published, so a
+        if (shard.ids.find(name) != shard.ids.end()) {                      // name always maps to a readable engine.
+            std::cerr << "[SpaceShipHandler::createEngineId] Engine " << name << " already exists." << std::endl;
+            return invalidEngineId;
         }
 
-        auto newEngine = new Engine();
+        auto newEngine = new Engine(MpfrBackend(precision));
 
         mpfr_set_ld(newEngine->mass, mass, MPFR_RNDN);
         mpfr_set_ld(newEngine->exhaustVelocity, exhaustVelocity, MPFR_RNDN);
 
         newEngine->name = name;
-        engineList.insert({name, newEngine});
-        return 0;
+        newEngine->id = engines.reserve();
+        engines.publish(newEngine->id, newEngine);
+        shard.ids.insert({std::move(name), newEngine->id});
+        return newEngine->id;
     }
 
     // ========== SETTERS ==========
     /**
-     * @brief Sets the mass of the ship.
+     * @brief Sets the mass of an engine and updates every ship using it.
+     * @param mass To-be mass.
+     * @param id Id of the engine.
+     * @return 0 if successful, 1 if not.
+     */
+    int setEngineDryMass(const long double mass, const EngineId id) {
+        Engine* engine = engines.get(id);
+        if (engine == nullptr) {
+            std::cerr << "[SpaceShipHandler::setEngineDryMass] Engine " << id.value << " does not exist." << std::endl;
+            return 1;
+        }
+        EngineUsers::EditGuard guard(engineUsers, engine);
+        mpfr_set_ld(engine->mass, mass, MPFR_RNDN);
+
+        auto users = engineUsers.find(engine);                              // Only the stages using this engine, and
+        if (users != nullptr) {                                             // the stages before them, go stale.
+            for (auto &shipStages : *users) {
+                shipStages.first->engineMassChanged(shipStages.second);
+            }
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Sets the mass of an engine and updates every ship using it.
      * @param mass To-be mass.
-     * @param ship Pointer to the ship.
+     * @param name Name of the engine.
      * @return 0 if successful, 1 if not.
      */
     int setEngineDryMass(const long double mass, const std::string& name) {
-        try {
-            mpfr_set_ld(engineList.at(name)->mass, mass, MPFR_RNDN);
-        } catch (const std::out_of_range& e) {
+        const EngineId id = findEngineId(name);
+        if (id == invalidEngineId) {
             std::cerr << "[SpaceShipHandler::setEngineDryMass] Engine " << name << " does not exist." << std::endl;
             return 1;
         }
+        return setEngineDryMass(mass, id);
+    }
+
+    /**
+     * @brief Sets the engine exhaust velocity and marks the stages using it out of date.
+     * @param exhaustVelocity To-be exhaust velocity.
+     * @param id Id of the engine.
+     * @return 0 if successful, 1 if not.
+     */
+    int setEngineExhaustVelocity(const long double exhaustVelocity, const EngineId id) {
+        Engine* engine = engines.get(id);
+        if (engine == nullptr) {
+            std::cerr << "[SpaceShipHandler::setEngineExhaustVelocity] Engine " << id.value << " does not exist."
+                      << std::endl;
+            return 1;
+        }
+        EngineUsers::EditGuard guard(engineUsers, engine);
+        mpfr_set_ld(engine->exhaustVelocity, exhaustVelocity, MPFR_RNDN);
+
+        auto users = engineUsers.find(engine);
+        if (users != nullptr) {
+            for (auto &shipStages : *users) {
+                shipStages.first->engineExhaustVelocityChanged(shipStages.second);
+            }
+        }
         return 0;
     }
 
     /**
-     * @brief Sets the engine exhaust velocity.
+     * @brief Sets the engine exhaust velocity and marks the stages using it out of date.
      * @param exhaustVelocity To-be exhaust velocity.
      * @param name Name of the engine.
      * @return 0 if successful, 1 if not.
      */
     int setEngineExhaustVelocity(const long double exhaustVelocity, const std::string& name) {
-        try {
-            mpfr_set_ld(engineList.at(name)->exhaustVelocity, exhaustVelocity, MPFR_RNDN);
-        } catch (const std::out_of_range& e) {
+        const EngineId id = findEngineId(name);
+        if (id == invalidEngineId) {
             std::cerr << "[SpaceShipHandler::setEngineExhaustVelocity] Engine " << name << " does not exist." << std::endl;
             return 1;
         }
-        return 0;
+        return setEngineExhaustVelocity(exhaustVelocity, id);
+    }
+
+    // ========== EVALUATION ==========
+    /**
+     * @brief Generates the delta-V of every ship with stale stages, in parallel.
+     * @details Ships are ordered by stale stage count, largest first, and shared out on a work-stealing pool so that
+     *          a few long ships don't leave the other threads idle. Each thread evaluates with its own MpfrScratch
+     *          pool and MPFR caches. Afterwards every ship's getters are plain conversions.
+     * @note The ships must not be used by other threads until this returns. Engine edits from other threads wait
+     *       for the ships being evaluated that use the engine, as usual.
+     * @param threads Number of threads, including the caller. 0 means one per core.
+     * @return Ships and stages evaluated, and the throughput.
+     */
+    EvaluationStats evaluateAll(unsigned threads = 0) {
+        std::vector<SpaceShipWrapper*> ships;
+        {
+            std::lock_guard<std::mutex> lock(shipListMutex);
+            ships = shipList;
+        }
+        std::lock_guard<std::mutex> lock(poolMutex);
+        if (pool == nullptr || (threads != 0 && pool->getThreadCount() != threads)) {
+            pool.reset();
+            pool.reset(new WorkStealingPool(threads));
+        }
+
+        EvaluationStats stats;
+        stats.threads = pool->getThreadCount();
+        std::vector<size_t> order, dirty(ships.size());                     // Read once: engine edits from other
+        for (size_t i = 0; i < ships.size(); i++) {                         // threads may change the counts while
+            dirty[i] = ships[i]->getDirtyStages();                          // this sorts
+            if (dirty[i] != 0) {
+                order.push_back(i);
+                stats.stages += dirty[i];
+            }
+        }
+        stats.ships = order.size();
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return dirty[a] > dirty[b];
+        });
+
+        auto start = std::chrono::steady_clock::now();
+        stats.steals = pool->run(order, [&](size_t i) { ships[i]->getDeltaV(); });
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (stats.seconds > 0) {
+            stats.shipsPerSecond = stats.ships / stats.seconds;
+            stats.stagesPerSecond = stats.stages / stats.seconds;
+        }
+        return stats;
     }
 
     // ========== GETTERS ==========
@@ -119,13 +314,77 @@ public:
      * @return Pointer to the Engine.
      */
     const Engine* getEngine(const std::string& name) {
-        return engineList.at(name);
+        return getEngine(getEngineId(name));
     }
 
+    /**
+     * @brief Gets the engine by id. Errors have to be handled.
+     * @param id Id of the Engine.
+     * @return Pointer to the Engine.
+     */
+    const Engine* getEngine(const EngineId id) {
+        const Engine* engine = engines.get(id);
+        if (engine == nullptr) {
+            throw std::out_of_range("Invalid engine id");
+        }
+        return engine;
+    }
+
+    /**
+     * @brief Gets the id of an engine by name, for importing. Errors have to be handled.
+     * @param name Name of the Engine.
+     * @return Id of the Engine.
+     */
+    EngineId getEngineId(const std::string& name) {
+        const EngineId id = findEngineId(name);
+        if (id == invalidEngineId) {
+            throw std::out_of_range("Invalid engine name");
+        }
+        return id;
+    }
+
+    /**
+     * @brief Gets the number of engines. Valid ids are [0, getEngineCount()).
+     * @return Number of engines.
+     */
+    uint32_t getEngineCount() const {
+        return engines.size();
+    }
+
+    /**
+     * @brief Gets the ships created by this handler.
+     * @note Not guarded; only use it while no thread is adding ships.
+     * @return Pointer to the ship list.
+     */
     std::vector<SpaceShipWrapper*>* getShipList() {
         return &shipList;
     }
 
+    /**
+     * @brief Gets the precision of ships and engines created by this handler.
+     * @return Precision in bits.
+     */
+    mpfr_prec_t getPrecision() const {
+        return precision;
+    }
+
+protected:
+    NameShard& nameShard(const std::string& name) {
+        return nameShards[std::hash<std::string>()(name) % nameShardCount];
+    }
+
+    /**
+     * @brief Looks up an engine id by name.
+     * @param name Name of the Engine.
+     * @return Id of the Engine, or invalidEngineId if there is none.
+     */
+    EngineId findEngineId(const std::string& name) {
+        NameShard& shard = nameShard(name);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto id = shard.ids.find(name);
+        return id != shard.ids.end() ? id->second : invalidEngineId;
+    }
+
 };
 
 
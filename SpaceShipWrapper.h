@@ -6,25 +6,108 @@
 #include <cstdio>
 #include <mpfr.h>
 #include "SpaceShip.h"
+#include "MpfrScratch.h"
+#include "EngineTable.h"
+#include "iostream"
+#include <stdexcept>
 
 #ifndef IRA_SPACESHIPWRAPPER_H
 #define IRA_SPACESHIPWRAPPER_H
 
+/**
+ * @brief long double interface to SpaceShip.
+ * @details A ship may only be used by one thread at a time. Every public method holds the ship's own
+ *          EngineUsers::ShipGuard, so engine edits made through the handler wait for it to finish if the ship uses
+ *          the engine, and operations on other ships don't wait at all. Don't edit engines from inside a ship
+ *          operation, e.g. from a subclass; see EngineUsers.
+ */
 class SpaceShipWrapper : SpaceShip {
+protected:
+    const EngineTable* engines;                                 /**< Engines by EngineId, if created by a handler. */
+
+    /**
+     * @brief Checks a stage index and a delta-V given to a solver, reporting the problem if any.
+     * @return true if both are valid.
+     */
+    bool checkSolverInput(const char* solver, size_t stageIdx, const long double deltaV) const {
+        if (stageIdx >= stages.size()) {
+            std::cerr << "[SpaceShipWrapper::" << solver << "] Stage " << stageIdx << " does not exist." << std::endl;
+            return false;
+        }
+        if (!(deltaV >= 0) || std::isinf(deltaV)) {
+            std::cerr << "[SpaceShipWrapper::" << solver << "] Delta-V has to be non-negative and finite."
+                      << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Checks the structures and target given to optimal staging, reporting the problem if any.
+     * @return true if they are valid.
+     */
+    bool checkStagingInput(const char* solver, const std::vector<StageStructure>& structures,
+                           const long double target) const {
+        if (structures.empty() || structures.size() > stages.size()) {
+            std::cerr << "[SpaceShipWrapper::" << solver << "] Need a structure for 1 to " << stages.size()
+                      << " stages." << std::endl;
+            return false;
+        }
+        for (size_t i = 0; i < structures.size(); i++) {
+            if (!(structures[i].tankFraction > 0) || !(structures[i].fixedDryMass >= 0)
+                || std::isinf(structures[i].tankFraction) || std::isinf(structures[i].fixedDryMass)) {
+                std::cerr << "[SpaceShipWrapper::" << solver << "] Stage " << i << " needs a positive tank fraction "
+                          << "and a non-negative fixed dry mass." << std::endl;
+                return false;
+            }
+            if (mpfr_sgn(stages[i]->engine->exhaustVelocity) <= 0) {
+                std::cerr << "[SpaceShipWrapper::" << solver << "] Stage " << i << " has no exhaust velocity."
+                          << std::endl;
+                return false;
+            }
+        }
+        if (!(target > 0) || std::isinf(target)) {
+            std::cerr << "[SpaceShipWrapper::" << solver << "] Target has to be positive and finite." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
 public:
+    SpaceShipWrapper() : engines(nullptr) {}
+
+    /**
+     * @brief Constructs a ship whose values, and the temporaries used to set them, have the given precision.
+     * @param precision MPFR precision in bits.
+     * @param engineUsers Reverse engine index the ship registers its stages in (optional).
+     * @param engines Engines by EngineId, needed for the EngineId overloads (optional).
+     */
+    explicit SpaceShipWrapper(mpfr_prec_t precision, EngineUsers* engineUsers = nullptr,
+                              const EngineTable* engines = nullptr)
+            : SpaceShip(precision, engineUsers), engines(engines) {}
 
     // ========== CREATORS ==========
     void addStage(long double dryMass, long double fuelMass, const Engine* engine, int stageIdx = -1) {
-        mpfr_t dryMass_mpfr, fuelMass_mpfr;
-        mpfr_init(dryMass_mpfr);
-        mpfr_init(fuelMass_mpfr);
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        MpfrScratch dryMass_mpfr(precision), fuelMass_mpfr(precision);
         mpfr_set_ld(dryMass_mpfr, dryMass, MPFR_RNDN);
         mpfr_set_ld(fuelMass_mpfr, fuelMass, MPFR_RNDN);
 
         this->SpaceShip::addStage(dryMass_mpfr, fuelMass_mpfr, engine, stageIdx);
+    }
 
-        mpfr_clear(dryMass_mpfr);
-        mpfr_clear(fuelMass_mpfr);
+    void addStage(long double dryMass, long double fuelMass, const EngineId engine, int stageIdx = -1) {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        addStage(dryMass, fuelMass, resolveEngine(engine), stageIdx);
+    }
+
+    /**
+     * @brief Reserves storage so the next count stages of the ship are stored in one contiguous block.
+     * @param count Number of stages that will be added.
+     */
+    void reserveStages(size_t count) {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        SpaceShip::reserveStages(count);
     }
 
     // ========== GETTERS ==========
@@ -33,19 +116,12 @@ public:
     * @brief Returns ld from remaining mass of type mpfr_t.
     * @param stageIdx index of the stage.
     * @return remaining mass of stages above + specified stage.
+    * @note O(1) lookup of the cached suffix mass; only stale stages are re-summed.
     */
     long double getRemainingMass(uint stageIdx) {
-        mpfr_t remainingMass;
-        mpfr_init(remainingMass);
-        mpfr_set_zero(remainingMass, 0);
-        for (long i = getStages()->size() - 1; i >= stageIdx; i--) {                        // don't change to unsigned long
-            mpfr_add(remainingMass, remainingMass, stages[i]->dryMass, MPFR_RNDN);          // as it will cause infinite loop
-            mpfr_add(remainingMass, remainingMass, stages[i]->fuelMass, MPFR_RNDN);         // at stage 0
-            mpfr_add(remainingMass, remainingMass, stages[i]->engine->mass, MPFR_RNDN);
-        }
-        auto result = mpfr_get_ld(remainingMass, MPFR_RNDN);
-        mpfr_clear(remainingMass);
-        return result;
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        genRemainingMass();
+        return mpfr_get_ld(stages[stageIdx]->remainingMass, MPFR_RNDN);
     }
 
     /**
@@ -55,6 +131,7 @@ public:
     * @return Dry mass of the stage.
     */
     long double getStageDryMass(uint stageIdx) {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
         return mpfr_get_ld(stages[stageIdx]->dryMass, MPFR_RNDN);
     }
 
@@ -65,6 +142,7 @@ public:
     * @return Fuel mass of the stage.
     */
     long double getStageFuelMass(uint stageIdx) {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
         return mpfr_get_ld(stages[stageIdx]->fuelMass, MPFR_RNDN);
     }
 
@@ -75,6 +153,8 @@ public:
     * @return Delta-v of the stage.
     */
     long double getStageDeltaV(uint stageIdx) {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        genDeltaV();
         return mpfr_get_ld(stages[stageIdx]->deltaV, MPFR_RNDN);
     }
 
@@ -85,6 +165,7 @@ public:
     * @return Total mass of the stage.
     */
     long double getStageTotalMass(uint stageIdx) {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
         return mpfr_get_ld(stages[stageIdx]->totalMass, MPFR_RNDN);
     }
 
@@ -95,6 +176,7 @@ public:
     * @return Engine mass of the stage.
     */
     long double getStageEngineMass(uint stageIdx) {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
         return mpfr_get_ld(stages[stageIdx]->engine->mass, MPFR_RNDN);
     }
 
@@ -105,6 +187,7 @@ public:
     * @return Exhaust velocity of the stage.
     */
     long double getStageExhaustVelocity(uint stageIdx) {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
         return mpfr_get_ld(stages[stageIdx]->engine->exhaustVelocity, MPFR_RNDN);
     }
 
@@ -113,6 +196,7 @@ public:
      * @return Total mass of the spaceship.
      */
     long double getMass() {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
         return mpfr_get_ld(mass, MPFR_RNDN);
     }
 
@@ -121,13 +205,50 @@ public:
      * @return Total delta-V of the spaceship.
      */
     long double getDeltaV() {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        genDeltaV();
         return mpfr_get_ld(deltaV, MPFR_RNDN);
     }
 
+    /**
+     * @brief Returns the gradient of the total delta-V by every stage's masses and exhaust velocity, from one
+     *        O(n) pass at the ship's precision. See SpaceShip::getDeltaVGradient.
+     * @return Partial derivatives of each stage, with the delta-V they were taken at.
+     */
+    DeltaVGradient getDeltaVGradient() {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        DeltaVGradient gradient;
+        SpaceShip::getDeltaVGradient(gradient);
+        return gradient;
+    }
+
+    /**
+     * @brief Returns the stages, with their delta-V up to date.
+     * @return Vector of stages.
+     */
     const std::vector<Stage*>* getStages() {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        genDeltaV();
         return &stages;
     }
 
+    /**
+     * @brief Returns how many stages have a stale delta-V, which is roughly the work the next evaluation does.
+     * @return Number of stale stages; 0 if the ship is fully evaluated.
+     */
+    size_t getDirtyStages() const {
+        EngineUsers::ShipGuard guard(engineUsers, operations);             // Engine edits mark stages dirty
+        return dirtyStages;
+    }
+
+    /**
+     * @brief Returns the MPFR precision of the ship.
+     * @return Precision in bits.
+     */
+    mpfr_prec_t getPrecision() const {
+        return SpaceShip::getPrecision();
+    }
+
 
     // ========== SETTERS ==========
     //   This is unoptimized from version before SpaceShipHandler merge, but abstraction
@@ -139,11 +260,10 @@ public:
     * @param newMass The new dry mass.
     */
     void setStageDryMass(uint stageIdx, const long double newMass) {
-        mpfr_t newMass_mpfr;
-        mpfr_init(newMass_mpfr);
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        MpfrScratch newMass_mpfr(precision);
         mpfr_set_ld(newMass_mpfr, newMass, MPFR_RNDN);
         SpaceShip::setStageDryMass(stages[stageIdx], newMass_mpfr);
-        mpfr_clear(newMass_mpfr);
     }
 
     /**
@@ -152,30 +272,265 @@ public:
      * @param newMass The new fuel mass.
      */
     void setStageFuelMass(uint stageIdx, const long double newMass) {
-        mpfr_t newMassMPFR;
-        mpfr_init(newMassMPFR);
-        mpfr_set_d(newMassMPFR, newMass, MPFR_RNDN);
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        MpfrScratch newMassMPFR(precision);
+        mpfr_set_ld(newMassMPFR, newMass, MPFR_RNDN);
         SpaceShip::setStageFuelMass(stages[stageIdx], newMassMPFR);
-        mpfr_clear(newMassMPFR);
     }
 
     void setStageEngine(uint stageIdx, const Engine* newEngine) {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
         SpaceShip::setStageEngine(stages[stageIdx], newEngine);
     }
 
+    void setStageEngine(uint stageIdx, const EngineId newEngine) {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        SpaceShip::setStageEngine(stages[stageIdx], resolveEngine(newEngine));
+    }
+
+    /**
+     * @brief Sets how delta-V is generated. EvaluationMode::fast evaluates each stage in long double and only redoes
+     *        the stages whose error bound misses the tolerance in MPFR. EvaluationMode::certified uses interval
+     *        arithmetic at the lowest precision (from 64 bits, doubling) that bounds the total within the tolerance.
+     * @param mode EvaluationMode::exact, EvaluationMode::fast or EvaluationMode::certified.
+     * @param relativeTolerance fast: relative error allowed per stage.
+     * @param absoluteTolerance certified: width allowed for the total, in m/s.
+     */
+    void setEvaluationMode(EvaluationMode mode, long double relativeTolerance = 1e-15,
+                           long double absoluteTolerance = 1e-9) {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        SpaceShip::setEvaluationMode(mode, relativeTolerance, absoluteTolerance);
+    }
+
+    /**
+     * @brief Returns the number of stages the fast path has redone in MPFR.
+     * @return Number of fallbacks.
+     */
+    size_t getFallbackStages() const {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        return SpaceShip::getFallbackStages();
+    }
+
+    /**
+     * @brief Returns a counter that changes whenever a stage or engine of the ship does.
+     * @return Revision of the ship.
+     */
+    size_t getRevision() const {
+        return SpaceShip::getRevision();
+    }
+
+    /**
+     * @brief Lets delta-V of ships with at least minStages stale stages be generated in blocks on a pool of threads.
+     *        Results can differ from the serial evaluation in the last bits, but not between thread counts.
+     * @param pool Pool to run on, or nullptr to evaluate on the calling thread only.
+     * @param minStages Fewest stale stages to split.
+     */
+    void setStagePool(WorkStealingPool* pool, size_t minStages = 1024) {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        SpaceShip::setStagePool(pool, minStages);
+    }
+
+    /**
+     * @brief Computes guaranteed bounds on the delta-V with directed rounding, doubling the working precision from
+     *        startPrecision until the total's interval is narrower than tolerance.
+     * @param tolerance Width the total delta-V interval has to get under, in m/s.
+     * @param startPrecision First working precision, in bits.
+     * @return Bounds, with the precision they needed.
+     */
+    DeltaVBounds certifyDeltaV(long double tolerance, mpfr_prec_t startPrecision = 64) {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        return SpaceShip::certifyDeltaV(tolerance, startPrecision);
+    }
+
+    /**
+     * @brief Returns the bounds from the last evaluation in EvaluationMode::certified.
+     * @return Bounds, with the precision they needed.
+     */
+    const DeltaVBounds& getDeltaVBounds() {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        return SpaceShip::getDeltaVBounds();
+    }
+
+    // ========== SOLVERS ==========
+    /**
+     * @brief Finds the fuel mass that gives a stage a delta-V, with every other stage unchanged. Closed form.
+     * @param stageIdx Index of the stage.
+     * @param deltaV Delta-V the stage should have.
+     * @param fuelMass Set to the fuel mass.
+     * @return 0 if successful, 1 if not.
+     */
+    int solveStageFuelMass(uint stageIdx, const long double deltaV, long double& fuelMass) {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        if (!checkSolverInput("solveStageFuelMass", stageIdx, deltaV)) {
+            return 1;
+        }
+        const long double solution = SpaceShip::solveStageFuelMass(stageIdx, deltaV);
+        if (!std::isfinite(solution)) {
+            std::cerr << "[SpaceShipWrapper::solveStageFuelMass] Stage " << stageIdx << " can't reach " << deltaV
+                      << " m/s." << std::endl;
+            return 1;
+        }
+        fuelMass = solution;
+        return 0;
+    }
+
+    /**
+     * @brief Finds the largest dry mass that lets a stage reach a delta-V with its current fuel. Closed form.
+     * @param stageIdx Index of the stage.
+     * @param deltaV Delta-V the stage should have.
+     * @param dryMass Set to the dry mass budget; infinite if deltaV is 0.
+     * @return 0 if successful, 1 if not or if the stage falls short even with no dry mass.
+     */
+    int solveStageDryMass(uint stageIdx, const long double deltaV, long double& dryMass) {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        if (!checkSolverInput("solveStageDryMass", stageIdx, deltaV)) {
+            return 1;
+        }
+        const long double solution = SpaceShip::solveStageDryMass(stageIdx, deltaV);
+        if (std::isnan(solution) || solution < 0) {
+            std::cerr << "[SpaceShipWrapper::solveStageDryMass] Stage " << stageIdx << " can't reach " << deltaV
+                      << " m/s." << std::endl;
+            return 1;
+        }
+        dryMass = solution;
+        return 0;
+    }
+
+    /**
+     * @brief Finds the fuel mass of every stage for a delta-V per stage, solving from the top down so each stage
+     *        carries the new fuel above it. Closed form.
+     * @param stageDeltaVs Delta-V of each stage, in burn order.
+     * @param fuelMasses Set to the fuel mass of each stage.
+     * @return 0 if successful, 1 if not.
+     */
+    int solveStageFuelMasses(const std::vector<long double>& stageDeltaVs, std::vector<long double>& fuelMasses) {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        if (stageDeltaVs.size() != stages.size()) {
+            std::cerr << "[SpaceShipWrapper::solveStageFuelMasses] Need one delta-V per stage." << std::endl;
+            return 1;
+        }
+        for (size_t i = 0; i < stageDeltaVs.size(); i++) {
+            if (!checkSolverInput("solveStageFuelMasses", i, stageDeltaVs[i])) {
+                return 1;
+            }
+        }
+        SpaceShip::solveStageFuelMasses(stageDeltaVs, fuelMasses);
+        for (size_t i = 0; i < fuelMasses.size(); i++) {
+            if (!std::isfinite(fuelMasses[i])) {
+                std::cerr << "[SpaceShipWrapper::solveStageFuelMasses] Stage " << i << " can't reach "
+                          << stageDeltaVs[i] << " m/s." << std::endl;
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Finds the fuel mass of one stage that gives the ship a total delta-V. See SpaceShip::solveFuelMasses.
+     * @param stageIdx Index of the stage whose fuel varies.
+     * @param totalDeltaV Total delta-V the ship should have.
+     * @param fuelMass Set to the fuel mass; 0 if the ship already reaches totalDeltaV without any.
+     * @return 0 if successful, 1 if not.
+     */
+    int solveFuelMass(uint stageIdx, const long double totalDeltaV, long double& fuelMass) {
+        std::vector<long double> fuelMasses;
+        if (solveFuelMasses(stageIdx, {totalDeltaV}, fuelMasses) != 0) {
+            return 1;
+        }
+        fuelMass = fuelMasses[0];
+        return 0;
+    }
+
+    /**
+     * @brief Finds the fuel mass of one stage that gives the ship each of many total delta-Vs. The stages are read
+     *        once for the whole batch.
+     * @param stageIdx Index of the stage whose fuel varies.
+     * @param totalDeltaVs Total delta-Vs the ship should have.
+     * @param fuelMasses Set to the fuel mass for each total; NaN for totals that can't be reached.
+     * @return 0 if successful, 1 if not or if any total can't be reached.
+     */
+    int solveFuelMasses(uint stageIdx, const std::vector<long double>& totalDeltaVs,
+                        std::vector<long double>& fuelMasses) {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        for (auto &totalDeltaV : totalDeltaVs) {
+            if (!checkSolverInput("solveFuelMasses", stageIdx, totalDeltaV)) {
+                return 1;
+            }
+        }
+        const size_t unreachable = SpaceShip::solveFuelMasses(stageIdx, totalDeltaVs, fuelMasses);
+        if (unreachable != 0) {
+            std::cerr << "[SpaceShipWrapper::solveFuelMasses] " << unreachable << " of " << totalDeltaVs.size()
+                      << " delta-Vs can't be reached." << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Splits fuel over the first stages for the most delta-V at a gross mass, by the classical optimal
+     *        staging conditions, and writes it into the stages. See SpaceShip::optimizeStaging.
+     * @param structures Structure of each optimized stage, in burn order; the stages above them are the payload.
+     * @param grossMass Mass of the whole ship.
+     * @return 0 if successful, 1 if not.
+     */
+    int maximizeStagingDeltaV(const std::vector<StageStructure>& structures, const long double grossMass) {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        if (!checkStagingInput("maximizeStagingDeltaV", structures, grossMass)) {
+            return 1;
+        }
+        return SpaceShip::optimizeStaging(structures, StagingGoal::maximizeDeltaV, grossMass);
+    }
+
+    /**
+     * @brief Splits fuel over the first stages for the least gross mass that reaches a delta-V, by the classical
+     *        optimal staging conditions, and writes it into the stages. See SpaceShip::optimizeStaging.
+     * @param structures Structure of each optimized stage, in burn order; the stages above them are the payload.
+     * @param totalDeltaV Delta-V of the whole ship, payload stages included.
+     * @return 0 if successful, 1 if not.
+     */
+    int minimizeStagingMass(const std::vector<StageStructure>& structures, const long double totalDeltaV) {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        if (!checkStagingInput("minimizeStagingMass", structures, totalDeltaV)) {
+            return 1;
+        }
+        return SpaceShip::optimizeStaging(structures, StagingGoal::minimizeMass, totalDeltaV);
+    }
+
     // ===== MPFR GETTERS =====
     void getRawDeltaV(mpfr_t result) {
-        mpfr_init(result);
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        genDeltaV();
+        mpfr_init2(result, precision);
         mpfr_set(result, deltaV, MPFR_RNDN);
     }
 
     void getRawMass(mpfr_t result) {
-        mpfr_init(result);
+        EngineUsers::ShipGuard guard(engineUsers, operations);
+        mpfr_init2(result, precision);
         mpfr_set(result, mass, MPFR_RNDN);
     }
 
     // ========== MISC ==========
+    /**
+     * @brief Looks up an engine by id in the handler's engine list.
+     * @param id Id of the engine.
+     * @return Pointer to the engine.
+     */
+    const Engine* resolveEngine(const EngineId id) const {
+        const Engine* engine = engines != nullptr ? engines->get(id) : nullptr;
+        if (engine == nullptr) {
+            std::cerr << "[SpaceShipWrapper::resolveEngine] Engine " << id.value << " does not exist." << std::endl;
+            throw std::out_of_range("Invalid engine id");
+        }
+        return engine;
+    }
+
+    /**
+     * @brief Prints the ship and every stage. Linear in the number of stages: delta-V is generated once and every
+     *        per-stage value, including the remaining mass, is a cached lookup.
+     */
     void printStats() {
+        EngineUsers::ShipGuard guard(engineUsers, operations);
         printf("DeltaV: %.32Lf m/s\n", getDeltaV());
         printf("Mass: %.32Lf kg\n", getMass());
         for (uint i = 0; i < stages.size(); i++) {
@@ -10,23 +10,44 @@
 
 
 
-Stage::Stage() {
-    mpfr_init(deltaV);
-    mpfr_init(dryMass);
-    mpfr_init(fuelMass);
-    mpfr_init(totalMass);
+template <typename Backend>
+BasicStage<Backend>::BasicStage(const Backend& backend) {
+    backend.init(deltaV);
+    backend.init(dryMass);
+    backend.init(fuelMass);
+    backend.init(totalMass);
+    backend.init(remainingMass);
+    index = 0;
+    ownsValues = true;
 }
 
-Stage::~Stage() {
-    mpfr_clear(deltaV);
-    mpfr_clear(dryMass);
-    mpfr_clear(fuelMass);
-    mpfr_clear(totalMass);
+template <typename Backend>
+BasicStage<Backend>::BasicStage(const Backend& backend, void* significands) {
+    const size_t size = backend.customSize();
+    typename Backend::storage_type* values[valueCount] = {&deltaV, &dryMass, &fuelMass, &totalMass, &remainingMass};
+    for (int i = 0; i < valueCount; i++) {
+        backend.initCustom(*values[i], static_cast<char*>(significands) + i * size);
+    }
+    index = 0;
+    ownsValues = false;
+}
+
+template <typename Backend>
+BasicStage<Backend>::~BasicStage() {
+    if (!ownsValues) {                                                  // The arena owns the significands
+        return;
+    }
+    Backend::clear(deltaV);
+    Backend::clear(dryMass);
+    Backend::clear(fuelMass);
+    Backend::clear(totalMass);
+    Backend::clear(remainingMass);
     // engine is handled by an engine handler, not this class.
 }
 
 // Copy operations:
-Stage& Stage::operator=(const Stage& other) {
+template <typename Backend>
+BasicStage<Backend>& BasicStage<Backend>::operator=(const BasicStage& other) {
     // This before just for more chances to catch this error.
     if (other.engine == nullptr) {
         std::cerr << "[Stage::operator=] Move invalid. Check engine handler." << std::endl;
@@ -36,34 +57,37 @@ Stage& Stage::operator=(const Stage& other) {
         return *this;
     }
 
-    mpfr_set(deltaV, other.deltaV, MPFR_RNDN);                          // Make sure that the underlying mpfr_t values
-    mpfr_set(dryMass, other.dryMass, MPFR_RNDN);                        // are copied instead of just the pointers
-    mpfr_set(fuelMass, other.fuelMass, MPFR_RNDN);
-    mpfr_set(totalMass, other.totalMass, MPFR_RNDN);
+    Backend::copy(deltaV, other.deltaV);                                // Make sure that the underlying values
+    Backend::copy(dryMass, other.dryMass);                              // are copied instead of just the pointers
+    Backend::copy(fuelMass, other.fuelMass);
+    Backend::copy(totalMass, other.totalMass);
+    Backend::copy(remainingMass, other.remainingMass);
 
     engine = other.engine;                                              // Engine handler's job to keep this valid
+    index = other.index;
 
     return *this;
 }
-Stage::Stage(const Stage& other) {
+template <typename Backend>
+BasicStage<Backend>::BasicStage(const BasicStage& other) {
     if (other.engine == nullptr) {
         std::cerr << "[Stage::operator=] Move invalid. Check engine handler." << std::endl;
         throw std::runtime_error("Null pointer exception");
     }
-    mpfr_init(deltaV);                                                  // Make sure that the underlying mpfr_t values
-    mpfr_init(dryMass);                                                 // are copied instead of just the pointers.
-    mpfr_init(fuelMass);                                                // This is effectively the same as the
-    mpfr_init(totalMass);                                               // move operator above, but also initializes
-    mpfr_set(deltaV, other.deltaV, MPFR_RNDN);                          // the mpfr_t values.
-    mpfr_set(dryMass, other.dryMass, MPFR_RNDN);
-    mpfr_set(fuelMass, other.fuelMass, MPFR_RNDN);
-    mpfr_set(totalMass, other.totalMass, MPFR_RNDN);
+    Backend::initCopy(deltaV, other.deltaV);                            // Make sure that the underlying values
+    Backend::initCopy(dryMass, other.dryMass);                          // are copied instead of just the pointers.
+    Backend::initCopy(fuelMass, other.fuelMass);                        // This is effectively the same as the
+    Backend::initCopy(totalMass, other.totalMass);                      // copy assignment above, but also
+    Backend::initCopy(remainingMass, other.remainingMass);              // initializes the values.
 
     engine = other.engine;                                              // Engine handler's job to keep this valid
+    index = other.index;
+    ownsValues = true;
 }
 
 // Move operations:
-Stage& Stage::operator=(Stage&& other) noexcept {
+template <typename Backend>
+BasicStage<Backend>& BasicStage<Backend>::operator=(BasicStage&& other) noexcept {
     // should only be in debugging, so exception here should be removed after.
     if (other.engine == nullptr) {
         std::cerr << "[Stage::operator=] Move invalid. Check engine handler." << std::endl;
@@ -74,23 +98,38 @@ Stage& Stage::operator=(Stage&& other) noexcept {
         return *this;                                                   // Handle self-assignment
     }
 
-    deltaV[0] = other.deltaV[0];                                        // Point the new mpfr_t pointers to the data
-    dryMass[0] = other.dryMass[0];                                      // of the original object.
-    fuelMass[0] = other.fuelMass[0];
-    totalMass[0] = other.totalMass[0];
+    Backend::move(deltaV, other.deltaV);                                // Point the new values to the data
+    Backend::move(dryMass, other.dryMass);                              // of the original object.
+    Backend::move(fuelMass, other.fuelMass);
+    Backend::move(totalMass, other.totalMass);
+    Backend::move(remainingMass, other.remainingMass);
     engine = other.engine;                                              // Engine handler's job to keep this valid
+    index = other.index;
+    ownsValues = other.ownsValues;
 
     return *this;
 }
-Stage::Stage(Stage&& other) noexcept {
+template <typename Backend>
+BasicStage<Backend>::BasicStage(BasicStage&& other) noexcept {
     // should only be in debugging, so exception here should be removed after.
     if (other.engine == nullptr) {
         std::cerr << "[Stage::operator=] Move invalid. Check engine handler." << std::endl;
         throw std::runtime_error("Null pointer exception");
     }
-    deltaV[0] = other.deltaV[0];
-    dryMass[0] = other.dryMass[0];
-    fuelMass[0] = other.fuelMass[0];
-    totalMass[0] = other.totalMass[0];
+    Backend::move(deltaV, other.deltaV);
+    Backend::move(dryMass, other.dryMass);
+    Backend::move(fuelMass, other.fuelMass);
+    Backend::move(totalMass, other.totalMass);
+    Backend::move(remainingMass, other.remainingMass);
     engine = other.engine;                                              // Engine handler's job to keep this valid
-}
\ No newline at end of file
+    index = other.index;
+    ownsValues = other.ownsValues;
+}
+
+template class BasicStage<DoubleBackend>;
+template class BasicStage<LongDoubleBackend>;
+template class BasicStage<DoubleDoubleBackend>;
+template class BasicStage<MpfrBackend>;
+#ifdef IRA_FLOAT128
+template class BasicStage<Float128Backend>;
+#endif
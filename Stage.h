@@ -9,27 +9,47 @@
 
 
 /**
- * @brief Represents a stage of a spaceship.
+ * @brief Represents a stage of a spaceship, with its values held by a numeric backend.
  *
- * Any loss in non-fuel mass mid-stage will not be accounted for.
+ * Any loss in non-fuel mass mid-stage will not be accounted for. The supported backends are instantiated in
+ * Stage.cpp.
+ * @tparam Backend A numeric backend from NumericBackend.h.
  */
-class Stage {
+template <typename Backend>
+class BasicStage {
 public:
-    const Engine* engine;         /**< Engine used in the stage. */
-    mpfr_t deltaV,                /**< Delta-V of the stage. */
+    const BasicEngine<Backend>* engine;           /**< Engine used in the stage. */
+    size_t index;                 /**< Position of the stage in its ship (0 is the first stage to burn). */
+    typename Backend::storage_type deltaV,        /**< Delta-V of the stage. */
     dryMass,                      /**< Dry mass of the stage (excluding engine mass). */
     fuelMass,                     /**< Fuel mass of the stage. */
-    totalMass;                    /**< Total mass of the stage (including engine mass). */
-
-    Stage();
-    ~Stage();
-
-    Stage& operator=(const Stage& other);
-    Stage(const Stage& other);
-
-    Stage& operator=(Stage&& other) noexcept;
-    Stage(Stage&& other) noexcept;
+    totalMass,                    /**< Total mass of the stage (including engine mass). */
+    remainingMass;                /**< Total mass of this stage and every stage after it. */
+    bool ownsValues;              /**< False if the significands live in a StageArena, which frees them instead. */
+
+    static const int valueCount = 5;  /**< Number of values in a stage. */
+
+    /**
+     * @brief Constructs a stage whose values are initialized by the given backend.
+     * @param backend Numeric backend, which holds the precision for MPFR.
+     */
+    explicit BasicStage(const Backend& backend = Backend());
+    /**
+     * @brief Constructs a stage whose values use caller owned memory, through the MPFR custom interface for MPFR.
+     * @param backend Numeric backend, which holds the precision for MPFR.
+     * @param significands Memory for valueCount significands of backend.customSize() bytes each.
+     */
+    BasicStage(const Backend& backend, void* significands);
+    ~BasicStage();
+
+    BasicStage& operator=(const BasicStage& other);
+    BasicStage(const BasicStage& other);
+
+    BasicStage& operator=(BasicStage&& other) noexcept;
+    BasicStage(BasicStage&& other) noexcept;
 };
 
+typedef BasicStage<MpfrBackend> Stage;
+
 
 #endif //IRA_STAGE_H
@@ -0,0 +1,77 @@
+//
+// Created by user on 6/14/23.
+//
+
+#include "StageArena.h"
+#include <cstddef>
+#include <new>
+
+namespace {
+    const size_t minBlockCapacity = 8;
+
+    size_t alignUp(size_t size, size_t alignment) {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+}
+
+template <typename Backend>
+BasicStageArena<Backend>::BasicStageArena(const Backend& backend) : backend(backend) {
+    slotSize = alignUp(alignUp(sizeof(BasicStage<Backend>), alignof(std::max_align_t))
+                       + BasicStage<Backend>::valueCount * backend.customSize(), alignof(std::max_align_t));
+}
+
+template <typename Backend>
+BasicStageArena<Backend>::~BasicStageArena() {
+    for (auto &block : blocks) {
+        for (size_t i = 0; i < block.used; i++) {
+            reinterpret_cast<BasicStage<Backend>*>(block.memory + i * slotSize)->~BasicStage();
+        }
+        ::operator delete(block.memory);
+    }
+}
+
+template <typename Backend>
+BasicStage<Backend>* BasicStageArena<Backend>::allocate() {
+    if (blocks.empty() || blocks.back().used == blocks.back().capacity) {
+        addBlock(stageCount > minBlockCapacity ? stageCount : minBlockCapacity);   // Geometric growth
+    }
+    Block& block = blocks.back();
+    char* slot = block.memory + block.used * slotSize;
+    block.used++;
+    stageCount++;
+    char* significands = slot + alignUp(sizeof(BasicStage<Backend>), alignof(std::max_align_t));
+    return new (slot) BasicStage<Backend>(backend, significands);
+}
+
+template <typename Backend>
+void BasicStageArena<Backend>::reserve(size_t count) {
+    if (!blocks.empty() && blocks.back().capacity - blocks.back().used >= count) {
+        return;
+    }
+    addBlock(count);
+}
+
+template <typename Backend>
+size_t BasicStageArena<Backend>::allocatedBytes() const {
+    size_t bytes = 0;
+    for (const auto &block : blocks) {
+        bytes += block.capacity * slotSize;
+    }
+    return bytes;
+}
+
+template <typename Backend>
+void BasicStageArena<Backend>::addBlock(size_t capacity) {
+    if (capacity == 0) {
+        return;
+    }
+    blocks.push_back({static_cast<char*>(::operator new(capacity * slotSize)), capacity, 0});
+}
+
+template class BasicStageArena<DoubleBackend>;
+template class BasicStageArena<LongDoubleBackend>;
+template class BasicStageArena<DoubleDoubleBackend>;
+template class BasicStageArena<MpfrBackend>;
+#ifdef IRA_FLOAT128
+template class BasicStageArena<Float128Backend>;
+#endif
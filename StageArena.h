@@ -0,0 +1,70 @@
+//
+// Created by user on 6/14/23.
+//
+
+#include <vector>
+#include <mpfr.h>
+#include "Stage.h"
+
+#ifndef IRA_STAGEARENA_H
+#define IRA_STAGEARENA_H
+
+/**
+ * @brief Contiguous storage for the stages of one ship and the significands of their values.
+ * @details Each slot holds a stage followed by the limbs of its mpfr_t values, which are set up with the MPFR custom
+ *          interface, so walking the stages in order walks memory linearly. Hardware float backends keep their values
+ *          in the stage itself. Blocks are never moved or shrunk, so stage pointers stay valid until the arena is
+ *          destroyed. Reserving the final stage count up front keeps a ship in a single block, which is then freed in
+ *          one go. The supported backends are instantiated in StageArena.cpp.
+ * @tparam Backend A numeric backend from NumericBackend.h.
+ */
+template <typename Backend>
+class BasicStageArena {
+public:
+    /**
+     * @brief Constructs an empty arena.
+     * @param backend Numeric backend of every stage value, which holds the precision for MPFR.
+     */
+    explicit BasicStageArena(const Backend& backend);
+    ~BasicStageArena();
+
+    BasicStageArena(const BasicStageArena& other) = delete;
+    BasicStageArena& operator=(const BasicStageArena& other) = delete;
+
+    /**
+     * @brief Constructs a new stage in the arena.
+     * @return Pointer to the stage, valid until the arena is destroyed.
+     */
+    BasicStage<Backend>* allocate();
+
+    /**
+     * @brief Makes sure the next count stages are allocated from one block.
+     * @param count Number of stages.
+     */
+    void reserve(size_t count);
+
+    /**
+     * @brief Returns the number of bytes the arena has allocated.
+     * @return Allocated bytes.
+     */
+    size_t allocatedBytes() const;
+
+private:
+    struct Block {
+        char* memory;                   /**< Start of the block. */
+        size_t capacity,                /**< Number of slots in the block. */
+        used;                           /**< Number of slots holding a stage. */
+    };
+
+    Backend backend;                    /**< Backend of every stage value. */
+    size_t slotSize;                    /**< Bytes per stage, including its significands. */
+    size_t stageCount = 0;              /**< Number of stages allocated so far. */
+    std::vector<Block> blocks;          /**< Blocks in allocation order. */
+
+    void addBlock(size_t capacity);
+};
+
+typedef BasicStageArena<MpfrBackend> StageArena;
+
+
+#endif //IRA_STAGEARENA_H
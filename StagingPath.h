@@ -0,0 +1,165 @@
+//
+// Created by user on 6/27/23.
+//
+
+#include <vector>
+#include <array>
+#include "NumericBackend.h"
+
+#ifndef IRA_STAGINGPATH_H
+#define IRA_STAGINGPATH_H
+
+/**
+ * @brief The optimally staged ships over a fixed payload, traced by the mass of their top stage.
+ * @details Stage i burns fuel f_i with exhaust velocity c_i and carries a dry mass of k_i + s_i * f_i, k_i holding
+ *          the engine and the part of the structure that doesn't grow with the tanks. With M_i the mass of stages
+ *          [i, n) and the payload,
+ *
+ *              f_i = (M_i - M_{i+1} - k_i) / (1 + s_i),
+ *              deltaV = sum c_i * log(M_i * (1 + s_i) / (s_i * M_i + M_{i+1} + k_i)).
+ *
+ *          Maximizing deltaV for a fixed M_0, or minimizing M_0 for a fixed deltaV, is the classical staging problem:
+ *          its Lagrange conditions are d deltaV / d M_j = 0 for every stage above the first, and the multiplier is
+ *          d deltaV / d M_0. Condition j only ties M_{j-1}, M_j and M_{j+1}, and is linear in M_{j-1}:
+ *
+ *              c_{j-1} / (s_{j-1} * M_{j-1} + M_j + k_{j-1}) = c_j * B_j / (M_j * (s_j * M_j + B_j)) = lambda_j,
+ *              B_j = M_{j+1} + k_j,
+ *
+ *          so picking the top stage's mass gives every stage below it in one explicit pass, ending with the
+ *          multiplier lambda_0. march carries the derivative of every M_j by the top stage's mass along, which is all
+ *          a Newton iteration needs: d M_0 / d top for a gross mass target, and lambda_0 * d M_0 / d top for a
+ *          delta-V target, since every other partial is 0 on the path.
+ *
+ *          Masses below a top stage that is too light come out negative, and the values downstream of them are
+ *          meaningless; check fuels before using a pass.
+ * @tparam Backend A numeric backend from NumericBackend.h.
+ */
+template <typename Backend>
+class StagingPath {
+public:
+    typedef typename Backend::value_type value_type;
+
+    std::vector<value_type> velocities,         /**< c_i, exhaust velocity of each stage. */
+    fractions,                                  /**< s_i, dry mass added per unit of fuel. Has to be positive. */
+    fixedMasses;                                /**< k_i, engine and fixed dry mass of each stage. */
+    value_type payload;                         /**< Mass above the top stage. */
+
+    std::vector<value_type> masses,             /**< [i] is M_i, the mass of stages [i, n) and the payload. */
+    slopes,                                     /**< [i] is d M_i / d M_{n-1}. */
+    fuels;                                      /**< f_i, fuel of each stage. */
+    value_type deltaV,                          /**< Delta-V of the stages, if the last march summed it. */
+    deltaVSlope,                                /**< d deltaV / d M_{n-1}. */
+    multiplier;                                 /**< lambda_0 = d deltaV / d M_0. */
+
+    StagingPath(const Backend& backend, size_t stageCount) : backend(backend), stageCount(stageCount) {
+        for (auto* values : {&velocities, &fractions, &fixedMasses, &fuels}) {
+            values->resize(stageCount);
+        }
+        masses.resize(stageCount + 1);
+        slopes.resize(stageCount + 1);
+        for (auto* values : columns()) {
+            for (auto &value : *values) {
+                backend.init(value);
+            }
+        }
+        for (auto* value : scalars()) {
+            backend.init(*value);
+        }
+        backend.set(one, 1);
+    }
+    ~StagingPath() {
+        for (auto* values : columns()) {
+            for (auto &value : *values) {
+                backend.clear(value);
+            }
+        }
+        for (auto* value : scalars()) {
+            backend.clear(*value);
+        }
+    }
+
+    StagingPath(const StagingPath& other) = delete;
+    StagingPath& operator=(const StagingPath& other) = delete;
+
+    /**
+     * @brief Stages every stage below a top stage by the Lagrange conditions.
+     * @param top Mass of the top stage and the payload, M_{n-1}.
+     * @param withDeltaV Whether to sum deltaV too, one log1p per stage. Everything else is set either way.
+     */
+    void march(const value_type& top, bool withDeltaV = true) {
+        const size_t n = stageCount;
+        backend.copy(masses[n], payload);
+        backend.set(slopes[n], 0);
+        backend.copy(masses[n - 1], top);
+        backend.set(slopes[n - 1], 1);
+        for (size_t j = n - 1; j > 0; j--) {
+            lagrange(j);
+            backend.div(ratio, velocities[j - 1], multiplier);                   // M_{j-1} = (c_{j-1} / lambda_j
+            backend.sub(masses[j - 1], ratio, masses[j]);                        //     - M_j - k_{j-1}) / s_{j-1}
+            backend.sub(masses[j - 1], masses[j - 1], fixedMasses[j - 1]);
+            backend.div(masses[j - 1], masses[j - 1], fractions[j - 1]);
+
+            backend.mul(term, ratio, multiplierSlope);                           // dM_{j-1} = -(c_{j-1} / lambda_j
+            backend.div(term, term, multiplier);                                 //     * dlambda_j / lambda_j
+            backend.add(term, term, slopes[j]);                                  //     + dM_j) / s_{j-1}
+            backend.div(term, term, fractions[j - 1]);
+            backend.sub(slopes[j - 1], zero, term);
+        }
+        lagrange(0);
+        backend.mul(deltaVSlope, multiplier, slopes[0]);
+
+        backend.set(deltaV, 0);
+        for (size_t i = 0; i < n; i++) {
+            backend.sub(fuels[i], masses[i], masses[i + 1]);                     // f_i = (M_i - M_{i+1} - k_i)
+            backend.sub(fuels[i], fuels[i], fixedMasses[i]);                     //     / (1 + s_i)
+            backend.add(term, one, fractions[i]);
+            backend.div(fuels[i], fuels[i], term);
+            if (!withDeltaV) {
+                continue;
+            }
+            backend.sub(term, masses[i], fuels[i]);
+            rocketDeltaV(backend, ratio, fuels[i], term, velocities[i]);
+            backend.add(deltaV, deltaV, ratio);
+        }
+    }
+
+private:
+    Backend backend;
+    size_t stageCount;
+    value_type one, zero, base, stack, product, ratio, term, multiplierSlope;
+
+    std::array<std::vector<value_type>*, 6> columns() {
+        return {&velocities, &fractions, &fixedMasses, &masses, &slopes, &fuels};
+    }
+    std::array<value_type*, 12> scalars() {
+        return {&payload, &deltaV, &deltaVSlope, &multiplier, &one, &zero, &base, &stack, &product, &ratio, &term,
+                &multiplierSlope};
+    }
+
+    /**
+     * @brief Sets multiplier to lambda_j = d deltaV_j / d M_j and multiplierSlope to its derivative by the top
+     *        stage's mass, from M_j and M_{j+1}.
+     */
+    void lagrange(size_t j) {
+        backend.add(base, masses[j + 1], fixedMasses[j]);                        // B = M_{j+1} + k_j
+        backend.mul(stack, fractions[j], masses[j]);                             // S = s_j * M_j + B
+        backend.add(stack, stack, base);
+        backend.mul(product, masses[j], stack);                                  // D = M_j * S
+        backend.mul(multiplier, velocities[j], base);                            // lambda = c_j * B / D
+        backend.div(multiplier, multiplier, product);
+
+        // dlambda = lambda * (dB / B - dD / D), dD = dM_j * (S + s_j * M_j) + M_j * dB
+        backend.mul(term, fractions[j], masses[j]);
+        backend.add(term, term, stack);
+        backend.mul(term, term, slopes[j]);
+        backend.mul(ratio, masses[j], slopes[j + 1]);
+        backend.add(term, term, ratio);
+        backend.div(term, term, product);
+        backend.div(ratio, slopes[j + 1], base);
+        backend.sub(term, ratio, term);
+        backend.mul(multiplierSlope, multiplier, term);
+    }
+};
+
+
+#endif //IRA_STAGINGPATH_H
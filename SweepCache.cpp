@@ -0,0 +1,112 @@
+//
+// Created by user on 6/23/23.
+//
+
+#include "SweepCache.h"
+#include "MpfrScratch.h"
+#include "NumericBackend.h"
+#include <functional>
+#include <stdexcept>
+
+size_t SweepCache::KeyHash::operator()(const Key& key) const {
+    size_t hash = std::hash<size_t>()(key.parent);                          // boost::hash_combine
+    for (size_t part : {std::hash<long double>()(key.dryMass), std::hash<long double>()(key.fuelMass),
+                        std::hash<const Engine*>()(key.engine)}) {
+        hash ^= part + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+    }
+    return hash;
+}
+
+SweepCache::SweepCache(mpfr_prec_t precision) : precision(precision), arena(new StageArena(MpfrBackend(precision))) {}
+
+SweepCache::~SweepCache() {
+    for (auto &deltaV : stackDeltaVs) {
+        mpfr_clear(&deltaV);
+    }
+    // node stages are destroyed and freed with the arena.
+}
+
+void SweepCache::evaluate(const std::vector<SweepStage>& candidate, mpfr_t result) {
+    size_t node = root;
+    for (size_t i = candidate.size(); i-- > 0;) {                           // top down
+        node = child(node, candidate[i]);
+    }
+    if (node == root) {
+        mpfr_set_zero(result, 0);
+        return;
+    }
+    mpfr_set(result, &stackDeltaVs[node], MPFR_RNDN);
+}
+
+long double SweepCache::evaluate(const std::vector<SweepStage>& candidate) {
+    MpfrScratch result(precision);
+    evaluate(candidate, result);
+    return mpfr_get_ld(result, MPFR_RNDN);
+}
+
+size_t SweepCache::child(size_t parent, const SweepStage& stage) {
+    if (stage.engine == nullptr) {
+        throw std::runtime_error("Null pointer exception");
+    }
+    const Key key = {parent, stage.dryMass, stage.fuelMass, stage.engine};
+    auto found = children.find(key);
+    if (found != children.end()) {
+        stagesReused++;
+        return found->second;
+    }
+
+    Stage* node = arena->allocate();
+    node->engine = stage.engine;
+    node->index = parent == root ? 0 : nodes[parent]->index + 1;
+    mpfr_set_ld(node->dryMass, stage.dryMass, MPFR_RNDN);
+    mpfr_set_ld(node->fuelMass, stage.fuelMass, MPFR_RNDN);
+    mpfr_add(node->totalMass, node->dryMass, node->fuelMass, MPFR_RNDN);               // Same operations as
+    mpfr_add(node->totalMass, node->totalMass, stage.engine->mass, MPFR_RNDN);         // SpaceShip, so the stage
+    if (parent == root) {                                                               // values match exactly.
+        mpfr_set(node->remainingMass, node->totalMass, MPFR_RNDN);
+    } else {
+        mpfr_add(node->remainingMass, nodes[parent]->remainingMass, node->totalMass, MPFR_RNDN);
+    }
+    MpfrScratch rest(precision);                                                        // rest = dry + engine
+    mpfr_add(rest, node->dryMass, stage.engine->mass, MPFR_RNDN);                       //     + parent's remaining
+    if (parent != root) {
+        mpfr_add(rest, rest, nodes[parent]->remainingMass, MPFR_RNDN);
+    }
+    rocketDeltaV(MpfrBackend(precision), node->deltaV, node->fuelMass, rest, stage.engine->exhaustVelocity);
+
+    stackDeltaVs.emplace_back();
+    mpfr_ptr stackDeltaV = &stackDeltaVs.back();
+    mpfr_init2(stackDeltaV, precision);
+    if (parent == root) {
+        mpfr_set(stackDeltaV, node->deltaV, MPFR_RNDN);
+    } else {
+        mpfr_add(stackDeltaV, &stackDeltaVs[parent], node->deltaV, MPFR_RNDN);
+    }
+
+    nodes.push_back(node);
+    children.insert({key, nodes.size() - 1});
+    stagesEvaluated++;
+    return nodes.size() - 1;
+}
+
+void SweepCache::clear() {
+    for (auto &deltaV : stackDeltaVs) {
+        mpfr_clear(&deltaV);
+    }
+    stackDeltaVs.clear();
+    nodes.clear();
+    children.clear();
+    arena.reset(new StageArena(MpfrBackend(precision)));
+}
+
+size_t SweepCache::getNodeCount() const {
+    return nodes.size();
+}
+
+size_t SweepCache::getStagesEvaluated() const {
+    return stagesEvaluated;
+}
+
+size_t SweepCache::getStagesReused() const {
+    return stagesReused;
+}
@@ -0,0 +1,122 @@
+//
+// Created by user on 6/23/23.
+//
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <mpfr.h>
+#include "Stage.h"
+#include "Engine.h"
+#include "StageArena.h"
+
+#ifndef IRA_SWEEPCACHE_H
+#define IRA_SWEEPCACHE_H
+
+/**
+ * @brief One stage of a sweep candidate.
+ */
+struct SweepStage {
+    long double dryMass;
+    long double fuelMass;
+    const Engine* engine;
+};
+
+/**
+ * @brief Evaluates the delta-V of many candidate ships, reusing the work for upper stacks they have in common.
+ * @details A stage's delta-V only depends on itself and the stages above it, so candidates are stored as a trie from
+ *          the top stage down. Each node is a Stage holding the remaining mass and delta-V of that stage on top of its
+ *          parent's stack, plus the delta-V of the whole stack. A candidate only evaluates the stages below the
+ *          longest upper stack already in the trie; for a trade study that keeps the upper stages and varies the
+ *          boosters, that is the boosters alone.
+ *
+ *          Stage values are computed exactly as SpaceShip does in EvaluationMode::exact. The total is summed from the
+ *          top down instead of from the bottom up, so it can differ from SpaceShip's in the last bits.
+ * @note Engines are matched by pointer and their values are read once, when a node is created. Call clear after
+ *       editing an engine the cache has seen.
+ */
+class SweepCache {
+public:
+    /**
+     * @brief Constructs an empty cache.
+     * @param precision MPFR precision of every cached value.
+     */
+    explicit SweepCache(mpfr_prec_t precision);
+    ~SweepCache();
+
+    SweepCache(const SweepCache& other) = delete;
+    SweepCache& operator=(const SweepCache& other) = delete;
+
+    /**
+     * @brief Computes the delta-V of a candidate.
+     * @param candidate Stages in burn order (0 is the first to burn), like a ship's.
+     * @param result Initialized mpfr_t to store the total delta-V in.
+     */
+    void evaluate(const std::vector<SweepStage>& candidate, mpfr_t result);
+
+    /**
+     * @brief Computes the delta-V of a candidate.
+     * @param candidate Stages in burn order (0 is the first to burn), like a ship's.
+     * @return Total delta-V of the candidate.
+     */
+    long double evaluate(const std::vector<SweepStage>& candidate);
+
+    /**
+     * @brief Frees every node. Needed after editing an engine the cache has seen.
+     */
+    void clear();
+
+    /**
+     * @brief Returns the number of distinct upper stacks cached.
+     * @return Number of trie nodes.
+     */
+    size_t getNodeCount() const;
+
+    /**
+     * @brief Returns how many stages evaluate has computed since construction.
+     * @return Number of stages evaluated.
+     */
+    size_t getStagesEvaluated() const;
+
+    /**
+     * @brief Returns how many stages evaluate has found in the trie instead of computing.
+     * @return Number of stages reused.
+     */
+    size_t getStagesReused() const;
+
+private:
+    struct Key {
+        size_t parent;
+        long double dryMass, fuelMass;
+        const Engine* engine;
+
+        bool operator==(const Key& other) const {
+            return parent == other.parent && dryMass == other.dryMass && fuelMass == other.fuelMass
+                   && engine == other.engine;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+
+    static const size_t root = (size_t) -1;     /**< Parent of the top stages. */
+
+    mpfr_prec_t precision;                                  /**< Precision of every cached value. */
+    std::unique_ptr<StageArena> arena;                      /**< Storage for the nodes' stages. */
+    std::vector<Stage*> nodes;                              /**< Node stages. Stage::index is the depth below the
+                                                                 top, remainingMass includes every stage above. */
+    std::vector<__mpfr_struct> stackDeltaVs;                /**< Delta-V of each node's stage and all above it. */
+    std::unordered_map<Key, size_t, KeyHash> children;     /**< Node by parent and stage. */
+    size_t stagesEvaluated = 0;
+    size_t stagesReused = 0;
+
+    /**
+     * @brief Finds the node for a stage on top of parent's stack, creating and evaluating it if needed.
+     * @return Index of the node.
+     */
+    size_t child(size_t parent, const SweepStage& stage);
+};
+
+
+#endif //IRA_SWEEPCACHE_H
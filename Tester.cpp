@@ -2,10 +2,30 @@
 #include <iostream>
 #include <random>
 #include <cstdlib>
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include <algorithm>
 #include "SpaceShipHandler.h"
+#include "MpfrScratch.h"
+#include "BasicShip.h"
+#include "DeltaVBatch.h"
+#include "SweepCache.h"
+#include "DesignSweep.h"
+#include "EngineAssignment.h"
+#include "RefuelAnalysis.h"
+#include "QuantileSketch.h"
+#include "MonteCarlo.h"
 #include "catch2/catch_test_macros.hpp"
 #include "catch2/matchers/catch_matchers_floating_point.hpp"
 
+// Catch2 provides main, so the allocation recycling is installed during static initialization, before any test runs.
+static const struct RecycleAllocations {
+    RecycleAllocations() {
+        MpfrScratch::recycleAllocations();
+    }
+} recycleAllocations;
+
 void doubleTest(const mpfr_t mpfrA, const long double b, char* name) {
     long double a = mpfr_get_ld(mpfrA, MPFR_RNDN);
     printf("%20s variance: %30Le\n", name, 100 * (a - b) / a);
@@ -52,6 +72,30 @@ TEST_CASE("Accuracy") {
     }
 }
 
+TEST_CASE("Setter Precision") {
+    std::mt19937 gen(2718);
+    std::uniform_real_distribution<long double> valRange(1, 1'000'000'000.0);
+    SpaceShipHandler handler(256);
+    handler.createEngine("P", valRange(gen), valRange(gen));
+    auto* ship = handler.addShip();
+    for (int i = 0; i < 100; i++) {
+        const long double dryMass = valRange(gen),                          // One long double ulp above a double
+                          fuelMass = std::nextafter((long double) (double) valRange(gen), HUGE_VALL);
+        REQUIRE(fuelMass != (double) fuelMass);
+        auto* built = handler.addShip();
+        built->addStage(dryMass, fuelMass, handler.getEngine("P"));
+        if (i == 0) {
+            ship->addStage(1, 1, handler.getEngine("P"));
+        }
+        ship->setStageDryMass(0, dryMass);                                  // Setters keep every bit of a long
+        ship->setStageFuelMass(0, fuelMass);                                // double, like addStage
+        CHECK(ship->getStageDryMass(0) == dryMass);
+        CHECK(ship->getStageFuelMass(0) == fuelMass);
+        CHECK(ship->getDeltaV() == built->getDeltaV());
+        handler.removeShip(built);
+    }
+}
+
 TEST_CASE("Runtime Errors") {
     SpaceShipHandler handler(1024);
     std::vector<int> stages;
@@ -270,4 +314,1337 @@ TEST_CASE("Crazy") {
 //}
         mpfr_free_cache();
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE("Incremental DeltaV") {
+    std::mt19937 gen(1337);
+    std::uniform_real_distribution<long double> valRange(1, 1'000'000'000.0);
+    std::uniform_int_distribution<uint> stageRange(10, 30);
+
+    for (int j = 0; j < 20; j++) {
+        SpaceShipHandler handler(1024);
+        auto* ship = handler.addShip();
+        const uint stageCount = stageRange(gen);
+        std::uniform_int_distribution<uint> stagePick(0, stageCount - 1);
+        std::uniform_int_distribution<uint> enginePick(0, stageCount - 1);
+
+        for (uint i = 0; i < stageCount; i++) {
+            std::string name = "I" + std::to_string(i);
+            handler.createEngine(name, valRange(gen), valRange(gen));
+            ship->addStage(valRange(gen), valRange(gen), handler.getEngine(name));
+        }
+        for (uint i = 0; i < 3 * stageCount; i++) {                        // Single stage what-if edits
+            const uint stageIdx = stagePick(gen);
+            switch (i % 4) {
+                case 0: ship->setStageDryMass(stageIdx, valRange(gen)); break;
+                case 1: ship->setStageFuelMass(stageIdx, valRange(gen)); break;
+                case 2: ship->setStageEngine(stageIdx, handler.getEngine("I" + std::to_string(enginePick(gen)))); break;
+                default: {
+                    ship->addStage(valRange(gen), valRange(gen), handler.getEngine("I0"), stageIdx);
+                    stagePick = std::uniform_int_distribution<uint>(0, ship->getStages()->size() - 1);
+                }
+            }
+        }
+
+        auto* rebuilt = handler.addShip();                                  // Same ship, built from scratch
+        for (uint i = 0; i < ship->getStages()->size(); i++) {
+            rebuilt->addStage(ship->getStageDryMass(i), ship->getStageFuelMass(i), (*ship->getStages())[i]->engine);
+        }
+        for (uint i = 0; i < ship->getStages()->size(); i++) {
+            doubleTest((*ship->getStages())[i]->deltaV, rebuilt->getStageDeltaV(i), (char *) "Stage DeltaV");
+            doubleTest((*ship->getStages())[i]->remainingMass, rebuilt->getRemainingMass(i), (char *) "Remaining Mass");
+        }
+        doubleTest(ship->getDeltaV(), rebuilt->getDeltaV(), (char *) "DeltaV");
+    }
+}
+
+TEST_CASE("Deferred Mutations") {
+    std::mt19937 gen(4242);
+    std::uniform_real_distribution<long double> valRange(1, 1'000'000'000.0);
+
+    SpaceShipHandler handler(1024);
+    auto* ship = handler.addShip();
+    auto* deferred = handler.addShip();
+    for (uint i = 0; i < 30; i++) {
+        handler.createEngine("B" + std::to_string(i), valRange(gen), valRange(gen));
+    }
+
+    for (uint i = 0; i < 30; i++) {                                         // ship is read after every mutation,
+        const long double dryMass = valRange(gen), fuelMass = valRange(gen); // deferred only at the end
+        ship->addStage(dryMass, fuelMass, handler.getEngine("B" + std::to_string(i)));
+        deferred->addStage(dryMass, fuelMass, handler.getEngine("B" + std::to_string(i)));
+        ship->getDeltaV();
+    }
+    for (uint i = 0; i < 30; i += 3) {
+        const long double fuelMass = valRange(gen);
+        ship->setStageFuelMass(i, fuelMass);
+        deferred->setStageFuelMass(i, fuelMass);
+        ship->getDeltaV();
+        ship->setStageEngine(i, handler.getEngine("B0"));
+        deferred->setStageEngine(i, handler.getEngine("B0"));
+        ship->getDeltaV();
+    }
+    CHECK(deferred->getDirtyStages() == 30);                                // Nothing generated until a getter
+
+    for (uint i = 0; i < 30; i++) {
+        doubleTest(deferred->getStageDeltaV(i), ship->getStageDeltaV(i), (char *) "Stage DeltaV");
+    }
+    doubleTest(deferred->getDeltaV(), ship->getDeltaV(), (char *) "DeltaV");
+}
+
+TEST_CASE("Mixed Precision") {
+    SpaceShipHandler screening(128);
+    SpaceShipHandler verification(8192);
+    auto* cheap = screening.addShip();
+    auto* exact = verification.addShip();
+
+    screening.createEngine("P", 64958.37813684586060647419003544200678, 3617.40857668100880828454535276250681);
+    verification.createEngine("P", 64958.37813684586060647419003544200678, 3617.40857668100880828454535276250681);
+    cheap->addStage(46381.56737479119504996560863219201565, 3552.14007770645868733438987874251325, screening.getEngine("P"));
+    exact->addStage(46381.56737479119504996560863219201565, 3552.14007770645868733438987874251325, verification.getEngine("P"));
+
+    mpfr_t cheapDeltaV, exactDeltaV;
+    cheap->getRawDeltaV(cheapDeltaV);
+    exact->getRawDeltaV(exactDeltaV);
+    CHECK(mpfr_get_prec(cheapDeltaV) == 128);
+    CHECK(mpfr_get_prec(exactDeltaV) == 8192);
+    CHECK(mpfr_get_prec(screening.getEngine("P")->mass) == 128);
+    CHECK(mpfr_get_prec((*exact->getStages())[0]->remainingMass) == 8192);
+    doubleTest(cheapDeltaV, 113.6054696961617280180871812622258240703610626419, (char *) "128-bit DeltaV");
+    doubleTest(exactDeltaV, 113.6054696961617280180871812622258240703610626419, (char *) "8192-bit DeltaV");
+    mpfr_clear(cheapDeltaV);
+    mpfr_clear(exactDeltaV);
+}
+
+TEST_CASE("Stage Arena") {
+    SpaceShipHandler handler(8192);
+    auto* ship = handler.addShip();
+    handler.createEngine("A", 100000.456153, 456123.15687498453);
+
+    ship->reserveStages(30);
+    for (uint i = 0; i < 30; i++) {
+        ship->addStage(1561.1654893512 + i, 4561312.8564854312, handler.getEngine("A"));
+    }
+    const auto* stages = ship->getStages();
+    const auto stride = (char *) (*stages)[1] - (char *) (*stages)[0];
+    for (uint i = 1; i < 30; i++) {                                         // One block, walked in order
+        CHECK((char *) (*stages)[i] - (char *) (*stages)[i - 1] == stride);
+        CHECK(mpfr_get_prec((*stages)[i]->deltaV) == 8192);
+    }
+
+    ship->addStage(1561.1654893512, 4561312.8564854312, handler.getEngine("A"), 10);   // Spills into a new block
+    doubleTest(ship->getRemainingMass(0), 31 * (1561.1654893512 + 4561312.8564854312 + 100000.456153) + 435,
+               (char *) "Remaining Mass");
+}
+
+TEST_CASE("Steady State Allocations") {
+    std::mt19937 gen(99);
+    std::uniform_real_distribution<long double> valRange(1, 1'000'000'000.0);
+
+    for (long precision : {1024, 8192}) {
+        SpaceShipHandler handler(precision);
+        auto* ship = handler.addShip();
+        std::vector<long double> dryMasses[2], fuelMasses[2];              // Built with the first, edited to the
+        for (uint i = 0; i < 30; i++) {                                     // second and back
+            handler.createEngine("M" + std::to_string(i), valRange(gen), valRange(gen));
+            for (int k = 0; k < 2; k++) {
+                dryMasses[k].push_back(valRange(gen));
+                fuelMasses[k].push_back(valRange(gen));
+            }
+            ship->addStage(dryMasses[0][i], fuelMasses[0][i], handler.getEngine("M" + std::to_string(i)));
+        }
+        auto evaluate = [&]() {                                             // Same values every round, so MPFR's
+            for (int k : {1, 0}) {                                          // working buffers are the same too
+                for (uint i = 0; i < 30; i++) {
+                    ship->setStageDryMass(i, dryMasses[k][i]);
+                    ship->setStageFuelMass(i, fuelMasses[k][i]);
+                    ship->setStageEngine(i, handler.getEngine("M" + std::to_string(k == 1 ? 29 - i : i)));
+                    ship->getDeltaV();
+                    ship->getRemainingMass(i);
+                }
+            }
+        };
+        ship->getDeltaV();                                                  // Start each round from a clean ship
+        evaluate();                                                         // Warm up the scratch pool and caches
+
+        const size_t pooled = MpfrScratch::created();
+        const size_t heapAllocations = MpfrScratch::heapAllocations();
+        evaluate();
+
+        CHECK(MpfrScratch::heapAllocations() == heapAllocations);
+        CHECK(MpfrScratch::created() == pooled);
+    }
+}
+
+TEST_CASE("Engine Edits") {
+    std::mt19937 gen(808);
+    std::uniform_real_distribution<long double> valRange(1, 1'000'000'000.0);
+
+    SpaceShipHandler handler(1024);
+    for (uint i = 0; i < 5; i++) {
+        handler.createEngine("E" + std::to_string(i), valRange(gen), valRange(gen));
+    }
+    std::vector<SpaceShipWrapper*> ships;
+    std::vector<std::vector<uint>> engineChoice;
+    for (uint j = 0; j < 4; j++) {
+        ships.push_back(handler.addShip());
+        engineChoice.emplace_back();
+        for (uint i = 0; i < 20; i++) {
+            engineChoice[j].push_back(gen() % 5);
+            ships[j]->addStage(valRange(gen), valRange(gen), handler.getEngine("E" + std::to_string(engineChoice[j][i])));
+        }
+        ships[j]->getDeltaV();
+    }
+    ships[0]->setStageEngine(3, handler.getEngine("E2"));                   // Index has to follow engine swaps too
+    engineChoice[0][3] = 2;
+    auto* removed = handler.addShip();                                      // Edits must not reach a removed ship
+    removed->addStage(valRange(gen), valRange(gen), handler.getEngine("E2"));
+    CHECK(handler.removeShip(removed) == 0);
+    CHECK(handler.removeShip(removed) == 1);
+    CHECK(handler.getShipList()->size() == 4);
+
+    handler.setEngineDryMass(valRange(gen), "E2");
+    handler.setEngineExhaustVelocity(valRange(gen), "E2");
+    handler.setEngineExhaustVelocity(valRange(gen), "E4");
+
+    SpaceShipHandler fresh(1024);                                           // Same ships, built after the edits
+    for (uint i = 0; i < 5; i++) {
+        auto engine = handler.getEngine("E" + std::to_string(i));
+        fresh.createEngine("E" + std::to_string(i), mpfr_get_ld(engine->mass, MPFR_RNDN),
+                           mpfr_get_ld(engine->exhaustVelocity, MPFR_RNDN));
+    }
+    for (uint j = 0; j < 4; j++) {
+        auto* rebuilt = fresh.addShip();
+        for (uint i = 0; i < 20; i++) {
+            rebuilt->addStage(ships[j]->getStageDryMass(i), ships[j]->getStageFuelMass(i),
+                              fresh.getEngine("E" + std::to_string(engineChoice[j][i])));
+        }
+        doubleTest(ships[j]->getMass(), rebuilt->getMass(), (char *) "Mass");
+        for (uint i = 0; i < 20; i++) {
+            doubleTest(ships[j]->getStageTotalMass(i), rebuilt->getStageTotalMass(i), (char *) "Stage Mass");
+            doubleTest(ships[j]->getStageDeltaV(i), rebuilt->getStageDeltaV(i), (char *) "Stage DeltaV");
+        }
+        doubleTest(ships[j]->getDeltaV(), rebuilt->getDeltaV(), (char *) "DeltaV");
+    }
+}
+
+TEST_CASE("Engine Ids") {
+    SpaceShipHandler handler(1024);
+    const EngineId first = handler.createEngineId("1.1", 100000.456153, 456123.15687498453);
+    const EngineId second = handler.createEngineId("1.2", 64958.37813684586060647419003544200678, 3617.40857668100880828454535276250681);
+    CHECK(first == EngineId(0));
+    CHECK(second == EngineId(1));
+    CHECK(handler.createEngineId("1.1", 1, 1) == invalidEngineId);
+    CHECK(handler.createEngine("1.2", 1, 1) == 1);                          // The status API still reports duplicates
+    CHECK(handler.createEngine("1.3", 1, 1) == 0);
+    CHECK(handler.getEngineId("1.2") == second);
+    CHECK(handler.getEngine(second) == handler.getEngine("1.2"));
+
+    auto* byId = handler.addShip();
+    auto* byName = handler.addShip();
+    byId->addStage(1561.1654893512, 4561312.8564854312, first);
+    byName->addStage(1561.1654893512, 4561312.8564854312, handler.getEngine("1.1"));
+    byId->setStageDryMass(0, 46381.56737479119504996560863219201565);
+    byId->setStageFuelMass(0, 3552.14007770645868733438987874251325);
+    byId->setStageEngine(0, second);
+    doubleTest(byId->getDeltaV(), 113.6054696961617280180871812622258240703610626419, (char *) "DeltaV by id");
+
+    handler.setEngineExhaustVelocity(1000, second);
+    CHECK(handler.setEngineDryMass(1, invalidEngineId) == 1);
+    CHECK_THROWS(byName->setStageEngine(0, (EngineId) 7));
+    doubleTest(byId->getStageExhaustVelocity(0), 1000, (char *) "Exhaust Velocity");
+}
+
+TEST_CASE("Fast Evaluation") {
+    std::mt19937 gen(2718);
+    std::uniform_real_distribution<long double> magnitude(-3, 12);               // Masses over 15 orders of magnitude
+    std::uniform_int_distribution<uint> stageRange(1, 40);
+    auto randomMass = [&]() { return powl(10, magnitude(gen)); };
+
+    for (int j = 0; j < 20; j++) {
+        SpaceShipHandler handler(1024);
+        auto* exact = handler.addShip();
+        auto* fast = handler.addShip();
+        fast->setEvaluationMode(EvaluationMode::fast);
+        const uint stageCount = stageRange(gen);
+        for (uint i = 0; i < stageCount; i++) {
+            std::string name = "F" + std::to_string(i);
+            handler.createEngine(name, randomMass(), randomMass());
+            const long double dryMass = randomMass(), fuelMass = randomMass();
+            exact->addStage(dryMass, fuelMass, handler.getEngine(name));
+            fast->addStage(dryMass, fuelMass, handler.getEngine(name));
+        }
+        for (uint i = 0; i < stageCount; i++) {
+            CHECK_THAT(fast->getStageDeltaV(i), Catch::Matchers::WithinRel((double) exact->getStageDeltaV(i), 1e-15));
+        }
+        CHECK_THAT(fast->getDeltaV(), Catch::Matchers::WithinRel((double) exact->getDeltaV(), 1e-15));
+        CHECK(fast->getFallbackStages() == 0);
+
+        fast->setEvaluationMode(EvaluationMode::fast, 1e-30);                    // Beyond long double, so every
+        for (uint i = 0; i < stageCount; i++) {                                  // stage falls back to MPFR.
+            CHECK(fast->getStageDeltaV(i) == exact->getStageDeltaV(i));
+        }
+        CHECK(fast->getFallbackStages() == stageCount);
+    }
+}
+
+TEST_CASE("Exact Formula") {
+    // The exact path evaluates ve * log1p(fuel / rest) with rest summed from positive terms. It replaced the
+    // original ve * ln(remaining / (remaining - fuel)); both agree to a few units in the last place of the ship's
+    // precision against the original evaluated at four times that.
+    std::mt19937 gen(1729);
+    std::uniform_real_distribution<long double> magnitude(-3, 12);
+    auto randomMass = [&]() { return powl(10, magnitude(gen)); };
+    const mpfr_prec_t precision = 256, referencePrecision = 1024;
+
+    SpaceShipHandler handler(precision);
+    auto* ship = handler.addShip();
+    const uint stageCount = 30;
+    std::vector<long double> dryMasses, fuelMasses, engineMasses, velocities;
+    for (uint i = 0; i < stageCount; i++) {
+        dryMasses.push_back(randomMass());
+        fuelMasses.push_back(i % 5 == 0 ? 1e-3 : randomMass());                // Some stages barely burn
+        engineMasses.push_back(randomMass());
+        velocities.push_back(randomMass());
+        handler.createEngine("X" + std::to_string(i), engineMasses[i], velocities[i]);
+        ship->addStage(dryMasses[i], fuelMasses[i], handler.getEngine("X" + std::to_string(i)));
+    }
+
+    mpfr_t remaining, denominator, expected, actual;
+    for (auto value : {remaining, denominator, expected, actual}) {
+        mpfr_init2(value, referencePrecision);
+    }
+    mpfr_set_zero(remaining, 0);
+    const auto* stages = ship->getStages();
+    for (uint i = stageCount; i-- > 0;) {                                  // ln(m0 / m1) from the top down
+        for (const long double mass : {dryMasses[i], fuelMasses[i], engineMasses[i]}) {
+            mpfr_set_ld(denominator, mass, MPFR_RNDN);
+            mpfr_add(remaining, remaining, denominator, MPFR_RNDN);
+        }
+        mpfr_set_ld(denominator, fuelMasses[i], MPFR_RNDN);
+        mpfr_sub(denominator, remaining, denominator, MPFR_RNDN);
+        mpfr_div(expected, remaining, denominator, MPFR_RNDN);
+        mpfr_log(expected, expected, MPFR_RNDN);
+        mpfr_set_ld(denominator, velocities[i], MPFR_RNDN);
+        mpfr_mul(expected, expected, denominator, MPFR_RNDN);
+
+        mpfr_sub(actual, (*stages)[i]->deltaV, expected, MPFR_RNDN);
+        mpfr_div(actual, actual, expected, MPFR_RNDN);
+        CHECK((mpfr_zero_p(actual) || mpfr_get_exp(actual) <= 3 - precision));   // Under 8 units of 2^-256
+    }
+    for (auto value : {remaining, denominator, expected, actual}) {
+        mpfr_clear(value);
+    }
+}
+
+TEST_CASE("Numeric Backends") {
+    std::mt19937 gen(6174);
+    std::uniform_real_distribution<long double> magnitude(-3, 12);
+    std::uniform_int_distribution<uint> stageRange(1, 40);
+    auto randomMass = [&]() { return powl(10, magnitude(gen)); };
+
+    // Relative error of a backend value against an MPFR reference, computed in MPFR.
+    auto relativeError = [](mpfr_srcptr reference, mpfr_srcptr value) {
+        mpfr_t difference;
+        mpfr_init2(difference, mpfr_get_prec(reference));
+        mpfr_sub(difference, value, reference, MPFR_RNDN);
+        mpfr_div(difference, difference, reference, MPFR_RNDN);
+        const long double error = fabsl(mpfr_get_ld(difference, MPFR_RNDN));
+        mpfr_clear(difference);
+        return error;
+    };
+
+    for (int j = 0; j < 20; j++) {
+        SpaceShipHandler handler(1024);
+        auto* reference = handler.addShip();
+        DoubleShip doubleShip;
+        LongDoubleShip longDoubleShip;
+        DoubleDoubleShip doubleDoubleShip;
+#ifdef IRA_FLOAT128
+        Float128Ship float128Ship;
+#endif
+        const uint stageCount = stageRange(gen);
+        for (uint i = 0; i < stageCount; i++) {
+            std::string name = "N" + std::to_string(i);
+            handler.createEngine(name, randomMass(), randomMass());
+            const long double dryMass = randomMass(), fuelMass = randomMass();
+            reference->addStage(dryMass, fuelMass, handler.getEngine(name));
+            doubleShip.addStage(dryMass, fuelMass, handler.getEngine(name));
+            longDoubleShip.addStage(dryMass, fuelMass, handler.getEngine(name));
+            doubleDoubleShip.addStage(dryMass, fuelMass, handler.getEngine(name));
+#ifdef IRA_FLOAT128
+            float128Ship.addStage(dryMass, fuelMass, handler.getEngine(name));
+#endif
+        }
+        const uint stageIdx = std::uniform_int_distribution<uint>(0, stageCount - 1)(gen);
+        const long double newMass = randomMass();                           // Lazy evaluation works the same way
+        reference->setStageFuelMass(stageIdx, newMass);
+        doubleShip.setStageFuelMass(stageIdx, newMass);
+        longDoubleShip.setStageFuelMass(stageIdx, newMass);
+        doubleDoubleShip.setStageFuelMass(stageIdx, newMass);
+#ifdef IRA_FLOAT128
+        float128Ship.setStageFuelMass(stageIdx, newMass);
+#endif
+        const uint engineIdx = std::uniform_int_distribution<uint>(0, stageCount - 1)(gen);
+        const Engine* newEngine = handler.getEngine("N" + std::to_string(stageIdx));   // Engines are copied in
+        reference->setStageEngine(engineIdx, newEngine);
+        doubleShip.setStageEngine(engineIdx, newEngine);
+        longDoubleShip.setStageEngine(engineIdx, newEngine);
+        doubleDoubleShip.setStageEngine(engineIdx, newEngine);
+#ifdef IRA_FLOAT128
+        float128Ship.setStageEngine(engineIdx, newEngine);
+#endif
+        CHECK(doubleShip.getStageEngineMass(engineIdx) == (double) reference->getStageEngineMass(engineIdx));
+
+        mpfr_t expected, actual;
+        reference->getRawDeltaV(expected);
+        mpfr_init2(actual, 1024);
+
+        mpfr_set_d(actual, doubleShip.getRawDeltaV(), MPFR_RNDN);
+        CHECK(relativeError(expected, actual) < 1e-13);
+        mpfr_set_ld(actual, longDoubleShip.getRawDeltaV(), MPFR_RNDN);
+        CHECK(relativeError(expected, actual) < 1e-16);
+        mpfr_set_d(actual, doubleDoubleShip.getRawDeltaV().hi, MPFR_RNDN);
+        mpfr_add_d(actual, actual, doubleDoubleShip.getRawDeltaV().lo, MPFR_RNDN);
+        CHECK(relativeError(expected, actual) < 1e-28);
+#ifdef IRA_FLOAT128
+        const __float128 quad = float128Ship.getRawDeltaV();                // Split into two long doubles
+        const long double quadHigh = (long double) quad;
+        mpfr_set_ld(actual, quadHigh, MPFR_RNDN);
+        mpfr_t low;
+        mpfr_init2(low, 1024);
+        mpfr_set_ld(low, (long double) (quad - quadHigh), MPFR_RNDN);
+        mpfr_add(actual, actual, low, MPFR_RNDN);
+        mpfr_clear(low);
+        CHECK(relativeError(expected, actual) < 1e-31);
+#endif
+        CHECK_THAT((double) doubleShip.getMass(), Catch::Matchers::WithinRel((double) reference->getMass(), 1e-14));
+        mpfr_clear(expected);
+        mpfr_clear(actual);
+    }
+}
+
+TEST_CASE("Certified Bounds") {
+    std::mt19937 gen(1618);
+    std::uniform_real_distribution<long double> valRange(1, 1'000'000'000.0);
+    std::uniform_int_distribution<uint> stageRange(1, 30);
+
+    for (int j = 0; j < 20; j++) {
+        SpaceShipHandler handler(1024);
+        auto* ship = handler.addShip();
+        auto* certified = handler.addShip();
+        certified->setEvaluationMode(EvaluationMode::certified);
+        const uint stageCount = stageRange(gen);
+        for (uint i = 0; i < stageCount; i++) {
+            std::string name = "C" + std::to_string(i);
+            handler.createEngine(name, valRange(gen), valRange(gen));
+            const long double dryMass = valRange(gen), fuelMass = valRange(gen);
+            ship->addStage(dryMass, fuelMass, handler.getEngine(name));
+            certified->addStage(dryMass, fuelMass, handler.getEngine(name));
+        }
+
+        mpfr_t exact;
+        ship->getRawDeltaV(exact);
+        const DeltaVBounds bounds = ship->certifyDeltaV(1e-6);
+        CHECK(bounds.converged);
+        CHECK(bounds.precision <= 128);
+        CHECK(mpfr_cmp_ld(exact, bounds.lower) >= 0);
+        CHECK(mpfr_cmp_ld(exact, bounds.upper) <= 0);
+        CHECK(bounds.upper - bounds.lower <= 1e-6);
+        for (uint i = 0; i < stageCount; i++) {
+            CHECK(mpfr_cmp_ld((*ship->getStages())[i]->deltaV, bounds.stageLower[i]) >= 0);
+            CHECK(mpfr_cmp_ld((*ship->getStages())[i]->deltaV, bounds.stageUpper[i]) <= 0);
+        }
+
+        const DeltaVBounds tight = ship->certifyDeltaV(1e-250);              // Escalates towards the ship's precision
+        CHECK(tight.converged);
+        CHECK(tight.precision > 128);
+        CHECK(tight.precision <= 1024);
+
+        CHECK(fabsl(certified->getDeltaV() - ship->getDeltaV()) <= 1e-9);
+        CHECK(certified->getDeltaVBounds().converged);
+        CHECK(certified->getDeltaVBounds().precision <= 128);
+        mpfr_clear(exact);
+    }
+}
+
+TEST_CASE("Concurrent Handler") {
+    const int threadCount = 8, enginesPerThread = 40, shipsPerThread = 10, stageCount = 12;
+    SpaceShipHandler handler(256);
+    std::vector<std::vector<SpaceShipWrapper*>> ships(threadCount);
+    std::vector<std::vector<std::vector<std::pair<long double, long double>>>> masses(threadCount);
+    std::vector<std::vector<std::vector<std::string>>> engineNames(threadCount);
+    std::atomic<bool> building(true);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; t++) {
+        threads.emplace_back([&, t]() {
+            std::mt19937 gen(4242 + t);
+            std::uniform_real_distribution<long double> valRange(1, 1'000'000'000.0);
+            for (int i = 0; i < enginesPerThread; i++) {                   // Every thread races on the same names
+                handler.createEngine("C" + std::to_string(i), valRange(gen), valRange(gen));
+            }
+            std::uniform_int_distribution<int> enginePick(0, enginesPerThread - 1);
+            for (int j = 0; j < shipsPerThread; j++) {
+                auto* ship = handler.addShip();
+                ships[t].push_back(ship);
+                masses[t].emplace_back();
+                engineNames[t].emplace_back();
+                for (int i = 0; i < stageCount; i++) {
+                    const long double dryMass = valRange(gen), fuelMass = valRange(gen);
+                    const std::string name = "C" + std::to_string(enginePick(gen));
+                    ship->addStage(dryMass, fuelMass, handler.getEngineId(name));
+                    masses[t].back().emplace_back(dryMass, fuelMass);
+                    engineNames[t].back().push_back(name);
+                    ship->getDeltaV();
+                }
+            }
+        });
+    }
+    std::thread editor([&]() {                                              // Edits engines while ships evaluate
+        std::mt19937 gen(99);
+        std::uniform_real_distribution<long double> valRange(1, 1'000'000'000.0);
+        std::uniform_int_distribution<uint32_t> enginePick(0, enginesPerThread - 1);
+        while (building.load()) {
+            const EngineId id(enginePick(gen));
+            if (id.value < handler.getEngineCount()) {
+                handler.setEngineDryMass(valRange(gen), id);
+                handler.setEngineExhaustVelocity(valRange(gen), id);
+            }
+        }
+    });
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    building.store(false);
+    editor.join();
+
+    REQUIRE(handler.getEngineCount() == enginesPerThread);                 // Duplicates were refused, ids are dense
+    for (EngineId id(0); id.value < handler.getEngineCount(); id.value++) {
+        CHECK(handler.getEngine(id)->id == id);
+        CHECK(handler.getEngineId(handler.getEngine(id)->name) == id);
+    }
+    CHECK(handler.getShipList()->size() == threadCount * shipsPerThread);
+
+    SpaceShipHandler fresh(256);                                            // Same ships, built after the edits
+    for (EngineId id(0); id.value < handler.getEngineCount(); id.value++) {
+        const Engine* engine = handler.getEngine(id);
+        fresh.createEngine(engine->name, mpfr_get_ld(engine->mass, MPFR_RNDN),
+                           mpfr_get_ld(engine->exhaustVelocity, MPFR_RNDN));
+    }
+    for (int t = 0; t < threadCount; t++) {
+        for (int j = 0; j < shipsPerThread; j++) {
+            auto* rebuilt = fresh.addShip();
+            for (int i = 0; i < stageCount; i++) {
+                rebuilt->addStage(masses[t][j][i].first, masses[t][j][i].second, fresh.getEngine(engineNames[t][j][i]));
+            }
+            CHECK_THAT((double) ships[t][j]->getDeltaV(),
+                       Catch::Matchers::WithinRel((double) rebuilt->getDeltaV(), 1e-12));
+        }
+    }
+}
+
+TEST_CASE("Parallel Evaluation") {
+    std::mt19937 gen(31415);
+    std::uniform_real_distribution<long double> valRange(1, 1'000'000'000.0);
+    std::uniform_int_distribution<uint> stageRange(10, 30), insertRange(0, 100);
+    SpaceShipHandler parallel(512), serial(512);
+    for (int i = 0; i < 20; i++) {
+        const long double mass = valRange(gen), exhaustVelocity = valRange(gen);
+        parallel.createEngine("W" + std::to_string(i), mass, exhaustVelocity);
+        serial.createEngine("W" + std::to_string(i), mass, exhaustVelocity);
+    }
+
+    const int shipCount = 60;
+    std::vector<SpaceShipWrapper*> parallelShips, serialShips;
+    for (int j = 0; j < shipCount; j++) {                                   // Very uneven ships, like the generator's
+        parallelShips.push_back(parallel.addShip());
+        serialShips.push_back(serial.addShip());
+        const uint stageCount = stageRange(gen) + (j % 4 == 0 ? insertRange(gen) : 0);
+        for (uint i = 0; i < stageCount; i++) {
+            const long double dryMass = valRange(gen), fuelMass = valRange(gen);
+            const EngineId engine(i % 20);
+            parallelShips.back()->addStage(dryMass, fuelMass, engine);
+            serialShips.back()->addStage(dryMass, fuelMass, engine);
+        }
+    }
+
+    EvaluationStats stats = parallel.evaluateAll(4);
+    CHECK(stats.ships == shipCount);
+    CHECK(stats.threads == 4);
+    for (int j = 0; j < shipCount; j++) {
+        CHECK(parallelShips[j]->getDirtyStages() == 0);
+        CHECK(parallelShips[j]->getDeltaV() == serialShips[j]->getDeltaV());
+    }
+    CHECK(parallel.evaluateAll(4).ships == 0);                              // Nothing stale, nothing to do
+
+    parallel.setEngineExhaustVelocity(1234.5, (EngineId) 3);               // Only ships with 4+ stages use W3
+    serial.setEngineExhaustVelocity(1234.5, (EngineId) 3);
+    parallelShips[7]->setStageDryMass(0, 42);
+    serialShips[7]->setStageDryMass(0, 42);
+    stats = parallel.evaluateAll(3);
+    CHECK(stats.ships == shipCount);
+    CHECK(stats.stages > 0);
+    for (int j = 0; j < shipCount; j++) {
+        CHECK(parallelShips[j]->getDeltaV() == serialShips[j]->getDeltaV());
+    }
+
+    parallel.setEngineDryMass(1, (EngineId) 0);                             // Every ship stale
+    std::atomic<bool> evaluating(true);
+    std::thread editor([&]() {                                              // Engine edits may run alongside
+        for (int k = 0; evaluating.load() || k < 10; k++) {
+            parallel.setEngineDryMass(100 + k % 7, (EngineId) 5);
+        }
+        parallel.setEngineDryMass(777, (EngineId) 5);
+    });
+    parallel.evaluateAll(4);
+    evaluating.store(false);
+    editor.join();
+    serial.setEngineDryMass(1, (EngineId) 0);
+    serial.setEngineDryMass(777, (EngineId) 5);
+    for (int j = 0; j < shipCount; j++) {
+        CHECK(parallelShips[j]->getDeltaV() == serialShips[j]->getDeltaV());
+    }
+}
+
+TEST_CASE("Parallel Stages") {
+    std::mt19937 gen(1729);
+    std::uniform_real_distribution<long double> valRange(1, 1'000'000'000.0);
+    SpaceShipHandler handler(256);
+    for (int i = 0; i < 50; i++) {
+        handler.createEngine("L" + std::to_string(i), valRange(gen), valRange(gen));
+    }
+    WorkStealingPool two(2), four(4);
+    auto* serial = handler.addShip();
+    auto* parallel = handler.addShip();
+    auto* other = handler.addShip();
+    parallel->setStagePool(&four, 500);
+    other->setStagePool(&two, 500);
+
+    const uint stageCount = 3000;                                           // Not a multiple of the block size
+    for (uint i = 0; i < stageCount; i++) {
+        const long double dryMass = valRange(gen), fuelMass = valRange(gen);
+        for (auto* ship : {serial, parallel, other}) {
+            ship->addStage(dryMass, fuelMass, (EngineId) (i % 50));
+        }
+    }
+    auto compare = [&]() {
+        mpfr_t fromFour, fromTwo;
+        parallel->getRawDeltaV(fromFour);
+        other->getRawDeltaV(fromTwo);
+        CHECK(mpfr_equal_p(fromFour, fromTwo));                             // Independent of the thread count
+        mpfr_clear(fromFour);
+        mpfr_clear(fromTwo);
+        CHECK_THAT((double) parallel->getDeltaV(), Catch::Matchers::WithinRel((double) serial->getDeltaV(), 1e-15));
+        for (uint i = 0; i < stageCount; i += 97) {
+            CHECK_THAT((double) parallel->getRemainingMass(i),
+                       Catch::Matchers::WithinRel((double) serial->getRemainingMass(i), 1e-15));
+            CHECK_THAT((double) parallel->getStageDeltaV(i),
+                       Catch::Matchers::WithinRel((double) serial->getStageDeltaV(i), 1e-15));
+        }
+    };
+    compare();
+
+    for (auto* ship : {serial, parallel, other}) {                          // Partly stale, and below the threshold
+        ship->setStageFuelMass(1700, 12345);
+    }
+    compare();
+    for (auto* ship : {serial, parallel, other}) {
+        ship->setStageDryMass(200, 54321);
+    }
+    compare();
+    handler.setEngineDryMass(777, (EngineId) 49);
+    compare();
+    for (auto* ship : {serial, parallel, other}) {
+        ship->setEvaluationMode(EvaluationMode::fast);
+    }
+    compare();
+}
+
+TEST_CASE("Batch Kernel") {
+    std::mt19937 gen(8128);
+    std::uniform_real_distribution<long double> valRange(1, 1'000'000'000.0);
+    std::uniform_int_distribution<uint> stageRange(10, 30);
+    const size_t shipCount = 37;                                            // Leaves a scalar tail on every level
+    const size_t stageCount = stageRange(gen);
+
+    std::vector<double> dry(shipCount * stageCount), fuel(dry.size()), engineMass(dry.size()), velocity(dry.size());
+    for (size_t i = 0; i < dry.size(); i++) {
+        dry[i] = (double) valRange(gen);
+        fuel[i] = i % shipCount == 0 ? 1e-9 : (double) valRange(gen);      // Ship 0 barely burns: log1p(~1e-18)
+        engineMass[i] = (double) valRange(gen);
+        velocity[i] = (double) valRange(gen);
+    }
+
+    SpaceShipHandler handler(256);                                          // Reference values from the MPFR path
+    std::vector<SpaceShipWrapper*> ships;
+    for (size_t j = 0; j < shipCount; j++) {
+        ships.push_back(handler.addShip());
+        for (size_t i = 0; i < stageCount; i++) {
+            const size_t at = i * shipCount + j;
+            const std::string name = "V" + std::to_string(at);
+            handler.createEngine(name, engineMass[at], velocity[at]);
+            ships.back()->addStage(dry[at], fuel[at], handler.getEngine(name));
+        }
+    }
+
+    std::vector<double> stageDeltaVs(dry.size()), deltaVs(shipCount);
+    ShipBatch batch;
+    batch.shipCount = shipCount;
+    batch.stageCount = stageCount;
+    batch.dryMasses = dry.data();
+    batch.fuelMasses = fuel.data();
+    batch.engineMasses = engineMass.data();
+    batch.exhaustVelocities = velocity.data();
+    batch.stageDeltaVs = stageDeltaVs.data();
+    batch.deltaVs = deltaVs.data();
+
+    const SimdLevel best = DeltaVBatch::getSimdLevel();
+    for (SimdLevel level : {SimdLevel::scalar, SimdLevel::avx2, SimdLevel::avx512}) {
+        if (!DeltaVBatch::isSupported(level)) {
+            continue;
+        }
+        CHECK(DeltaVBatch::setSimdLevel(level) == level);
+        std::fill(deltaVs.begin(), deltaVs.end(), 0);                      // Nothing carries over from the
+        std::fill(stageDeltaVs.begin(), stageDeltaVs.end(), 0);            // previous level
+        DeltaVBatch::evaluate(batch);
+        for (size_t j = 0; j < shipCount; j++) {
+            CHECK_THAT(deltaVs[j], Catch::Matchers::WithinRel((double) ships[j]->getDeltaV(), 1e-13));
+            for (size_t i = 0; i < stageCount; i++) {
+                CHECK_THAT(stageDeltaVs[i * shipCount + j],
+                           Catch::Matchers::WithinRel((double) ships[j]->getStageDeltaV(i), 1e-13));
+            }
+        }
+    }
+    DeltaVBatch::setSimdLevel(best);
+    CHECK(DeltaVBatch::getSimdLevel() == best);
+
+    batch.dryMasses = nullptr;
+    CHECK_THROWS(DeltaVBatch::evaluate(batch));
+}
+
+TEST_CASE("Sweep Cache") {
+    std::mt19937 gen(6028);
+    std::uniform_real_distribution<long double> valRange(1, 1'000'000'000.0);
+    std::uniform_int_distribution<uint> boosterRange(1, 3), enginePick(0, 9);
+    SpaceShipHandler handler(256);
+    for (int i = 0; i < 10; i++) {
+        handler.createEngine("T" + std::to_string(i), valRange(gen), valRange(gen));
+    }
+    std::vector<std::vector<SweepStage>> uppers(3);                         // A few fixed upper stacks
+    for (auto &upper : uppers) {
+        for (int i = 0; i < 8; i++) {
+            upper.push_back({valRange(gen), valRange(gen), handler.getEngine((EngineId) enginePick(gen))});
+        }
+    }
+
+    SweepCache cache(256);
+    size_t candidateStages = 0;
+    for (int j = 0; j < 60; j++) {                                          // Boosters vary, uppers repeat
+        std::vector<SweepStage> candidate;
+        const uint boosters = boosterRange(gen);
+        for (uint i = 0; i < boosters; i++) {
+            candidate.push_back({valRange(gen), valRange(gen), handler.getEngine((EngineId) enginePick(gen))});
+        }
+        const auto &upper = uppers[j % uppers.size()];
+        candidate.insert(candidate.end(), upper.begin(), upper.end());
+        candidateStages += candidate.size();
+
+        auto* ship = handler.addShip();
+        for (auto &stage : candidate) {
+            ship->addStage(stage.dryMass, stage.fuelMass, stage.engine);
+        }
+        CHECK_THAT((double) cache.evaluate(candidate), Catch::Matchers::WithinRel((double) ship->getDeltaV(), 1e-15));
+        CHECK(cache.evaluate(candidate) == cache.evaluate(candidate));     // Second lookup is all reuse
+    }
+    CHECK(cache.getNodeCount() == cache.getStagesEvaluated());
+    CHECK(cache.getStagesEvaluated() <= 3 * 8 + 60 * 3);
+    CHECK(cache.getStagesEvaluated() + cache.getStagesReused() == 3 * candidateStages);
+
+    mpfr_t empty;
+    mpfr_init2(empty, 256);
+    cache.evaluate({}, empty);
+    CHECK(mpfr_zero_p(empty));
+    mpfr_clear(empty);
+    cache.clear();
+    CHECK(cache.getNodeCount() == 0);
+    CHECK_THROWS(cache.evaluate({{1, 1, nullptr}}));
+}
+
+namespace {
+    std::string sweepText(DesignSweep& sweep) {
+        FILE* out = tmpfile();
+        REQUIRE(sweep.run(out) == 0);
+        std::string text;
+        rewind(out);
+        for (int c; (c = fgetc(out)) != EOF;) {
+            text += (char) c;
+        }
+        fclose(out);
+        return text;
+    }
+}
+
+TEST_CASE("Design Sweep") {
+    SpaceShipHandler handler(256);
+    const EngineId a = handler.createEngineId("A", 1500, 3000);
+    const EngineId b = handler.createEngineId("B", 900, 3400);
+    const EngineId c = handler.createEngineId("C", 400, 4400);
+
+    std::vector<SweepStageRange> ranges(2);
+    ranges[0] = {10'000, 40'000, 4, 50'000, 90'000, 3, {a, b}};             // 24 booster designs
+    ranges[1] = {2'000, 2'000, 1, 8'000, 8'000, 1, {c}};
+    SweepOptions options;
+    options.threads = 3;
+    options.chunkSize = 5;
+    DesignSweep grid(handler, ranges, options);
+    REQUIRE(grid.getCandidateCount() == 24);
+
+    std::istringstream rows(sweepText(grid));
+    std::string row;
+    std::getline(rows, row);
+    CHECK(row.rfind("candidate,deltaV,mass,", 0) == 0);
+    size_t count = 0;
+    std::vector<SweepStage> candidate;
+    while (std::getline(rows, row)) {
+        size_t index;
+        long double deltaV, mass;
+        REQUIRE(sscanf(row.c_str(), "%zu,%Lg,%Lg", &index, &deltaV, &mass) == 3);
+        CHECK(index == count++);
+        grid.getCandidate(index, candidate);
+        SpaceShipWrapper ship(256);
+        for (auto &stage : candidate) {
+            ship.addStage(stage.dryMass, stage.fuelMass, stage.engine);
+        }
+        CHECK_THAT((double) deltaV, Catch::Matchers::WithinRel((double) ship.getDeltaV(), 1e-15));
+        CHECK_THAT((double) mass, Catch::Matchers::WithinRel((double) ship.getMass(), 1e-15));
+    }
+    CHECK(count == 24);
+    CHECK(handler.getShipList()->empty());                                   // Nothing piles up in the handler
+
+    options.sampling = SweepSampling::latinHypercube;
+    options.samples = 50;
+    options.seed = 7;
+    DesignSweep latin(handler, ranges, options);
+    REQUIRE(latin.getCandidateCount() == 50);
+    std::vector<int> dryStrata(50), fuelStrata(50);
+    for (size_t index = 0; index < 50; index++) {
+        latin.getCandidate(index, candidate);
+        dryStrata[(size_t) ((candidate[0].dryMass - 10'000) / 30'000 * 50)]++;
+        fuelStrata[(size_t) ((candidate[0].fuelMass - 50'000) / 40'000 * 50)]++;
+    }
+    CHECK(std::count(dryStrata.begin(), dryStrata.end(), 1) == 50);         // Each stratum exactly once
+    CHECK(std::count(fuelStrata.begin(), fuelStrata.end(), 1) == 50);
+
+    options.threads = 1;
+    DesignSweep serial(handler, ranges, options);
+    options.threads = 4;
+    DesignSweep parallel(handler, ranges, options);
+    CHECK(sweepText(serial) == sweepText(parallel));
+
+    ranges[1].engines = {EngineId(99)};
+    DesignSweep broken(handler, ranges, options);
+    FILE* brokenOut = tmpfile();
+    CHECK(broken.run(brokenOut) == 1);
+    fclose(brokenOut);
+}
+
+TEST_CASE("Engine Assignment") {
+    std::mt19937 gen(4242);
+    std::uniform_real_distribution<long double> massRange(100, 100'000), velocityRange(1'000, 5'000);
+    for (int j = 0; j < 5; j++) {
+        SpaceShipHandler handler(256);
+        for (int i = 0; i < 6; i++) {
+            handler.createEngine("E" + std::to_string(i), massRange(gen), velocityRange(gen));
+        }
+        const uint stageCount = 4;
+        std::vector<long double> dryMasses, fuelMasses;
+        for (uint i = 0; i < stageCount; i++) {
+            dryMasses.push_back(massRange(gen));
+            fuelMasses.push_back(10 * massRange(gen));
+        }
+
+        std::vector<std::pair<long double, long double>> all;              // Brute force: deltaV, mass
+        for (uint code = 0; code < 6 * 6 * 6 * 6; code++) {
+            SpaceShipWrapper ship(256);
+            for (uint i = 0, rest = code; i < stageCount; i++, rest /= 6) {
+                ship.addStage(dryMasses[i], fuelMasses[i], handler.getEngine((EngineId) (rest % 6)));
+            }
+            all.push_back({ship.getDeltaV(), ship.getMass()});
+        }
+
+        EngineAssignmentSolver solver(handler, dryMasses, fuelMasses);
+        EngineAssignment best;
+        REQUIRE(solver.maximizeDeltaV(best) == 0);
+        long double bestDeltaV = 0;
+        for (auto &result : all) {
+            bestDeltaV = std::max(bestDeltaV, result.first);
+        }
+        CHECK(best.deltaV == bestDeltaV);
+        CHECK(best.engines.size() == stageCount);
+        CHECK(solver.getNodesVisited() < 1 + 6 + 36 + 216 + 1296);
+        CHECK(solver.getCandidatesConfirmed() >= 1);
+
+        const long double target = 0.8L * bestDeltaV;
+        EngineAssignment lightest;
+        REQUIRE(solver.minimizeMass(target, lightest) == 0);
+        long double lightestMass = INFINITY;
+        for (auto &result : all) {
+            if (result.first >= target) {
+                lightestMass = std::min(lightestMass, result.second);
+            }
+        }
+        CHECK(lightest.mass == lightestMass);
+        CHECK(lightest.deltaV >= target);
+
+        CHECK(solver.minimizeMass(2 * bestDeltaV, lightest) == 1);
+    }
+
+    SpaceShipHandler handler(256);
+    handler.createEngine("Only", 1000, 3000);
+    EngineAssignmentSolver missing(handler, {1000, 1000}, {5000, 5000}, {EngineId(0), EngineId(3)});
+    EngineAssignment result;
+    CHECK(missing.maximizeDeltaV(result) == 1);
+    EngineAssignmentSolver mismatched(handler, {1000}, {5000, 5000});
+    CHECK(mismatched.maximizeDeltaV(result) == 1);
+}
+
+TEST_CASE("Refuel Analysis") {
+    std::mt19937 gen(1969);
+    std::uniform_real_distribution<long double> massRange(1'000, 100'000), velocityRange(1'000, 5'000);
+    SpaceShipHandler handler(256);
+    const uint stageCount = 6;
+    std::vector<long double> dryMasses, fuelMasses;
+    std::vector<const Engine*> engines;
+    auto* ship = handler.addShip();
+    for (uint i = 0; i < stageCount; i++) {
+        engines.push_back(handler.getEngine(handler.createEngineId("R" + std::to_string(i), massRange(gen),
+                                                                 velocityRange(gen))));
+        dryMasses.push_back(massRange(gen));
+        fuelMasses.push_back(10 * massRange(gen));
+        ship->addStage(dryMasses[i], fuelMasses[i], engines[i]);
+    }
+    // Stages [first, stageCount) of the ship as a new ship, with extra fuel loaded into one of them.
+    auto upperShip = [&](uint first, uint toppedUp, long double extra) {
+        auto* upper = handler.addShip();
+        for (uint i = first; i < stageCount; i++) {
+            upper->addStage(dryMasses[i], fuelMasses[i] + (i == toppedUp ? extra : 0), engines[i]);
+        }
+        return upper;
+    };
+
+    RefuelAnalysis analysis(ship);
+    RefuelResult result = analysis.evaluate(RefuelScenario());
+    CHECK_THAT((double) result.deltaV, Catch::Matchers::WithinRel((double) ship->getDeltaV(), 1e-15));
+
+    result = analysis.evaluate({{{0, 3, 50'000}}});                         // Refuel on the pad
+    CHECK_THAT((double) result.deltaV,
+               Catch::Matchers::WithinRel((double) upperShip(0, 3, 50'000)->getDeltaV(), 1e-15));
+    CHECK(result.deltaVBefore[0] == 0);
+
+    result = analysis.evaluate({{{2, 2, 20'000}, {2, 4, 30'000}}});         // One depot, two stages
+    auto* upper = upperShip(2, 2, 20'000);
+    upper->setStageFuelMass(2, fuelMasses[4] + 30'000);
+    CHECK_THAT((double) result.deltaVBefore[0],
+               Catch::Matchers::WithinRel((double) (ship->getStageDeltaV(0) + ship->getStageDeltaV(1)), 1e-15));
+    CHECK_THAT((double) result.deltaVAfter[1], Catch::Matchers::WithinRel((double) upper->getDeltaV(), 1e-15));
+    CHECK(result.deltaVBefore[0] == result.deltaVBefore[1]);
+    CHECK(analysis.getStagesEvaluated() == 4 + 3);
+
+    result = analysis.evaluate({{{1, 1, 40'000}, {3, 4, 25'000}}});         // Two depots
+    auto* first = upperShip(1, 1, 40'000);
+    auto* second = upperShip(3, 4, 25'000);
+    const long double expectedBefore = ship->getStageDeltaV(0) + first->getStageDeltaV(0) + first->getStageDeltaV(1);
+    CHECK_THAT((double) result.deltaVBefore[1], Catch::Matchers::WithinRel((double) expectedBefore, 1e-15));
+    CHECK_THAT((double) result.deltaVAfter[1], Catch::Matchers::WithinRel((double) second->getDeltaV(), 1e-15));
+    CHECK_THAT((double) result.deltaV,
+               Catch::Matchers::WithinRel((double) (result.deltaVBefore[0] + result.deltaVAfter[0]), 1e-15));
+
+    std::vector<RefuelScenario> scenarios(500);                             // Batch on a pool matches serial
+    std::uniform_int_distribution<uint> stagePick(0, stageCount - 1);
+    for (auto &scenario : scenarios) {
+        const uint stage = stagePick(gen);
+        scenario.refuels.push_back({std::uniform_int_distribution<uint>(0, stage)(gen), stage, massRange(gen)});
+    }
+    std::vector<RefuelResult> serial, parallel;
+    analysis.evaluate(scenarios, serial);
+    WorkStealingPool pool(3);
+    analysis.evaluate(scenarios, parallel, &pool);
+    REQUIRE(parallel.size() == scenarios.size());
+    for (size_t i = 0; i < scenarios.size(); i++) {
+        CHECK(serial[i].deltaV == parallel[i].deltaV);
+        CHECK(serial[i].deltaVAfter == parallel[i].deltaVAfter);
+    }
+
+    const size_t revision = ship->getRevision();                            // Edits to the ship are picked up
+    ship->setStageDryMass(stageCount - 1, 2 * dryMasses[stageCount - 1]);
+    CHECK(ship->getRevision() != revision);
+    CHECK_THAT((double) analysis.evaluate(RefuelScenario()).deltaV,
+               Catch::Matchers::WithinRel((double) ship->getDeltaV(), 1e-15));
+
+    CHECK_THROWS_AS(analysis.evaluate({{{3, 2, 1}}}), std::out_of_range);
+    CHECK_THROWS_AS(analysis.evaluate({{{0, stageCount, 1}}}), std::out_of_range);
+    CHECK_THROWS(RefuelAnalysis(nullptr));
+}
+
+TEST_CASE("Inverse Solvers") {
+    std::mt19937 gen(1234);
+    std::uniform_real_distribution<long double> massRange(1'000, 100'000), velocityRange(1'000, 5'000);
+    SpaceShipHandler handler(256);
+    const uint stageCount = 5;
+    std::vector<long double> dryMasses, fuelMasses;
+    std::vector<const Engine*> engines;
+    auto* ship = handler.addShip();
+    for (uint i = 0; i < stageCount; i++) {
+        engines.push_back(handler.getEngine(handler.createEngineId("S" + std::to_string(i), massRange(gen),
+                                                                 velocityRange(gen))));
+        dryMasses.push_back(massRange(gen));
+        fuelMasses.push_back(10 * massRange(gen));
+        ship->addStage(dryMasses[i], fuelMasses[i], engines[i]);
+    }
+    // The ship with some masses replaced, built from scratch.
+    auto rebuilt = [&](const std::vector<long double>& dry, const std::vector<long double>& fuel) {
+        auto* copy = handler.addShip();
+        for (uint i = 0; i < stageCount; i++) {
+            copy->addStage(dry[i], fuel[i], engines[i]);
+        }
+        return copy;
+    };
+
+    long double fuel, dry;
+    REQUIRE(ship->solveStageFuelMass(2, 3'000, fuel) == 0);
+    std::vector<long double> fuels = fuelMasses, drys = dryMasses;
+    fuels[2] = fuel;
+    CHECK_THAT((double) rebuilt(drys, fuels)->getStageDeltaV(2), Catch::Matchers::WithinRel(3'000.0, 1e-15));
+
+    REQUIRE(ship->solveStageDryMass(1, 1'000, dry) == 0);
+    drys[1] = dry;
+    CHECK_THAT((double) rebuilt(drys, fuelMasses)->getStageDeltaV(1), Catch::Matchers::WithinRel(1'000.0, 1e-15));
+    CHECK(ship->solveStageDryMass(1, 50'000, dry) == 1);                   // Out of reach with no dry mass at all
+
+    const std::vector<long double> stageTargets = {1'500, 1'200, 900, 2'000, 700};
+    REQUIRE(ship->solveStageFuelMasses(stageTargets, fuels) == 0);
+    auto* sized = rebuilt(dryMasses, fuels);
+    for (uint i = 0; i < stageCount; i++) {
+        CHECK_THAT((double) sized->getStageDeltaV(i), Catch::Matchers::WithinRel((double) stageTargets[i], 1e-15));
+    }
+
+    const long double total = ship->getDeltaV();                            // Vary one stage for the total
+    const std::vector<long double> totals = {1.05L * total, 1.1L * total, 1.5L * total, 0};
+    std::vector<long double> solved;
+    REQUIRE(ship->solveFuelMasses(3, totals, solved) == 0);
+    REQUIRE(solved.size() == totals.size());
+    for (size_t j = 0; j + 1 < totals.size(); j++) {
+        fuels = fuelMasses;
+        fuels[3] = solved[j];
+        CHECK_THAT((double) rebuilt(dryMasses, fuels)->getDeltaV(),
+                   Catch::Matchers::WithinRel((double) totals[j], 1e-15));
+    }
+    CHECK(solved.back() == 0);                                              // Reached with no fuel at all
+    REQUIRE(ship->solveFuelMass(0, total, fuel) == 0);
+    CHECK_THAT((double) fuel, Catch::Matchers::WithinRel((double) fuelMasses[0], 1e-15));
+    CHECK(ship->getDeltaV() == total);                                      // Solvers leave the ship alone
+
+    CHECK(ship->solveStageFuelMass(stageCount, 1'000, fuel) == 1);
+    CHECK(ship->solveFuelMass(0, -1, fuel) == 1);
+    handler.createEngine("Dud", 1'000, 0);
+    auto* dud = handler.addShip();
+    dud->addStage(1'000, 1'000, handler.getEngine("Dud"));
+    CHECK(dud->solveStageFuelMass(0, 100, fuel) == 1);
+    CHECK(dud->solveFuelMass(0, 100, fuel) == 1);
+}
+
+TEST_CASE("Delta-V Gradient") {
+    std::mt19937 gen(271828);
+    std::uniform_real_distribution<long double> massRange(1'000, 100'000), velocityRange(1'000, 5'000);
+    SpaceShipHandler handler(256);
+    const uint stageCount = 7;
+    std::vector<EngineId> engines;
+    auto* ship = handler.addShip();
+    for (uint i = 0; i < stageCount; i++) {                                 // One engine per stage
+        engines.push_back(handler.createEngineId("G" + std::to_string(i), massRange(gen), velocityRange(gen)));
+        ship->addStage(massRange(gen), 10 * massRange(gen), engines[i]);
+    }
+    const DeltaVGradient gradient = ship->getDeltaVGradient();
+    REQUIRE(gradient.dryMass.size() == stageCount);
+    CHECK(gradient.deltaV == ship->getDeltaV());
+
+    // Delta-V only depends on mass ratios, so scaling every mass leaves it alone, and it is linear in every
+    // exhaust velocity: sum(m * d/dm) = 0 and sum(ve * d/dve) = deltaV.
+    long double massSum = 0, massScale = 0, velocitySum = 0;
+    for (uint i = 0; i < stageCount; i++) {
+        const long double terms[] = {ship->getStageDryMass(i) * gradient.dryMass[i],
+                                     ship->getStageFuelMass(i) * gradient.fuelMass[i],
+                                     ship->getStageEngineMass(i) * gradient.engineMass[i]};
+        for (long double term : terms) {
+            massSum += term;
+            massScale += fabsl(term);
+        }
+        velocitySum += ship->getStageExhaustVelocity(i) * gradient.exhaustVelocity[i];
+    }
+    CHECK(fabsl(massSum) < 1e-15 * massScale);
+    CHECK_THAT((double) velocitySum, Catch::Matchers::WithinRel((double) gradient.deltaV, 1e-15));
+
+    // Central differences, which the 256 bit ship resolves far below their own O(h^2) error.
+    auto central = [&](const std::function<void(long double)>& set, long double value) {
+        const long double h = value * 1e-7L;
+        set(value + h);
+        const long double up = ship->getDeltaV();
+        set(value - h);
+        const long double down = ship->getDeltaV();
+        set(value);
+        return (up - down) / (2 * h);
+    };
+    for (uint i : {0u, 3u, stageCount - 1}) {
+        const long double dry = ship->getStageDryMass(i), fuel = ship->getStageFuelMass(i);
+        const long double engineMass = ship->getStageEngineMass(i), velocity = ship->getStageExhaustVelocity(i);
+        CHECK_THAT((double) central([&](long double x) { ship->setStageDryMass(i, x); }, dry),
+                   Catch::Matchers::WithinRel((double) gradient.dryMass[i], 1e-8));
+        CHECK_THAT((double) central([&](long double x) { ship->setStageFuelMass(i, x); }, fuel),
+                   Catch::Matchers::WithinRel((double) gradient.fuelMass[i], 1e-6));  // Set in double
+        CHECK_THAT((double) central([&](long double x) { handler.setEngineDryMass(x, engines[i]); }, engineMass),
+                   Catch::Matchers::WithinRel((double) gradient.engineMass[i], 1e-8));
+        CHECK_THAT((double) central([&](long double x) { handler.setEngineExhaustVelocity(x, engines[i]); },
+                                    velocity),
+                   Catch::Matchers::WithinRel((double) gradient.exhaustVelocity[i], 1e-8));
+    }
+
+    const DeltaVGradient exact = ship->getDeltaVGradient();                 // Same gradient from any mode
+    ship->setEvaluationMode(EvaluationMode::fast);
+    const DeltaVGradient fast = ship->getDeltaVGradient();
+    for (uint i = 0; i < stageCount; i++) {
+        CHECK_THAT((double) fast.exhaustVelocity[i],
+                   Catch::Matchers::WithinRel((double) exact.exhaustVelocity[i], 1e-15));
+        CHECK(fast.fuelMass[i] == exact.fuelMass[i]);
+    }
+}
+
+TEST_CASE("Optimal Staging") {
+    SpaceShipHandler handler(256);
+    const EngineId first = handler.createEngineId("Booster", 8'000, 2'900);
+    const EngineId second = handler.createEngineId("Sustainer", 3'000, 3'300);
+    const EngineId third = handler.createEngineId("Vacuum", 900, 4'400);
+    auto* ship = handler.addShip();
+    for (EngineId engine : {first, second, third}) {
+        ship->addStage(1'000, 1'000, engine);
+    }
+    ship->addStage(4'000, 500, handler.createEngineId("Capsule", 100, 3'000));   // The payload
+    const std::vector<StageStructure> structures = {{3'000, 0.06}, {1'500, 0.08}, {500, 0.1}};
+    const long double grossMass = 600'000;
+
+    REQUIRE(ship->maximizeStagingDeltaV(structures, grossMass) == 0);
+    CHECK_THAT((double) ship->getMass(), Catch::Matchers::WithinRel((double) grossMass, 1e-15));
+    CHECK(ship->getStageFuelMass(3) == 500);
+    for (uint i = 0; i < structures.size(); i++) {
+        CHECK(ship->getStageFuelMass(i) > 0);
+        CHECK_THAT((double) ship->getStageDryMass(i),
+                   Catch::Matchers::WithinRel((double) (structures[i].fixedDryMass
+                                                        + structures[i].tankFraction * ship->getStageFuelMass(i)),
+                                              1e-15));
+    }
+
+    // At the optimum, a unit of gross mass buys the same delta-V in every stage: fuel brings its tanks along.
+    const DeltaVGradient gradient = ship->getDeltaVGradient();
+    std::vector<long double> marginal;
+    for (uint i = 0; i < structures.size(); i++) {
+        const long double s = structures[i].tankFraction;
+        marginal.push_back((gradient.fuelMass[i] + s * gradient.dryMass[i]) / (1 + s));
+    }
+    for (uint i = 1; i < structures.size(); i++) {
+        CHECK_THAT((double) marginal[i], Catch::Matchers::WithinRel((double) marginal[0], 1e-12));
+    }
+
+    // Moving mass between stages at the same gross mass only loses delta-V.
+    const long double best = ship->getDeltaV();
+    std::vector<long double> fuels;
+    for (uint i = 0; i < structures.size(); i++) {
+        fuels.push_back(ship->getStageFuelMass(i));
+    }
+    auto restage = [&](const std::vector<long double>& newFuels) {
+        for (uint i = 0; i < structures.size(); i++) {
+            ship->setStageFuelMass(i, newFuels[i]);
+            ship->setStageDryMass(i, structures[i].fixedDryMass + structures[i].tankFraction * newFuels[i]);
+        }
+    };
+    for (uint from = 0; from < structures.size(); from++) {
+        for (uint to = 0; to < structures.size(); to++) {
+            if (from == to) {
+                continue;
+            }
+            std::vector<long double> moved = fuels;
+            const long double shift = 0.02L * fuels[from];
+            moved[from] -= shift;
+            moved[to] += shift * (1 + structures[from].tankFraction) / (1 + structures[to].tankFraction);
+            restage(moved);
+            CHECK(ship->getDeltaV() < best);
+        }
+    }
+    restage(fuels);
+
+    // The lightest ship reaching that delta-V is the one just found.
+    REQUIRE(ship->minimizeStagingMass(structures, best) == 0);
+    CHECK_THAT((double) ship->getDeltaV(), Catch::Matchers::WithinRel((double) best, 1e-15));
+    CHECK_THAT((double) ship->getMass(), Catch::Matchers::WithinRel((double) grossMass, 1e-12));
+    for (uint i = 0; i < structures.size(); i++) {
+        CHECK_THAT((double) ship->getStageFuelMass(i), Catch::Matchers::WithinRel((double) fuels[i], 1e-10));
+    }
+
+    // A single stage under the payload has nothing to balance: all the spare gross mass is its fuel.
+    REQUIRE(ship->maximizeStagingDeltaV({{3'000, 0.06}}, grossMass) == 0);
+    CHECK_THAT((double) ship->getMass(), Catch::Matchers::WithinRel((double) grossMass, 1e-15));
+
+    // Bad inputs and unreachable targets leave the ship alone.
+    const long double mass = ship->getMass();
+    CHECK(ship->maximizeStagingDeltaV({{3'000, 0}}, grossMass) == 1);
+    CHECK(ship->maximizeStagingDeltaV(std::vector<StageStructure>(5, {0, 0.1}), grossMass) == 1);
+    CHECK(ship->maximizeStagingDeltaV(structures, 10'000) == 1);
+    CHECK(ship->minimizeStagingMass(structures, 1) == 1);
+    CHECK(ship->minimizeStagingMass(structures, 1e6) == 1);
+    CHECK(ship->getMass() == mass);
+}
+
+TEST_CASE("Quantile Sketch") {
+    std::mt19937 gen(4242);
+    std::lognormal_distribution<double> valueRange(8, 1.5);
+    const double accuracy = 1e-3;
+    QuantileSketch sketch(accuracy), low(accuracy), high(accuracy);
+    std::vector<double> values(100'000);
+    for (size_t i = 0; i < values.size(); i++) {
+        values[i] = valueRange(gen);
+        sketch.add(values[i]);
+        (i % 2 == 0 ? low : high).add(values[i]);
+    }
+    std::sort(values.begin(), values.end());
+    REQUIRE(sketch.getCount() == values.size());
+    REQUIRE(low.merge(high) == 0);
+    for (double quantile : {0.0, 0.01, 0.25, 0.5, 0.9, 0.99, 1.0}) {
+        const double exact = values[(size_t) (quantile * (double) (values.size() - 1))];
+        CHECK_THAT(sketch.getQuantile(quantile), Catch::Matchers::WithinRel(exact, accuracy * (1 + 1e-9)));
+        CHECK(low.getQuantile(quantile) == sketch.getQuantile(quantile));  // Merging is exact
+    }
+
+    // Memory follows the range of the values, not their count.
+    const size_t buckets = sketch.getBucketCount();
+    CHECK(buckets <= (size_t) (std::log(values.back() / values.front()) / std::log1p(2 * accuracy)) + 2);
+    for (size_t i = 0; i < values.size(); i++) {
+        sketch.add(values[i]);
+    }
+    CHECK(sketch.getBucketCount() == buckets);
+
+    // Folding keeps the buckets bounded at the expense of the low end only.
+    QuantileSketch folded(0.01, 64);
+    for (double value : values) {
+        folded.add(value);
+    }
+    CHECK(folded.getBucketCount() == 64);
+    CHECK_THAT(folded.getQuantile(1), Catch::Matchers::WithinRel(values.back(), 0.01 * (1 + 1e-9)));
+
+    QuantileSketch zeros;
+    CHECK(std::isnan(zeros.getQuantile(0.5)));
+    zeros.add(0);
+    zeros.add(-1);
+    zeros.add(10);
+    CHECK(zeros.getQuantile(0.5) == 0);
+    CHECK_THAT(zeros.getQuantile(1), Catch::Matchers::WithinRel(10.0, 1e-3));
+    CHECK(zeros.merge(folded) == 1);
+    CHECK_THROWS_AS(QuantileSketch(0), std::out_of_range);
+}
+
+TEST_CASE("Monte Carlo") {
+    SpaceShipHandler handler(256);
+    std::vector<EngineId> engines;
+    auto* ship = handler.addShip();
+    for (uint i = 0; i < 4; i++) {
+        engines.push_back(handler.createEngineId("M" + std::to_string(i), 2'000 + 500 * i, 2'800 + 400 * i));
+        ship->addStage(5'000 + 1'000 * i, 40'000 - 5'000 * i, engines[i]);
+    }
+    const long double nominal = ship->getDeltaV();
+
+    MonteCarloOptions options;
+    options.samples = 10'000;
+    MonteCarloResult fixed;
+    REQUIRE(MonteCarlo(handler, ship, {}, {}, options).run(fixed) == 0);
+    CHECK(fixed.nominalDeltaV == nominal);
+    CHECK_THAT(fixed.min, Catch::Matchers::WithinRel((double) nominal, 1e-13));
+    CHECK_THAT(fixed.max, Catch::Matchers::WithinRel((double) nominal, 1e-13));
+    CHECK(fixed.standardDeviation < 1e-9);
+
+    // Small normal tolerances on everything: the spread follows from the gradient to first order.
+    const long double spread = 0.005;
+    std::vector<StageTolerance> stageTolerances(4, {{DistributionKind::normal, spread},
+                                                    {DistributionKind::normal, spread}});
+    std::vector<EngineTolerance> engineTolerances;
+    for (EngineId engine : engines) {
+        engineTolerances.push_back({engine, {DistributionKind::normal, spread}, {DistributionKind::normal, spread}});
+    }
+    options.samples = 200'000;
+    options.seed = 77;
+    options.threads = 4;
+    options.requiredDeltaVs = {0, nominal, nominal + 1e6};
+    MonteCarloResult result;
+    REQUIRE(MonteCarlo(handler, ship, stageTolerances, engineTolerances, options).run(result) == 0);
+
+    const DeltaVGradient gradient = ship->getDeltaVGradient();
+    long double variance = 0;
+    for (uint i = 0; i < 4; i++) {
+        const long double terms[] = {gradient.dryMass[i] * ship->getStageDryMass(i),
+                                     gradient.fuelMass[i] * ship->getStageFuelMass(i),
+                                     gradient.engineMass[i] * ship->getStageEngineMass(i),
+                                     gradient.exhaustVelocity[i] * ship->getStageExhaustVelocity(i)};
+        for (long double term : terms) {
+            variance += term * spread * term * spread;
+        }
+    }
+    const double sigma = (double) sqrtl(variance);
+    CHECK_THAT(result.standardDeviation, Catch::Matchers::WithinRel(sigma, 0.02));
+    CHECK(fabs(result.mean - (double) nominal) < 0.05 * sigma);
+    CHECK(result.min < result.percentiles[0]);
+    CHECK(result.percentiles[4] < result.max);
+    CHECK(std::is_sorted(result.percentiles.begin(), result.percentiles.end()));
+    CHECK_THAT(result.percentiles[2], Catch::Matchers::WithinRel(result.mean, 2e-3));
+    CHECK(result.sketch.getCount() == options.samples);
+    CHECK(result.violationProbabilities[0] == 0);
+    CHECK(fabs(result.violationProbabilities[1] - 0.5) < 0.01);
+    CHECK(result.violationProbabilities[2] == 1);
+
+    // Same seed, same results, whatever the threads and chunks.
+    options.threads = 1;
+    options.chunkSize = 5'000;
+    MonteCarloResult serial;
+    REQUIRE(MonteCarlo(handler, ship, stageTolerances, engineTolerances, options).run(serial) == 0);
+    CHECK(serial.mean == result.mean);
+    CHECK(serial.standardDeviation == result.standardDeviation);
+    CHECK(serial.percentiles == result.percentiles);
+    CHECK(serial.violationProbabilities == result.violationProbabilities);
+    options.seed = 78;
+    MonteCarloResult reseeded;
+    REQUIRE(MonteCarlo(handler, ship, stageTolerances, engineTolerances, options).run(reseeded) == 0);
+    CHECK(reseeded.mean != result.mean);
+
+    // Uniform draws stay in their band; shared engine draws are the same for every stage using the engine.
+    auto* twin = handler.addShip();
+    twin->addStage(5'000, 40'000, engines[0]);
+    twin->addStage(5'000, 40'000, engines[0]);
+    const std::vector<EngineTolerance> uniformEngine = {{engines[0], {DistributionKind::uniform, 0.1},
+                                                         {DistributionKind::fixed, 0}}};
+    MonteCarlo scatter(handler, twin, {}, uniformEngine, options);
+    options.sharedEngineDraws = true;
+    MonteCarlo shared(handler, twin, {}, uniformEngine, options);
+    const double engineMass = (double) twin->getStageEngineMass(0);
+    std::vector<double> values;
+    for (uint64_t sample = 0; sample < 100; sample++) {
+        REQUIRE(scatter.getSample(sample, values) == 0);
+        CHECK(values[2] >= 0.9 * engineMass);
+        CHECK(values[2] <= 1.1 * engineMass);
+        CHECK(values[2] != values[6]);
+        CHECK(values[3] == values[7]);
+        REQUIRE(shared.getSample(sample, values) == 0);
+        CHECK(values[2] == values[6]);
+    }
+
+    MonteCarloResult unused;
+    CHECK(MonteCarlo(handler, ship, std::vector<StageTolerance>(2), {}, options).run(unused) == 1);
+    CHECK(MonteCarlo(handler, ship, {}, {{EngineId(999), {}, {}}}, options).run(unused) == 1);
+    CHECK(MonteCarlo(handler, ship, {}, {{engines[0], {DistributionKind::normal, -1}, {}}}, options).run(unused)
+          == 1);
+}
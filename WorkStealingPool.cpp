@@ -0,0 +1,118 @@
+//
+// Created by user on 6/21/23.
+//
+
+#include "WorkStealingPool.h"
+#include <mpfr.h>
+
+WorkStealingPool::WorkStealingPool(unsigned threads) : steals(0) {
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        queues.emplace_back(new Queue());
+    }
+    for (unsigned i = 1; i < threads; i++) {
+        workers.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+size_t WorkStealingPool::run(const std::vector<size_t>& order, const std::function<void(size_t)>& task) {
+    std::lock_guard<std::mutex> running(runMutex);
+    for (size_t i = 0; i < order.size(); i++) {
+        queues[i % queues.size()]->tasks.push_back(order[i]);              // Workers are idle, no lock needed yet
+    }
+    steals.store(0, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        this->task = &task;
+        error = nullptr;
+        busy = (unsigned) workers.size();
+        generation++;
+    }
+    wake.notify_all();
+
+    drain(0);
+
+    std::unique_lock<std::mutex> lock(stateMutex);
+    finished.wait(lock, [this]() { return busy == 0; });
+    this->task = nullptr;
+    if (error) {
+        std::exception_ptr thrown = error;
+        error = nullptr;
+        std::rethrow_exception(thrown);
+    }
+    return steals.load(std::memory_order_relaxed);
+}
+
+void WorkStealingPool::workerLoop(unsigned worker) {
+    unsigned long seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(stateMutex);
+            wake.wait(lock, [&]() { return stopping || generation != seen; });
+            if (stopping) {
+                break;
+            }
+            seen = generation;
+        }
+        drain(worker);
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            busy--;
+        }
+        finished.notify_one();
+    }
+    mpfr_free_cache2(MPFR_FREE_LOCAL_CACHE);
+}
+
+void WorkStealingPool::drain(unsigned worker) {
+    size_t index;
+    while (next(worker, index)) {
+        try {
+            (*task)(index);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+}
+
+bool WorkStealingPool::next(unsigned worker, size_t& index) {
+    {
+        Queue& own = *queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            index = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues.size(); i++) {                            // Own queue is empty, steal the smallest
+        Queue& victim = *queues[(worker + i) % queues.size()];              // task of the next worker that has one
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            index = victim.tasks.back();
+            victim.tasks.pop_back();
+            steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,88 @@
+//
+// Created by user on 6/21/23.
+//
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <atomic>
+#include <cstddef>
+
+#ifndef IRA_WORKSTEALINGPOOL_H
+#define IRA_WORKSTEALINGPOOL_H
+
+/**
+ * @brief Fixed set of worker threads that run a batch of indexed tasks, stealing from each other when they run dry.
+ * @details Tasks are dealt round-robin into one queue per worker in the order given. A worker takes from the front of
+ *          its own queue and, once it is empty, steals from the back of another's. Given tasks sorted from most to
+ *          least work, every worker starts on big tasks and the small ones at the back even out the finish.
+ *          The calling thread works as one of the workers. Threads live as long as the pool, so anything they keep
+ *          per thread (MpfrScratch pools, MPFR caches, GMP free lists) stays warm between runs.
+ */
+class WorkStealingPool {
+public:
+    /**
+     * @brief Starts the workers.
+     * @param threads Number of threads that run tasks, including the caller of run. 0 means one per core.
+     */
+    explicit WorkStealingPool(unsigned threads);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool& other) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool& other) = delete;
+
+    /**
+     * @brief Runs task(i) for every i in order and waits for all of them.
+     * @note Runs from different threads take turns. A task must not call run on its own pool. If a task throws, the
+     *       remaining tasks still run and the first exception is rethrown.
+     * @param order Task indices, the ones with the most work first.
+     * @param task Called once per index, from any worker.
+     * @return Number of tasks a worker stole from another's queue.
+     */
+    size_t run(const std::vector<size_t>& order, const std::function<void(size_t)>& task);
+
+    unsigned getThreadCount() const {
+        return (unsigned) queues.size();
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;     /**< One per worker; queues[0] belongs to the caller of run. */
+    std::vector<std::thread> workers;               /**< Background workers 1 .. n - 1. */
+
+    std::mutex runMutex;                            /**< Held for the whole of a run. */
+    std::mutex stateMutex;                          /**< Guards everything below. */
+    std::condition_variable wake,                   /**< Signals a new run, or shutdown, to the workers. */
+    finished;                                       /**< Signals the caller that a worker is done with the run. */
+    const std::function<void(size_t)>* task = nullptr;
+    unsigned long generation = 0;                   /**< Incremented by every run. */
+    unsigned busy = 0;                              /**< Background workers still in the current run. */
+    bool stopping = false;
+    std::exception_ptr error;                       /**< First exception thrown by a task in the current run. */
+    std::atomic<size_t> steals;
+
+    void workerLoop(unsigned worker);
+
+    /**
+     * @brief Runs tasks until every queue is empty.
+     */
+    void drain(unsigned worker);
+
+    /**
+     * @brief Takes the next task for a worker, its own first, then stolen.
+     * @return false once every queue is empty.
+     */
+    bool next(unsigned worker, size_t& index);
+};
+
+
+#endif //IRA_WORKSTEALINGPOOL_H
@@ -3,8 +3,10 @@
 #include <random>
 #include <cstdlib>
 #include "SpaceShipHandler.h"
+#include "MpfrScratch.h"
 
 int main () {
+    MpfrScratch::recycleAllocations();
     std::vector<SpaceShipWrapper*> ships;
     std::random_device rd;
     std::mt19937 gen(rd());
@@ -17,11 +19,12 @@ int main () {
     ships.reserve(3);
     for (int i = 0; i < 3; i++) {
         auto ship = handler.addShip();
+        ship->reserveStages(5);
         for (int j = 0; j < 5; j++) {
             auto engineName = "S" + std::to_string(i) + "." + std::to_string(j);
             long double vals[4] = {rnd(), rnd(), rnd(), rnd()};
-            handler.createEngine(engineName, vals[0], vals[1]);
-            ship->addStage(vals[2], vals[3], handler.getEngine(engineName));
+            auto engine = handler.createEngineId(engineName, vals[0], vals[1]);
+            ship->addStage(vals[2], vals[3], engine);
             //printf("ln((%.64Lf + %.64Lf + %.64Lf) / (%.64Lf + %.64Lf)) * %.64Lf\n", vals[0], vals[2], vals[3], vals[0], vals[2], vals[1]);
         }
         ship->printStats();